@@ -26,20 +26,6 @@
  *   const char* node, const char* search, const char* empty_match);
  * bool js_node_has_id(
  *   const char* node, const char* search, const char* empty_match);
- * bool js_node_has_attribute(
- *   const char* node, const char* search, const char* empty_match);
- * bool js_node_has_attribute_equal(
- *   const char* node, const char* search, const char* match);
- * bool js_node_has_attribute_dashmatch(
- *   const char* node, const char* search, const char* match);
- * bool js_node_has_attribute_includes(
- *   const char* node, const char* search, const char* match);
- * bool js_node_has_attribute_prefix(
- *   const char* node, const char* search, const char* match);
- * bool js_node_has_attribute_suffix(
- *   const char* node, const char* search, const char* match);
- * bool js_node_has_attribute_substring(
- *   const char* node, const char* search, const char* match);
  * bool js_node_is_root(
  *   const char* node, const char* empty_search, const char* empty_match);
  * int32_t js_node_count_siblings(const char* node, bool same_name, bool after);
@@ -66,7 +52,7 @@
  * bool js_node_is_lang(
  *   const char* node, const char* search, const char* empty_match);
  *
- * const int js_ua_font_size();
+ * const char* js_node_attributes(const char* node);
  *
  * The client must implement the following handler functions:
  *
@@ -93,12 +79,22 @@
  *   returns a boolean: true if node has no children or text; otherwise false.
  */
 
+var Readable = require('stream').Readable;
 var lh = require('./lib/libcss.js');
 
 var ch; //Client handler functions
+var incremental = false; // Whether styled nodes are kept between queries
 
 const DEFAULT_FONT_SIZE = 160;
 
+// Rendering environment of new contexts (see setEnvironment)
+const DEFAULT_ENVIRONMENT = {
+  fontSize: DEFAULT_FONT_SIZE / 10,
+  fontFamily: 'sans-serif',
+  color: '#000000',
+  exRatio: 0.6
+};
+
 const error = [
   'OK',
   'Invalid element!',
@@ -117,37 +113,165 @@ const error = [
   'Unable to append data to stylesheet!',
   'Unable to declare the data on the stylesheet as done!',
   'Unable to append stylesheet to selection context!',
-  'Invalid length of handler functions array!'
+  'Invalid length of handler functions array!',
+  'The buffer for the results is too small!',
+  'Unsupported property!',
+  'Invalid document!',
+  'Invalid rendering environment!',
+  'Invalid presentational hint!',
+  'Invalid stylesheet!',
+  'The stylesheet has no source to prune!'
 ];
 
+// Same as css_js_column_kind
+const columnKind = {
+  keyword: 0,
+  length: 1,
+  number: 2,
+  color: 3,
+  integer: 4
+};
+
 function free(...args) {
-  for (let arg in args) {
+  for (let arg of args) {
     lh.Module._free(arg);
   }
 }
 
-function getSelfIndex(identifier, siblings) {
-  var selfIndex = -1;
+/*
+ * Sibling index cache.
+ *
+ * libcss asks for the preceding sibling, the first preceding sibling with a
+ * given name and the count of (same-named) siblings before or after a node.
+ * Answering those from a fresh getSiblings() array costs O(k) per call, so a
+ * parent with k children costs O(k^2) to style. Instead, the children of a
+ * parent are indexed once and the index is shared by all of them:
+ *
+ * {
+ *   node: <string>,          identifier of the node it was built for
+ *   parent: <string>,        identifier of the parent ('' if none), or
+ *                            undefined until a notification needs it
+ *   siblings: <array>,       getSiblings() result, in document order
+ *   index: <Map>,            identifier -> position in siblings
+ *   sameNameBefore: <array>, count of same-named (case-insensitive) siblings
+ *                            before each position
+ *   nameCounts: <Map>,       lowercased tag name -> count of children
+ *   firstByName: <Map>       tag name -> position of its first occurrence
+ * }
+ *
+ * Entries live until childrenChanged() is called for their parent. Styling
+ * needs no parent, so it is only taken from the node store when a
+ * notification has to find the entry of a parent.
+ */
+var siblingGroups = new Map(); // node identifier -> sibling index
+var parentGroups = new Map(); // parent identifier -> sibling index
+var unparentedGroups = new Set(); // Indexes not yet in parentGroups
+
+function dropSiblingGroup(group) {
+  for (let sibling of group.siblings) {
+    if (siblingGroups.get(sibling.identifier) === group) {
+      siblingGroups.delete(sibling.identifier);
+    }
+  }
+  unparentedGroups.delete(group);
+  if (parentGroups.get(group.parent) === group) {
+    parentGroups.delete(group.parent);
+  }
+}
+
+function clearSiblingGroups() {
+  siblingGroups.clear();
+  parentGroups.clear();
+  unparentedGroups.clear();
+}
+
+// Files the pending indexes under the parent that the node store recorded
+// for the node they were built for, oldest first, so that a newer index of
+// the same parent replaces an older one. Indexes whose node is no longer
+// stored are dropped.
+function resolveSiblingGroups() {
+  for (let group of unparentedGroups) {
+    let nodePtr = pointerize(group.node);
+    let parentPtr = lh.Module._malloc(4);
+    let err = lh.getNodeParent(nodePtr, parentPtr);
+    let ptr = lh.Module.getValue(parentPtr, 'i32');
+    free(nodePtr, parentPtr);
+    if (error[err] !== 'OK')
+      throw new Error(error[err]);
+
+    if (ptr === 0) {
+      dropSiblingGroup(group);
+      continue;
+    }
+    group.parent = lh.Module.Pointer_stringify(ptr);
+    let previous = parentGroups.get(group.parent);
+    if (previous !== undefined) {
+      dropSiblingGroup(previous);
+    }
+    parentGroups.set(group.parent, group);
+  }
+  unparentedGroups.clear();
+}
+
+function getSiblingGroup(identifier) {
+  var group = siblingGroups.get(identifier);
+  if (group !== undefined) {
+    return group;
+  }
+
+  var siblings = ch.getSiblings(identifier);
+  group = {
+    node: identifier,
+    parent: undefined,
+    siblings: siblings,
+    index: new Map(),
+    sameNameBefore: new Array(siblings.length),
+    nameCounts: new Map(),
+    firstByName: new Map()
+  };
   for (let i = 0; i < siblings.length; i++) {
-    if (siblings[i].identifier === identifier) {
-      selfIndex = i;
-      break;
+    // Entries without a tag name match no type selector, as before
+    let tagName = typeof siblings[i].tagName === 'string'
+      ? siblings[i].tagName : '';
+    let lowerName = tagName.toLowerCase();
+    let count = group.nameCounts.get(lowerName) || 0;
+    group.index.set(siblings[i].identifier, i);
+    group.sameNameBefore[i] = count;
+    group.nameCounts.set(lowerName, count + 1);
+    if (!group.firstByName.has(tagName)) {
+      group.firstByName.set(tagName, i);
     }
   }
-  if (selfIndex === -1) {
+
+  // Do not index a list that does not describe the node being queried.
+  if (!group.index.has(identifier)) {
+    return group;
+  }
+
+  unparentedGroups.add(group);
+  for (let sibling of siblings) {
+    siblingGroups.set(sibling.identifier, group);
+  }
+
+  return group;
+}
+
+function getSelfIndex(identifier, group) {
+  var selfIndex = group.index.get(identifier);
+  if (selfIndex === undefined) {
     throw new Error(
       'The siblings array does not contain the node being queried!');
   }
   return selfIndex;
 }
 
-function getPrevSibling(identifier, siblings) {
-  var index = getSelfIndex(identifier, siblings);
+function getPrevSibling(identifier, group) {
+  var index = getSelfIndex(identifier, group);
   if (index === 0) {
     return null;
   }
   else {
-    return siblings[index - 1];
+    return group.siblings[index - 1];
   }
 }
 
@@ -171,6 +295,11 @@ function optionalHandler (node, chFun) {
   return chFun(nodeId);
 }
 
+function getParent (node) {
+  var ancestors = ch.getAncestors(node);
+  return ancestors[0] ? ancestors[0].identifier : '';
+}
+
 function pointerize (results) {
   var ptr = lh.Module.allocate(
     lh.Module.intArrayFromString(results), 'i8', lh.Module.ALLOC_NORMAL);
@@ -228,8 +357,7 @@ var exportFunctions = [
     var nodeId = lh.Module.Pointer_stringify(node);
     var siblingName = lh.Module.Pointer_stringify(sibling);
     var results = '';
-    var siblings = ch.getSiblings(nodeId);
-    var prevSibling = getPrevSibling(nodeId, siblings);
+    var prevSibling = getPrevSibling(nodeId, getSiblingGroup(nodeId));
     if (prevSibling && prevSibling.tagName === siblingName) {
       results = prevSibling.identifier;
     }
@@ -239,13 +367,12 @@ var exportFunctions = [
     var nodeId = lh.Module.Pointer_stringify(node);
     var siblingName = lh.Module.Pointer_stringify(sibling);
     var results = '';
-    var siblings = ch.getSiblings(nodeId);
-    for (let sibling of siblings) {
-      if (sibling.identifier === nodeId) break;
-      if (sibling.tagName === siblingName) {
-        results = sibling.identifier;
-        break;
-      }
+    var group = getSiblingGroup(nodeId);
+    var selfIndex = group.index.get(nodeId);
+    var first = group.firstByName.get(siblingName);
+    if (first !== undefined &&
+      (selfIndex === undefined || first < selfIndex)) {
+      results = group.siblings[first].identifier;
     }
     return pointerize(results);
   },
@@ -261,8 +388,7 @@ var exportFunctions = [
   function js_sibling_node(node) {
     var nodeId = lh.Module.Pointer_stringify(node);
     var results = '';
-    var siblings = ch.getSiblings(nodeId);
-    var prevSibling = getPrevSibling(nodeId, siblings);
+    var prevSibling = getPrevSibling(nodeId, getSiblingGroup(nodeId));
     if (prevSibling) {
       results = prevSibling.identifier;
     }
@@ -300,97 +426,6 @@ var exportFunctions = [
     }
     return false;
   },
-  function js_node_has_attribute(node, search, empty_match) {
-    var nodeId = lh.Module.Pointer_stringify(node);
-    var query = lh.Module.Pointer_stringify(search).toLowerCase();
-    var attributes = ch.getAttributes(nodeId);
-    for (let attribute of attributes) {
-      if (attribute.attribute.toLowerCase() === query) {
-        return true;
-      }
-    }
-    return false;
-  },
-  function js_node_has_attribute_equal(node, search, match) {
-    var nodeId = lh.Module.Pointer_stringify(node);
-    var query = lh.Module.Pointer_stringify(search);
-    var value = lh.Module.Pointer_stringify(match);
-    var attributes = ch.getAttributes(nodeId);
-    for (let attribute of attributes) {
-      if (attribute.attribute.toLowerCase() === query &&
-        attribute.value.toLowerCase() === value) {
-        return true;
-      }
-    }
-    return false;
-  },
-  function js_node_has_attribute_dashmatch(node, search, match) {
-    var nodeId = lh.Module.Pointer_stringify(node);
-    var query = lh.Module.Pointer_stringify(search);
-    var value = lh.Module.Pointer_stringify(match);
-    var attributes = ch.getAttributes(nodeId);
-    for (let attribute of attributes) {
-      if (attribute.attribute.toLowerCase() === query &&
-        (attribute.value.toLowerCase() === value ||
-          attribute.value.toLowerCase() === value.concat('-'))) {
-        return true;
-      }
-    }
-    return false;
-  },
-  function js_node_has_attribute_includes(node, search, match) {
-    var nodeId = lh.Module.Pointer_stringify(node);
-    var query = lh.Module.Pointer_stringify(search);
-    var value = lh.Module.Pointer_stringify(match);
-    var attributes = ch.getAttributes(nodeId);
-    for (let attribute of attributes) {
-      if (attribute.attribute.toLowerCase() === query &&
-        attribute.value.toLowerCase().indexOf(value) !== -1) {
-        return true;
-      }
-    }
-    return false;
-  },
-  function js_node_has_attribute_prefix(node, search, match) {
-    var nodeId = lh.Module.Pointer_stringify(node);
-    var query = lh.Module.Pointer_stringify(search);
-    var value = lh.Module.Pointer_stringify(match);
-    var attributes = ch.getAttributes(nodeId);
-    for (let attribute of attributes) {
-      if (attribute.attribute.toLowerCase() === query &&
-        attribute.value.toLowerCase().startsWith(value)) {
-        return true;
-      }
-    }
-    return false;
-  },
-  function js_node_has_attribute_suffix(node, search, match) {
-    var nodeId = lh.Module.Pointer_stringify(node);
-    var query = lh.Module.Pointer_stringify(search);
-    var value = lh.Module.Pointer_stringify(match);
-    var attributes = ch.getAttributes(nodeId);
-    for (let attribute of attributes) {
-      if (attribute.attribute.toLowerCase() === query &&
-        attribute.value.toLowerCase().endsWith(value)) {
-        return true;
-      }
-    }
-    return false;
-  },
-  function js_node_has_attribute_substring(node, search, match) {
-    // I don't see the difference between this and has_attribute_includes
-    var nodeId = lh.Module.Pointer_stringify(node);
-    var query = lh.Module.Pointer_stringify(search);
-    var value = lh.Module.Pointer_stringify(match);
-    var attributes = ch.getAttributes(nodeId);
-    for (let attribute of attributes) {
-      if (attribute.attribute.toLowerCase() === query &&
-        attribute.value.toLowerCase().indexOf(value) !== -1) {
-        return true;
-      }
-    }
-    return false;
-  },
   function js_node_is_root(node, empty_search, empty_match) {
     var nodeId = lh.Module.Pointer_stringify(node);
     var ancestors = ch.getAncestors(nodeId);
@@ -398,29 +433,18 @@ var exportFunctions = [
   },
   function js_node_count_siblings(node, same_name, after) {
     var nodeId = lh.Module.Pointer_stringify(node);
-    var siblings = ch.getSiblings(nodeId);
-    var selfIndex = getSelfIndex(nodeId, siblings);
+    var group = getSiblingGroup(nodeId);
+    var selfIndex = getSelfIndex(nodeId, group);
     if (same_name) {
-      var count = 0;
-      var tagName = siblings[selfIndex].tagName.toLowerCase();
+      var before = group.sameNameBefore[selfIndex];
       if (after) {
-        for (let i = selfIndex + 1; i < siblings.length; i++) {
-          if (siblings[i].tagName.toLowerCase() === tagName) {
-            count++;
-          }
-        }
-      }
-      else {
-        for (let i = 0; i < selfIndex; i++) {
-          if (siblings[i].tagName.toLowerCase() === tagName) {
-            count++;
-          }
-        }
+        var tagName = group.siblings[selfIndex].tagName.toLowerCase();
+        return group.nameCounts.get(tagName) - before - 1;
       }
-      return count;
+      return before;
     }
     else {
-      return after ? siblings.length - selfIndex - 1 : selfIndex;
+      return after ? group.siblings.length - selfIndex - 1 : selfIndex;
     }
   },
   function js_node_is_empty(node, empty_search, empty_match) {
@@ -434,7 +458,7 @@ var exportFunctions = [
     }
     var attributes = ch.getAttributes(nodeId);
     for (let attribute of attributes) {
-      if (attribute.tagName.toLowerCase() === 'href' &&
+      if (attribute.attribute.toLowerCase() === 'href' &&
         attribute.value) {
         return true;
       }
@@ -473,15 +497,19 @@ var exportFunctions = [
     var language = lh.Module.Pointer_stringify(search);
     return ch.isLang(nodeId, language);
   },
-  function js_ua_font_size() {
-    if (typeof ch.uaFontSize !== 'function') {
-      return DEFAULT_FONT_SIZE;
+  // The attribute table of a node, which attribute selectors match against.
+  function js_node_attributes(node) {
+    var nodeId = lh.Module.Pointer_stringify(node);
+    var attributes = ch.getAttributes(nodeId);
+    var data = attributes.length + '\0';
+    for (let attribute of attributes) {
+      data += attribute.attribute + '\0' + attribute.value + '\0';
     }
-    return ch.uaFontSize();
+    return pointerize(data);
   }
 ];
 
-module.exports.init = function (clientHandlers) {
+function checkHandlers (clientHandlers) {
   var requiredHandlers = [
     'getTagName',
     'getAttributes',
@@ -494,31 +522,293 @@ module.exports.init = function (clientHandlers) {
       throw new Error('Function ' + handler + ' not provided!');
     }
   }
-  ch = clientHandlers;
+}
+
+// The exported functions dispatch to the handlers of the current context,
+// so they only take function table slots once.
+var handlersSet = false;
+
+function setHandlers () {
+  if (handlersSet)
+    return;
+
+  // The native module takes the first <count> handlers.
+  var countPtr = lh.Module._malloc(Uint32Array.BYTES_PER_ELEMENT);
+  lh.getHandlerCount(countPtr);
+  var count = lh.Module.getValue(countPtr, 'i32');
+  free(countPtr);
 
   // Function pointers should be 64-bit.
   var handlerPtr = lh.Module._malloc(
-    exportFunctions.length * Uint32Array.BYTES_PER_ELEMENT * 2);
-  for (let i = 0; i < exportFunctions.length; i++) {
+    count * Uint32Array.BYTES_PER_ELEMENT * 2);
+  for (let i = 0; i < count; i++) {
     let funPtr = lh.Runtime.addFunction(exportFunctions[i]);
     lh.Module.setValue(
       handlerPtr + i * Uint32Array.BYTES_PER_ELEMENT * 2, funPtr, '*');
   }
 
-  var err = lh.setHandlers(handlerPtr, exportFunctions.length);
+  var err = lh.setHandlers(handlerPtr, count);
+  free(handlerPtr);
+  if (error[err] !== 'OK') {
+    throw new Error(error[err]);
+  };
+  handlersSet = true;
+}
+
+module.exports.init = function (clientHandlers, options) {
+  checkHandlers(clientHandlers);
+  if (typeof options !== 'object' || options === null) options = {};
+  activate(defaultContext);
+  setHandlers();
+  ch = clientHandlers;
+  incremental = options.incremental === true;
+  dropTree();
+  if (typeof ch.uaFontSize === 'function')
+    api.setEnvironment({ fontSize: ch.uaFontSize() / 10 });
+}
+
+/*
+ * Lazy style handles.
+ *
+ * A handle references a computed style in the native module and decodes
+ * properties one by one, on first access, through handle.get(name) or
+ * handle[name]. Releasing handles explicitly frees the native style as soon
+ * as possible; otherwise they are released when garbage-collected, where
+ * FinalizationRegistry is available.
+ */
+const handleRegistry = typeof FinalizationRegistry === 'function'
+  ? new FinalizationRegistry(ptr => lh.releaseStyleHandle(ptr))
+  : null;
+
+class StyleHandle {
+  constructor (ptr) {
+    this.ptr = ptr;
+    this.values = new Map();
+    if (ptr !== 0 && handleRegistry !== null)
+      handleRegistry.register(this, ptr, this);
+  }
+
+  get (property) {
+    if (this.values.has(property))
+      return this.values.get(property);
+    if (this.ptr === 0)
+      return undefined;
+
+    const resultsLength = 1024;
+    var resultsPtr = lh.Module._malloc(resultsLength);
+    var propertyPtr = pointerize(property);
+    var err = lh.getHandleProperty(
+      this.ptr, propertyPtr, resultsPtr, resultsLength);
+    var value = lh.Module.Pointer_stringify(resultsPtr);
+    free(resultsPtr, propertyPtr);
+
+    if (error[err] !== 'OK')
+      throw new Error(error[err]);
+
+    if (value === '') value = undefined;
+    this.values.set(property, value);
+    return value;
+  }
+
+  release () {
+    if (this.ptr === 0)
+      return;
+    if (handleRegistry !== null)
+      handleRegistry.unregister(this);
+    lh.releaseStyleHandle(this.ptr);
+    this.ptr = 0;
+  }
+}
+
+// Lets handle[name] stand for handle.get(name)
+const handleProxy = {
+  get (target, property) {
+    if (typeof property !== 'string' || property in target) {
+      let value = target[property];
+      return typeof value === 'function' ? value.bind(target) : value;
+    }
+    return target.get(property);
+  }
+};
+
+function getStyleHandle (node, options, inlineStyle) {
+  var handlePtr = lh.Module._malloc(4);
+  var nodePtr = pointerize(node);
+  var pseudoPtr = pointerize(options.pseudo);
+  var mediaPtr = pointerize(options.media);
+  var inlinePtr = pointerize(inlineStyle);
+
+  var err = lh.getStyleHandle(
+    nodePtr, pseudoPtr, mediaPtr, inlinePtr, handlePtr);
+  var ptr = lh.Module.getValue(handlePtr, 'i32') >>> 0;
+  free(nodePtr, pseudoPtr, mediaPtr, inlinePtr, handlePtr);
+
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+
+  return new Proxy(new StyleHandle(ptr), handleProxy);
+}
+
+/*
+ * Numeric styles.
+ *
+ * Names and kinds of the properties that the native module reads
+ * numerically, fetched once.
+ */
+var numericProperties = null;
+
+function getNumericProperties () {
+  if (numericProperties !== null)
+    return numericProperties;
+
+  const namesLength = 4096;
+  const maxCount = 256;
+  var namesPtr = lh.Module._malloc(namesLength);
+  var kindsPtr = lh.Module._malloc(maxCount);
+  var countPtr = lh.Module._malloc(4);
+
+  var err = lh.getNumericProperties(namesPtr, namesLength, kindsPtr, countPtr);
   if (error[err] !== 'OK') {
+    free(namesPtr, kindsPtr, countPtr);
     throw new Error(error[err]);
+  }
+
+  var count = lh.Module.getValue(countPtr, 'i32');
+  numericProperties = {
+    names: lh.Module.Pointer_stringify(namesPtr).split(','),
+    kinds: lh.Module.HEAPU8.slice(kindsPtr, kindsPtr + count)
   };
+  free(namesPtr, kindsPtr, countPtr);
+
+  return numericProperties;
+}
+
+function getNumericStyle (node, options, inlineStyle) {
+  var properties = getNumericProperties();
+  const count = properties.names.length;
+
+  var typesPtr = lh.Module._malloc(count);
+  var valuesPtr = lh.Module._malloc(count * 4);
+  var unitsPtr = lh.Module._malloc(count);
+  var hasStylePtr = lh.Module._malloc(1);
+  var nodePtr = pointerize(node);
+  var pseudoPtr = pointerize(options.pseudo);
+  var mediaPtr = pointerize(options.media);
+  var inlinePtr = pointerize(inlineStyle);
+
+  var err = lh.getStyleNumeric(nodePtr, pseudoPtr, mediaPtr, inlinePtr,
+    typesPtr, valuesPtr, unitsPtr, hasStylePtr);
+
+  var style = {};
+  if (error[err] === 'OK' && lh.Module.HEAPU8[hasStylePtr] !== 0) {
+    const types = lh.Module.HEAPU8;
+    const floats = lh.Module.HEAPF32;
+    const uints = lh.Module.HEAPU32;
+    const ints = lh.Module.HEAP32;
+    const values = valuesPtr >> 2;
+    for (let i = 0; i < count; i++) {
+      let type = types[typesPtr + i];
+      switch (properties.kinds[i]) {
+        case columnKind.keyword:
+          style[properties.names[i]] = type;
+          break;
+        case columnKind.length:
+          style[properties.names[i]] = {
+            type: type,
+            value: floats[values + i],
+            unit: types[unitsPtr + i]
+          };
+          break;
+        case columnKind.number:
+          style[properties.names[i]] = {
+            type: type,
+            value: floats[values + i]
+          };
+          break;
+        case columnKind.color:
+          style[properties.names[i]] = uints[values + i];
+          break;
+        case columnKind.integer:
+          style[properties.names[i]] = {
+            type: type,
+            value: ints[values + i]
+          };
+          break;
+      }
+    }
+  }
+
+  free(typesPtr, valuesPtr, unitsPtr, hasStylePtr, nodePtr, pseudoPtr,
+    mediaPtr, inlinePtr);
+
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+
+  return style;
+}
+
+function getInlineStyle (node) {
+  if (documentStyles !== null) {
+    let style = documentStyles.get(node);
+    return style === undefined ? '' : style;
+  }
+
+  var attributes = ch.getAttributes(node);
+  for (let attribute of attributes) {
+    if (attribute.attribute.toLowerCase() === 'style')
+      return attribute.value;
+  }
+  return '';
+}
+
+function parseStyle (results) {
+  var resultsArr = results.split('\n');
+  var resultsObj = {};
+  for (let line of resultsArr) {
+    let colon = line.indexOf(':');
+    if (colon > 0) {
+      let prop = line.substring(0, colon).trim();
+      let value = line.substring(colon + 1).trim();
+      resultsObj[prop] = value;
+    }
+  }
+  return resultsObj;
+}
+
+function parsePseudoStyles (results, pseudo) {
+  if (pseudo !== 'all')
+    return parseStyle(results);
+
+  // One section per pseudo-element, each headed by a line like '::before'
+  var resultsObj = {};
+  var sections = results.split(/^::/m);
+  for (let section of sections) {
+    let newline = section.indexOf('\n');
+    if (newline > 0) {
+      resultsObj[section.substring(0, newline)] =
+        parseStyle(section.substring(newline + 1));
+    }
+  }
+  return resultsObj;
 }
 
 module.exports.getStyle = function (node, options) {
+  try {
+    return computeStyle(node, options);
+  }
+  finally {
+    forgetTree();
+  }
+}
+
+function computeStyle (node, options) {
   if (typeof node !== 'string')
     throw new Error('Node identifier must be a string!');
 
   if (typeof options !== 'object' || options === null) options = {};
 
   const supportedPseudo = [
-    'none', 'first-line', 'first-letter', 'before', 'after'];
+    'none', 'first-line', 'first-letter', 'before', 'after', 'all'];
   if (typeof options.pseudo !== 'undefined') {
     if (supportedPseudo.indexOf(options.pseudo) === -1) {
       throw new Error('Supported values for pseudo-elements are ' +
@@ -529,26 +819,44 @@ module.exports.getStyle = function (node, options) {
     options.pseudo = 'none';
   }
 
-  if (typeof options.media !== 'string')
+  var mediaList = null;
+  if (Array.isArray(options.media)) {
+    mediaList = [];
+    for (let medium of options.media) {
+      if (typeof medium !== 'string')
+        throw new Error('Media must be strings!');
+      medium = medium.trim();
+      if (mediaList.indexOf(medium) === -1) mediaList.push(medium);
+    }
+    if (mediaList.length === 0) mediaList.push('all');
+  }
+  else if (typeof options.media !== 'string') {
     options.media = 'all';
+  }
 
-  var inlineStyle = '';
-  var attributes = ch.getAttributes(node);
-  for (let attribute of attributes) {
-    if (attribute.attribute.toLowerCase() === 'style') {
-      inlineStyle = attribute.value;
-      break;
-    }
+  var inlineStyle = getInlineStyle(node);
+
+  if (options.lazy === true || options.numeric === true) {
+    if (mediaList !== null || options.pseudo === 'all')
+      throw new Error('Lazy and numeric styles are for a single medium ' +
+        'and pseudo-element!');
+    if (options.lazy === true)
+      return getStyleHandle(node, options, inlineStyle);
+    return getNumericStyle(node, options, inlineStyle);
   }
 
-  const resultsLength = 8192; // Same as in libcss's selection test.
+  // Same as in libcss's selection test, for each pseudo-element and medium.
+  var resultsLength = options.pseudo === 'all' ? 5 * 8192 : 8192;
+  if (mediaList !== null) resultsLength *= mediaList.length;
   var resultsPtr = lh.Module._malloc(resultsLength);
   var nodePtr = pointerize(node);
   var pseudoPtr = pointerize(options.pseudo);
-  var mediaPtr = pointerize(options.media);
+  var mediaPtr = pointerize(
+    mediaList !== null ? mediaList.join(',') : options.media);
   var inlinePtr = pointerize(inlineStyle);
 
-  var err = lh.getStyle(
+  var getStyle = mediaList !== null ? lh.getStyleMedia : lh.getStyle;
+  var err = getStyle(
     nodePtr, pseudoPtr, mediaPtr, inlinePtr, resultsPtr, resultsLength);
   if (error[err] !== 'OK') {
     free(nodePtr, pseudoPtr, mediaPtr, inlinePtr, resultsPtr);
@@ -558,40 +866,543 @@ module.exports.getStyle = function (node, options) {
   var results = lh.Module.Pointer_stringify(resultsPtr);
   free(nodePtr, pseudoPtr, mediaPtr, inlinePtr, resultsPtr);
 
-  var resultsArr = results.split('\n');
+  if (mediaList === null)
+    return parsePseudoStyles(results, options.pseudo);
+
+  // One section per group of media sharing their results, each headed by
+  // a line like '@media screen,tv'
   var resultsObj = {};
-  for (let line of resultsArr) {
-    let colon = line.indexOf(':');
-    if (colon > 0) {
-      let prop = line.substring(0, colon).trim();
-      let value = line.substring(colon + 1).trim();
-      resultsObj[prop] = value;
+  var sections = results.split(/^@media /m);
+  for (let section of sections) {
+    let newline = section.indexOf('\n');
+    if (newline > 0) {
+      let style = parsePseudoStyles(
+        section.substring(newline + 1), options.pseudo);
+      for (let medium of section.substring(0, newline).split(',')) {
+        resultsObj[medium] = style;
+      }
     }
   }
 
   return resultsObj;
 }
 
-module.exports.addSheet = function (sheet, options) {
-  if (typeof sheet !== 'string')
-    throw new Error('Argument must be a string!');
+module.exports.getStyleId = function (node, options) {
+  if (typeof node !== 'string')
+    throw new Error('Node identifier must be a string!');
 
-  if (options === null || typeof options !== 'object') options = {};
-  if (typeof options.level !== 'string') options.level = '3';
-  if (typeof options.origin !== 'string') options.origin = 'author';
-  if (typeof options.url !== 'string') options.url = '';
-  if (typeof options.allowQuirks !== 'boolean') options.allowQuirks = false;
+  if (typeof options !== 'object' || options === null) options = {};
 
-  var media = '';
-  if (Array.isArray(options.media)) {
-    for (let str of options.media) {
-      if (typeof str === 'string') {
-        if (media.length > 0) media += ',';
-        media += str.trim();
-      }
+  const supportedPseudo = [
+    'none', 'first-line', 'first-letter', 'before', 'after'];
+  if (typeof options.pseudo !== 'undefined') {
+    if (supportedPseudo.indexOf(options.pseudo) === -1) {
+      throw new Error('Supported values for pseudo-elements are ' +
+        JSON.stringify(supportedPseudo));
     }
   }
-  if (media === '') media = 'all';
+  else {
+    options.pseudo = 'none';
+  }
+
+  if (typeof options.media !== 'string')
+    options.media = 'all';
+
+  var idPtr = lh.Module._malloc(4);
+  var nodePtr = pointerize(node);
+  var pseudoPtr = pointerize(options.pseudo);
+  var mediaPtr = pointerize(options.media);
+  var inlinePtr = pointerize(getInlineStyle(node));
+
+  var err = lh.getStyleId(nodePtr, pseudoPtr, mediaPtr, inlinePtr, idPtr);
+  var id = lh.Module.getValue(idPtr, 'i32') >>> 0;
+  free(nodePtr, pseudoPtr, mediaPtr, inlinePtr, idPtr);
+  forgetTree();
+
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+
+  return id;
+}
+
+module.exports.exportColumns = function (nodes, properties, options) {
+  if (!Array.isArray(nodes))
+    throw new Error('Node identifiers must be an array!');
+  if (!Array.isArray(properties))
+    throw new Error('Properties must be an array!');
+  for (let property of properties) {
+    if (typeof property !== 'string')
+      throw new Error('Properties must be strings!');
+  }
+
+  if (typeof options !== 'object' || options === null) options = {};
+  if (typeof options.media !== 'string')
+    options.media = 'all';
+
+  var elements = '';
+  var inlineStyles = '';
+  for (let node of nodes) {
+    if (typeof node !== 'string')
+      throw new Error('Node identifier must be a string!');
+    elements += node + '\0';
+    inlineStyles += getInlineStyle(node) + '\0';
+  }
+
+  // Type, value and unit columns for each property, as 64-bit pointers.
+  const count = nodes.length;
+  const pointerSize = Uint32Array.BYTES_PER_ELEMENT * 2;
+  var columnsPtr = lh.Module._malloc(properties.length * 3 * pointerSize);
+  var buffers = [];
+  for (let i = 0; i < properties.length; i++) {
+    let typePtr = lh.Module._malloc(count);
+    let valuePtr = lh.Module._malloc(count * 4);
+    let unitPtr = lh.Module._malloc(count);
+    buffers.push(typePtr, valuePtr, unitPtr);
+    lh.Module.setValue(columnsPtr + (3 * i) * pointerSize, typePtr, '*');
+    lh.Module.setValue(columnsPtr + (3 * i + 1) * pointerSize, valuePtr, '*');
+    lh.Module.setValue(columnsPtr + (3 * i + 2) * pointerSize, unitPtr, '*');
+  }
+  var kindsPtr = lh.Module._malloc(properties.length);
+  var elementsPtr = pointerize(elements);
+  var inlinePtr = pointerize(inlineStyles);
+  var mediaPtr = pointerize(options.media);
+  var propertiesPtr = pointerize(properties.join(','));
+
+  var err = lh.exportColumns(elementsPtr, inlinePtr, count, mediaPtr,
+    propertiesPtr, columnsPtr, kindsPtr);
+  forgetTree();
+
+  var columns = {};
+  if (error[err] === 'OK') {
+    const heap = lh.Module.HEAPU8.buffer;
+    for (let i = 0; i < properties.length; i++) {
+      let kind = lh.Module.HEAPU8[kindsPtr + i];
+      let [typePtr, valuePtr, unitPtr] = buffers.slice(3 * i, 3 * i + 3);
+      let column = { type: new Uint8Array(heap, typePtr, count).slice() };
+      if (kind === columnKind.length || kind === columnKind.number)
+        column.value = new Float32Array(heap, valuePtr, count).slice();
+      else if (kind === columnKind.color)
+        column.value = new Uint32Array(heap, valuePtr, count).slice();
+      else if (kind === columnKind.integer)
+        column.value = new Int32Array(heap, valuePtr, count).slice();
+      if (kind === columnKind.length)
+        column.unit = new Uint8Array(heap, unitPtr, count).slice();
+      columns[properties[i]] = column;
+    }
+  }
+
+  free(columnsPtr, kindsPtr, elementsPtr, inlinePtr, mediaPtr, propertiesPtr,
+    ...buffers);
+
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+
+  return columns;
+}
+
+/*
+ * Styled-tree streams.
+ *
+ * The subtree is walked depth-first, one node per record, only as fast as
+ * the consumer reads. Once a node's subtree has been emitted, its computed
+ * styles are dropped from the native node store.
+ */
+function getChildren (node) {
+  if (documentChildren !== null) {
+    let children = documentChildren.get(node);
+    if (children === undefined)
+      throw new Error('Invalid element!');
+    return children;
+  }
+
+  if (typeof ch.getChildren !== 'function')
+    throw new Error('Function getChildren not provided!');
+  return ch.getChildren(node).map(child => child.identifier);
+}
+
+function releaseSubtree (node) {
+  resolveSiblingGroups();
+  var group = parentGroups.get(node);
+  if (group !== undefined)
+    dropSiblingGroup(group);
+
+  var nodePtr = pointerize(node);
+  var err = lh.nodeRemoved(nodePtr);
+  free(nodePtr);
+
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+}
+
+// Record of a node's numeric style: the identifier's length (uint32) and
+// UTF-8 bytes, then per property a type (uint8), a unit (uint8) and a value
+// (float32, uint32 or int32, per kind), all little-endian.
+function encodeNumericStyle (node, style, properties) {
+  var identifier = Buffer.from(node, 'utf8');
+  var record = Buffer.alloc(4 + identifier.length +
+    6 * properties.names.length);
+  record.writeUInt32LE(identifier.length, 0);
+  identifier.copy(record, 4);
+
+  var offset = 4 + identifier.length;
+  for (let i = 0; i < properties.names.length; i++, offset += 6) {
+    let value = style[properties.names[i]];
+    if (value === undefined)
+      continue;
+    switch (properties.kinds[i]) {
+      case columnKind.keyword:
+        record.writeUInt8(value, offset);
+        break;
+      case columnKind.color:
+        record.writeUInt32LE(value, offset + 2);
+        break;
+      case columnKind.length:
+        record.writeUInt8(value.unit, offset + 1);
+        // Falls through
+      case columnKind.number:
+        record.writeUInt8(value.type, offset);
+        record.writeFloatLE(value.value, offset + 2);
+        break;
+      case columnKind.integer:
+        record.writeUInt8(value.type, offset);
+        record.writeInt32LE(value.value, offset + 2);
+        break;
+    }
+  }
+
+  return record;
+}
+
+module.exports.styleTreeStream = function (root, options) {
+  if (typeof root !== 'string')
+    throw new Error('Node identifier must be a string!');
+
+  if (typeof options !== 'object' || options === null) options = {};
+  var format = options.format === undefined ? 'ndjson' : options.format;
+  if (format !== 'ndjson' && format !== 'binary')
+    throw new Error('Supported formats are ["ndjson","binary"]');
+
+  var styleOptions = {};
+  if (options.pseudo !== undefined) styleOptions.pseudo = options.pseudo;
+  if (options.media !== undefined) styleOptions.media = options.media;
+  if (format === 'binary') styleOptions.numeric = true;
+  var release = options.release !== false;
+  var properties = format === 'binary' ? getNumericProperties() : null;
+
+  // Each entry holds a node and the index of its next child to emit.
+  var stack = [ { node: root, children: null, next: 0 } ];
+  // Other contexts may be used between reads.
+  var context = currentContext;
+
+  var stream = new Readable({
+    read () {
+      try {
+        activate(context);
+        while (stack.length > 0) {
+          let top = stack[stack.length - 1];
+          if (top.children === null) {
+            let style = computeStyle(
+              top.node, Object.assign({}, styleOptions));
+            top.children = getChildren(top.node);
+            let record = format === 'binary'
+              ? encodeNumericStyle(top.node, style, properties)
+              : JSON.stringify({ identifier: top.node, style: style }) + '\n';
+            if (!this.push(record))
+              return;
+          }
+          else if (top.next < top.children.length) {
+            stack.push({
+              node: top.children[top.next++], children: null, next: 0 });
+          }
+          else {
+            stack.pop();
+            if (release)
+              releaseSubtree(top.node);
+          }
+        }
+        forgetTree();
+        this.push(null);
+      }
+      catch (err) {
+        this.destroy(err);
+      }
+    }
+  });
+
+  if (properties !== null)
+    stream.properties = properties.names;
+  return stream;
+}
+
+// Same order as css_js_stat
+const memoryStats = [
+  'heap', 'strings', 'nodes', 'styles', 'sheets', 'text', 'shares'
+];
+
+module.exports.getMemoryStats = function () {
+  var statsPtr = lh.Module._malloc(memoryStats.length * 4);
+  var err = lh.getMemoryStats(statsPtr);
+
+  var stats = {};
+  for (let i = 0; i < memoryStats.length; i++) {
+    stats[memoryStats[i]] = lh.Module.getValue(statsPtr + i * 4, 'i32') >>> 0;
+  }
+  free(statsPtr);
+
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+
+  return stats;
+}
+
+/*
+ * Returns a function that reads the null-terminated strings at <ptr>, one
+ * after the other.
+ */
+function fieldReader (ptr) {
+  return function () {
+    var field = lh.Module.UTF8ToString(ptr);
+    ptr += lh.Module.lengthBytesUTF8(field) + 1;
+    return field;
+  };
+}
+
+/*
+ * Selector profiling. The profile covers the selections made, in any
+ * context, between startProfiling and stopProfiling. Starting drops the
+ * styles known to every context, so that they are selected again.
+ */
+module.exports.startProfiling = function () {
+  var err = lh.setProfiling(true);
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+}
+
+module.exports.stopProfiling = function () {
+  var err = lh.setProfiling(false);
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+}
+
+module.exports.getProfile = function (top) {
+  if (top === undefined || top === null)
+    top = 0;
+  if (!Number.isInteger(top) || top < 0)
+    throw new Error('Count of selectors must be a non-negative integer!');
+
+  var totalsPtr = lh.Module._malloc(2 * Float64Array.BYTES_PER_ELEMENT);
+  var countPtr = lh.Module._malloc(4);
+  var reportPtr = lh.Module._malloc(4);
+  var err = lh.getProfile(top, totalsPtr, countPtr, reportPtr);
+
+  var profile = null;
+  if (error[err] === 'OK') {
+    let count = lh.Module.getValue(countPtr, 'i32');
+    let report = lh.Module.getValue(reportPtr, 'i32');
+    let next = fieldReader(report);
+
+    profile = {
+      selections: lh.Module.getValue(totalsPtr, 'double'),
+      selectionTime: lh.Module.getValue(totalsPtr + 8, 'double') / 1e6,
+      selectors: []
+    };
+    for (let i = 0; i < count; i++) {
+      let selector = next();
+      let url = next();
+      let origin = next();
+      let sheet = Number(next());
+      let rule = Number(next());
+      let tests = Number(next());
+      let matches = Number(next());
+      profile.selectors.push({
+        selector: selector,
+        url: url,
+        origin: origin,
+        sheet: sheet,
+        rule: rule,
+        tests: tests,
+        matches: matches,
+        rejects: tests - matches,
+        matchRatio: tests === 0 ? 0 : matches / tests,
+        callbacks: Number(next()),
+        time: Number(next()) / 1e6,
+        exact: next() === '1'
+      });
+    }
+    free(report);
+  }
+  free(totalsPtr, countPtr, reportPtr);
+
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+
+  return profile;
+}
+
+/*
+ * Rule coverage. Like profiling, it covers the selections made in any
+ * context between startCoverage and stopCoverage, and starting drops the
+ * styles known to every context.
+ */
+module.exports.startCoverage = function () {
+  var err = lh.setCoverage(true);
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+}
+
+module.exports.stopCoverage = function () {
+  var err = lh.setCoverage(false);
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+}
+
+module.exports.getCoverage = function () {
+  var countPtr = lh.Module._malloc(4);
+  var reportPtr = lh.Module._malloc(4);
+  var err = lh.getCoverage(countPtr, reportPtr);
+
+  var sheets = [];
+  if (error[err] === 'OK') {
+    let count = lh.Module.getValue(countPtr, 'i32');
+    let report = lh.Module.getValue(reportPtr, 'i32');
+    let next = fieldReader(report);
+
+    for (let i = 0; i < count; i++) {
+      let sheet = {
+        sheet: i,
+        url: next(),
+        origin: next(),
+        prunable: next() === '1',
+        used: 0,
+        rules: []
+      };
+      let rules = Number(next());
+      for (let j = 0; j < rules; j++) {
+        let rule = { rule: j, selector: next(), matches: Number(next()) };
+        if (rule.matches > 0)
+          sheet.used++;
+        sheet.rules.push(rule);
+      }
+      sheets.push(sheet);
+    }
+    free(report);
+  }
+  free(countPtr, reportPtr);
+
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+
+  return sheets;
+}
+
+module.exports.getPrunedSheet = function (sheet) {
+  if (!Number.isInteger(sheet) || sheet < 0)
+    throw new Error('Invalid stylesheet!');
+
+  var textPtr = lh.Module._malloc(4);
+  var err = lh.getPrunedSheet(sheet, textPtr);
+
+  var text = null;
+  if (error[err] === 'OK') {
+    let ptr = lh.Module.getValue(textPtr, 'i32');
+    text = lh.Module.UTF8ToString(ptr);
+    free(ptr);
+  }
+  free(textPtr);
+
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+
+  return text;
+}
+
+/*
+ * Shared stylesheets.
+ *
+ * A stylesheet parsed once with parseSheet can be added to any number of
+ * contexts. The native stylesheet is freed once it is released and no
+ * context uses it anymore.
+ */
+const sheetRegistry = typeof FinalizationRegistry === 'function'
+  ? new FinalizationRegistry(ptr => lh.releaseStylesheet(ptr))
+  : null;
+
+class Sheet {
+  constructor (ptr) {
+    this.ptr = ptr;
+    if (sheetRegistry !== null)
+      sheetRegistry.register(this, ptr, this);
+  }
+
+  release () {
+    if (this.ptr === 0)
+      return;
+    if (sheetRegistry !== null)
+      sheetRegistry.unregister(this);
+    lh.releaseStylesheet(this.ptr);
+    this.ptr = 0;
+  }
+}
+
+module.exports.parseSheet = function (sheet, options) {
+  if (typeof sheet !== 'string')
+    throw new Error('Argument must be a string!');
+
+  if (options === null || typeof options !== 'object') options = {};
+  if (typeof options.level !== 'string') options.level = '3';
+  if (typeof options.url !== 'string') options.url = '';
+  if (typeof options.allowQuirks !== 'boolean') options.allowQuirks = false;
+
+  var handlePtr = lh.Module._malloc(4);
+  var sheetPtr = pointerize(sheet);
+  var levelPtr = pointerize(options.level);
+  var urlPtr = pointerize(options.url);
+
+  var err = lh.parseStylesheet(sheetPtr, levelPtr, urlPtr,
+    options.allowQuirks, handlePtr);
+  var ptr = lh.Module.getValue(handlePtr, 'i32') >>> 0;
+  free(handlePtr, sheetPtr, levelPtr, urlPtr);
+
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+
+  return new Sheet(ptr);
+}
+
+module.exports.addSheet = function (sheet, options) {
+  if (typeof sheet !== 'string' && !(sheet instanceof Sheet))
+    throw new Error('Argument must be a string or a parsed sheet!');
+
+  if (options === null || typeof options !== 'object') options = {};
+  if (typeof options.level !== 'string') options.level = '3';
+  if (typeof options.origin !== 'string') options.origin = 'author';
+  if (typeof options.url !== 'string') options.url = '';
+  if (typeof options.allowQuirks !== 'boolean') options.allowQuirks = false;
+
+  var media = '';
+  if (Array.isArray(options.media)) {
+    for (let str of options.media) {
+      if (typeof str === 'string') {
+        if (media.length > 0) media += ',';
+        media += str.trim();
+      }
+    }
+  }
+  if (media === '') media = 'all';
+
+  if (sheet instanceof Sheet) {
+    if (sheet.ptr === 0)
+      throw new Error('The sheet was released!');
+
+    let originPtr = pointerize(options.origin);
+    let mediaPtr = pointerize(media);
+    let err = lh.attachStylesheet(sheet.ptr, originPtr, mediaPtr);
+    free(originPtr, mediaPtr);
+
+    if (error[err] !== 'OK')
+      throw new Error(error[err]);
+    return;
+  }
 
   var sheetPtr = pointerize(sheet);
   var levelPtr = pointerize(options.level);
@@ -607,9 +1418,646 @@ module.exports.addSheet = function (sheet, options) {
     throw new Error(error[err]);
 }
 
+// Same order as css_js_sheet_stat
+const sheetStats = [
+  'rules', 'styleRules', 'mediaRules', 'selectors',
+  'id', 'class', 'tag', 'universal', 'attribute', 'pseudoClass',
+  'pseudoElement',
+  'descendant', 'child', 'adjacent', 'sibling',
+  'bytecode', 'size',
+  'idKeys', 'idLargest', 'classKeys', 'classLargest', 'elementKeys',
+  'elementLargest', 'universalChain'
+];
+const DEPTH_COUNT = 8;
+
+/*
+ * Statistics of a stylesheet: a sheet from parseSheet, or the index of a
+ * sheet added to the current context.
+ */
+module.exports.sheetStats = function (sheet) {
+  var handle = 0;
+  var index = 0;
+  if (sheet instanceof Sheet) {
+    if (sheet.ptr === 0)
+      throw new Error('The sheet was released!');
+    handle = sheet.ptr;
+  }
+  else if (Number.isInteger(sheet) && sheet >= 0) {
+    index = sheet;
+  }
+  else {
+    throw new Error('Invalid stylesheet!');
+  }
+
+  var count = sheetStats.length + DEPTH_COUNT;
+  var statsPtr = lh.Module._malloc(count * 4);
+  var err = lh.getSheetStats(handle, index, statsPtr);
+
+  var values = [];
+  for (let i = 0; i < count; i++)
+    values.push(lh.Module.getValue(statsPtr + i * 4, 'i32') >>> 0);
+  free(statsPtr);
+
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+
+  var raw = {};
+  for (let i = 0; i < sheetStats.length; i++)
+    raw[sheetStats[i]] = values[i];
+
+  return {
+    rules: raw.rules,
+    styleRules: raw.styleRules,
+    mediaRules: raw.mediaRules,
+    selectors: raw.selectors,
+    simpleSelectors: {
+      id: raw.id,
+      class: raw.class,
+      tag: raw.tag,
+      universal: raw.universal,
+      attribute: raw.attribute,
+      pseudoClass: raw.pseudoClass,
+      pseudoElement: raw.pseudoElement
+    },
+    combinators: {
+      descendant: raw.descendant,
+      child: raw.child,
+      adjacent: raw.adjacent,
+      sibling: raw.sibling
+    },
+    depth: values.slice(sheetStats.length),
+    bytecode: raw.bytecode,
+    size: raw.size,
+    hash: {
+      ids: { keys: raw.idKeys, largest: raw.idLargest },
+      classes: { keys: raw.classKeys, largest: raw.classLargest },
+      elements: { keys: raw.elementKeys, largest: raw.elementLargest },
+      universal: raw.universalChain
+    }
+  };
+}
+
+/*
+ * Adds the HTML user-agent stylesheet that is built into the native module.
+ */
+module.exports.addDefaultSheet = function () {
+  var err = lh.attachHtmlStylesheet();
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+}
+
+/*
+ * Parses a color: a number (0xAARRGGBB) or a string in
+ * the formats '#rgb', '#rrggbb' or '#aarrggbb'. Returns null if invalid.
+ */
+function parseColor (color) {
+  if (typeof color === 'number')
+    return Number.isInteger(color) && color >= 0 && color <= 0xffffffff
+      ? color : null;
+  if (typeof color !== 'string' || !/^#([0-9a-f]{3}){1,2}$|^#[0-9a-f]{8}$/i
+      .test(color))
+    return null;
+
+  var hex = color.substring(1);
+  if (hex.length === 3)
+    hex = hex.replace(/./g, '$&$&');
+  if (hex.length === 6)
+    hex = 'ff' + hex;
+  return parseInt(hex, 16);
+}
+
+/*
+ * Sets the rendering environment of the context: the values that computed
+ * styles take where the stylesheets don't set them. Members not given keep
+ * their current value.
+ */
+module.exports.setEnvironment = function (options) {
+  var environment = Object.assign({}, currentContext.environment, options);
+  var fontSize = Math.round(Number(environment.fontSize) * 10);
+  var color = parseColor(environment.color);
+  var exRatio = Number(environment.exRatio);
+  if (!(fontSize > 0) || color === null || !(exRatio > 0))
+    throw new Error('Invalid rendering environment!');
+
+  var current = currentContext.environment;
+  if (fontSize === Math.round(Number(current.fontSize) * 10) &&
+      String(environment.fontFamily) === String(current.fontFamily) &&
+      color === parseColor(current.color) &&
+      exRatio === Number(current.exRatio))
+    return;
+
+  var familyPtr = pointerize(String(environment.fontFamily));
+  var err = lh.setEnvironment(fontSize, familyPtr, color, exRatio);
+  free(familyPtr);
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+
+  currentContext.environment = environment;
+}
+
+/*
+ * Presentational hints: typed values for HTML attributes such as width,
+ * bgcolor or align, applied as author rules of no specificity. Unlike
+ * inline styles, they need no stylesheet to be parsed for each element.
+ */
+function encodeHints (identifier, hints, data, values) {
+  data.push(identifier);
+  hints = hints || [];
+  values.push(hints.length);
+  for (let hint of hints) {
+    let value = hint.value;
+    data.push(String(hint.property));
+    if (typeof value === 'number' && hint.unit !== undefined) {
+      data.push(String(hint.unit));
+      values.push(value);
+    }
+    else if (typeof value === 'number' ||
+        (typeof value === 'string' && value[0] === '#')) {
+      let color = parseColor(value);
+      if (color === null)
+        throw new Error('Invalid presentational hint!');
+      data.push('');
+      values.push(color);
+    }
+    else {
+      data.push(String(value));
+      values.push(0);
+    }
+  }
+}
+
+module.exports.setHints = function (hints, elementHints) {
+  var data = [];
+  var values = [];
+  var count = 0;
+
+  if (typeof hints === 'string') {
+    encodeHints(hints, elementHints, data, values);
+    count = 1;
+  }
+  else {
+    let entries = hints instanceof Map
+      ? hints.entries() : Object.entries(hints);
+    for (let [identifier, list] of entries) {
+      encodeHints(identifier, list, data, values);
+      count++;
+    }
+  }
+
+  var dataPtr = pointerize(data.join('\0') + '\0');
+  var valuesPtr = lh.Module._malloc(Math.max(values.length, 1) * 8);
+  for (let i = 0; i < values.length; i++)
+    lh.Module.setValue(valuesPtr + i * 8, values[i], 'double');
+
+  var err = lh.setHints(dataPtr, valuesPtr, count);
+  free(dataPtr, valuesPtr);
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+}
+
 module.exports.dropSheets = function () {
   var err = lh.resetCtx();
   if (error[err] !== 'OK')
     throw new Error(error[err]);
 }
 
+
+/*
+ * Handler-free mode.
+ *
+ * A document loaded with loadDocument is encoded once in the native module,
+ * which then answers the selectors itself instead of calling the client
+ * handlers. Loaded documents are static: mutation notifications do not
+ * apply to them; load the document again instead.
+ */
+var documentStyles = null; // node identifier -> inline style
+var documentChildren = null; // node identifier -> children identifiers
+var documentCount = 0;
+
+function getDocumentAttributes (node) {
+  var attributes = [];
+  if (Array.isArray(node.attributes)) {
+    for (let attribute of node.attributes) {
+      attributes.push([String(attribute.attribute), String(attribute.value)]);
+    }
+  }
+  else if (typeof node.attributes === 'object' && node.attributes !== null) {
+    for (let name of Object.keys(node.attributes)) {
+      attributes.push([name, String(node.attributes[name])]);
+    }
+  }
+  return attributes;
+}
+
+function getDocumentTag (node) {
+  var tag = node.tag !== undefined ? node.tag : node.tagName;
+  if (typeof tag !== 'string' || tag === '')
+    throw new Error('Document nodes must have a tag name!');
+  return tag;
+}
+
+function newDocumentIdentifier () {
+  return 'libcss-document-' + (documentCount++);
+}
+
+// Records of a nested tree, in document order.
+function flattenNested (nodes, parent, records) {
+  for (let node of nodes) {
+    if (typeof node === 'string')
+      continue;
+    if (typeof node !== 'object' || node === null)
+      throw new Error('Invalid document!');
+
+    let children = Array.isArray(node.children) ? node.children : [];
+    let record = {
+      identifier: typeof node.identifier === 'string'
+        ? node.identifier : newDocumentIdentifier(),
+      tag: getDocumentTag(node),
+      parent: parent,
+      attributes: getDocumentAttributes(node),
+      hasText: node.hasText === true || children.some(child =>
+        typeof child === 'string' && child !== '')
+    };
+    records.push(record);
+    flattenNested(children, record.identifier, records);
+  }
+  return records;
+}
+
+// Records of a flat node array, reordered so that parents come first.
+function flattenFlat (nodes) {
+  var childrenOf = new Map(); // parent identifier -> records
+  for (let node of nodes) {
+    if (typeof node !== 'object' || node === null)
+      throw new Error('Invalid document!');
+
+    let parent = typeof node.parent === 'string' ? node.parent : '';
+    let record = {
+      identifier: typeof node.identifier === 'string'
+        ? node.identifier : newDocumentIdentifier(),
+      tag: getDocumentTag(node),
+      parent: parent,
+      attributes: getDocumentAttributes(node),
+      hasText: node.hasText === true ||
+        (typeof node.text === 'string' && node.text !== '')
+    };
+    if (!childrenOf.has(parent))
+      childrenOf.set(parent, []);
+    childrenOf.get(parent).push(record);
+  }
+
+  var records = [];
+  var visit = parent => {
+    for (let record of childrenOf.get(parent) || []) {
+      records.push(record);
+      visit(record.identifier);
+    }
+  };
+  visit('');
+
+  // Nodes whose parent is missing are not reachable from the top level.
+  if (records.length !== nodes.length)
+    throw new Error('Invalid document!');
+  return records;
+}
+
+module.exports.loadDocument = function (tree) {
+  var nodes = Array.isArray(tree) ? tree : [ tree ];
+  var isFlat = nodes.some(node => typeof node === 'object' && node !== null &&
+    node.parent !== undefined);
+  var records = isFlat ? flattenFlat(nodes) : flattenNested(nodes, '', []);
+
+  var data = '';
+  var styles = new Map();
+  var children = new Map();
+  for (let record of records) {
+    data += record.identifier + '\0' + record.tag + '\0' + record.parent +
+      '\0' + record.attributes.length + '\0';
+    let style = '';
+    for (let [name, value] of record.attributes) {
+      data += name + '\0' + value + '\0';
+      if (name.toLowerCase() === 'style' && style === '')
+        style = value;
+    }
+    data += (record.hasText ? '1' : '0') + '\0';
+    styles.set(record.identifier, style);
+    children.set(record.identifier, []);
+    if (record.parent !== '')
+      children.get(record.parent).push(record.identifier);
+  }
+
+  var dataPtr = pointerize(data);
+  var err = lh.loadDocument(dataPtr, records.length);
+  free(dataPtr);
+
+  clearSiblingGroups();
+  if (error[err] !== 'OK') {
+    documentStyles = null;
+    documentChildren = null;
+    throw new Error(error[err]);
+  }
+
+  documentStyles = styles;
+  documentChildren = children;
+  return records.map(record => record.identifier);
+}
+
+module.exports.unloadDocument = function () {
+  documentStyles = null;
+  documentChildren = null;
+  var err = lh.unloadDocument();
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+}
+
+// Discards the styled nodes and the sibling indexes.
+function dropTree () {
+  clearSiblingGroups();
+  var err = lh.dropNodes();
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+}
+
+// Unless the context is incremental, nothing is kept after a query, since
+// the tree may change without notifications. Loaded documents are static.
+function forgetTree () {
+  if (!incremental && documentStyles === null)
+    dropTree();
+}
+
+// A loaded document is static, and the handlers may not know its nodes.
+function checkNoDocument () {
+  if (documentStyles !== null)
+    throw new Error('A loaded document is static: load it again instead!');
+}
+
+module.exports.attributeChanged = function (node, name, oldValue) {
+  checkNoDocument();
+  if (typeof node !== 'string')
+    throw new Error('Node identifier must be a string!');
+  if (typeof name !== 'string')
+    throw new Error('Attribute name must be a string!');
+  if (oldValue !== undefined && oldValue !== null &&
+    typeof oldValue !== 'string')
+    throw new Error('Old attribute value must be a string!');
+
+  var newValue = '';
+  for (let attribute of ch.getAttributes(node)) {
+    if (attribute.attribute.toLowerCase() === name.toLowerCase()) {
+      newValue = attribute.value;
+      break;
+    }
+  }
+  var hasOldValue = typeof oldValue === 'string';
+
+  var nodePtr = pointerize(node);
+  var parentPtr = pointerize(getParent(node));
+  var namePtr = pointerize(name);
+  var oldPtr = pointerize(hasOldValue ? oldValue : '');
+  var newPtr = pointerize(newValue);
+
+  var err = lh.attributeChanged(nodePtr, parentPtr, namePtr,
+    oldPtr, newPtr, hasOldValue);
+  free(nodePtr, parentPtr, namePtr, oldPtr, newPtr);
+
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+}
+
+module.exports.stateChanged = function (node, state) {
+  checkNoDocument();
+  if (typeof node !== 'string')
+    throw new Error('Node identifier must be a string!');
+  if (typeof state !== 'string')
+    throw new Error('State must be a string!');
+
+  var nodePtr = pointerize(node);
+  var parentPtr = pointerize(getParent(node));
+  var statePtr = pointerize(state);
+
+  var err = lh.stateChanged(nodePtr, parentPtr, statePtr);
+  free(nodePtr, parentPtr, statePtr);
+
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+}
+
+module.exports.childrenChanged = function (parent) {
+  var err;
+
+  checkNoDocument();
+
+  if (typeof parent === 'undefined') {
+    dropTree();
+    return;
+  }
+
+  if (typeof parent !== 'string')
+    throw new Error('Node identifier must be a string!');
+
+  resolveSiblingGroups();
+  var group = parentGroups.get(parent);
+  if (group !== undefined) {
+    dropSiblingGroup(group);
+  }
+
+  var nodePtr = pointerize(parent);
+  var parentPtr = pointerize(getParent(parent));
+
+  err = lh.childrenChanged(nodePtr, parentPtr);
+  free(nodePtr, parentPtr);
+
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+}
+
+module.exports.nodeRemoved = function (node) {
+  checkNoDocument();
+  if (typeof node !== 'string')
+    throw new Error('Node identifier must be a string!');
+
+  resolveSiblingGroups();
+  var group = siblingGroups.get(node);
+  var parent = (group !== undefined) ? group.parent : getParent(node);
+
+  var nodePtr = pointerize(node);
+  var err = lh.nodeRemoved(nodePtr);
+  free(nodePtr);
+
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+
+  if (parent !== '') {
+    api.childrenChanged(parent);
+  }
+}
+
+/*
+ * Selection contexts.
+ *
+ * Each context has its own stylesheets, node store, handlers and loaded
+ * document. Only the current context is loaded in the native module; the
+ * state of this module that belongs to a context is swapped along with it.
+ */
+class Context {
+  constructor (handle, handlers, incremental) {
+    this.handle = handle;
+    this.handlers = handlers;
+    this.incremental = incremental;
+    this.siblingGroups = new Map();
+    this.parentGroups = new Map();
+    this.unparentedGroups = new Set();
+    this.documentStyles = null;
+    this.documentChildren = null;
+    this.environment = Object.assign({}, DEFAULT_ENVIRONMENT);
+  }
+}
+
+var defaultContext = new Context(0, undefined, false);
+var currentContext = defaultContext;
+
+function swapContext (context, save) {
+  if (save) {
+    currentContext.handlers = ch;
+    currentContext.incremental = incremental;
+    currentContext.siblingGroups = siblingGroups;
+    currentContext.parentGroups = parentGroups;
+    currentContext.unparentedGroups = unparentedGroups;
+    currentContext.documentStyles = documentStyles;
+    currentContext.documentChildren = documentChildren;
+  }
+
+  ch = context.handlers;
+  incremental = context.incremental;
+  siblingGroups = context.siblingGroups;
+  parentGroups = context.parentGroups;
+  unparentedGroups = context.unparentedGroups;
+  documentStyles = context.documentStyles;
+  documentChildren = context.documentChildren;
+  currentContext = context;
+}
+
+function activate (context) {
+  if (context === currentContext)
+    return;
+  if (context.handle === null)
+    throw new Error('The context was destroyed!');
+
+  var err = lh.useContext(context.handle);
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+
+  swapContext(context, true);
+}
+
+// The functions that work on the current context
+const contextFunctions = [
+  'addSheet', 'addDefaultSheet', 'dropSheets', 'setEnvironment', 'setHints',
+  'getStyle', 'getStyleId', 'exportColumns', 'styleTreeStream',
+  'loadDocument', 'unloadDocument', 'attributeChanged', 'stateChanged',
+  'childrenChanged', 'nodeRemoved', 'getMemoryStats', 'getCoverage',
+  'getPrunedSheet', 'sheetStats'
+];
+
+// Unbound functions, for use within this module
+const api = Object.assign({}, module.exports);
+
+for (let name of contextFunctions) {
+  module.exports[name] = function (...args) {
+    activate(defaultContext);
+    return api[name](...args);
+  };
+}
+
+function makeContextWrapper (context) {
+  var wrapper = {};
+  for (let name of contextFunctions) {
+    wrapper[name] = function (...args) {
+      activate(context);
+      return api[name](...args);
+    };
+  }
+
+  wrapper.derive = function (options) {
+    return deriveContext(context, options);
+  };
+
+  wrapper.destroy = function () {
+    if (context.handle === null)
+      return;
+    var err = lh.destroyContext(context.handle);
+    if (error[err] !== 'OK')
+      throw new Error(error[err]);
+
+    // The native module goes back to the default context
+    swapContext(defaultContext, currentContext !== context);
+    context.handle = null;
+  };
+
+  return wrapper;
+}
+
+function checkContextOptions (options) {
+  if (typeof options !== 'object' || options === null) options = {};
+  if (options.handlers !== undefined)
+    checkHandlers(options.handlers);
+  setHandlers();
+  return options;
+}
+
+// Applies the environment given by the options of a new context.
+function setContextEnvironment (wrapper, options) {
+  var environment = Object.assign({}, options.environment);
+  if (options.handlers !== undefined &&
+      typeof options.handlers.uaFontSize === 'function' &&
+      environment.fontSize === undefined)
+    environment.fontSize = options.handlers.uaFontSize() / 10;
+  if (Object.keys(environment).length > 0)
+    wrapper.setEnvironment(environment);
+  return wrapper;
+}
+
+module.exports.createContext = function (options) {
+  options = checkContextOptions(options);
+
+  var handlePtr = lh.Module._malloc(4);
+  var err = lh.createContext(handlePtr);
+  var handle = lh.Module.getValue(handlePtr, 'i32') >>> 0;
+  free(handlePtr);
+
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+
+  return setContextEnvironment(
+    makeContextWrapper(new Context(handle, options.handlers,
+      options.incremental === true)), options);
+}
+
+/*
+ * Creates a context that starts with the stylesheets of <base>. The sheets
+ * are shared, not parsed again; sheets added afterwards to either context
+ * don't affect the other. The handlers default to those of <base>.
+ */
+function deriveContext (base, options) {
+  options = checkContextOptions(options);
+  activate(base);
+
+  var handlePtr = lh.Module._malloc(4);
+  var err = lh.deriveContext(base.handle, handlePtr);
+  var handle = lh.Module.getValue(handlePtr, 'i32') >>> 0;
+  free(handlePtr);
+
+  if (error[err] !== 'OK')
+    throw new Error(error[err]);
+
+  var context = new Context(handle,
+    options.handlers !== undefined ? options.handlers : ch,
+    options.incremental !== undefined ? options.incremental === true
+      : incremental);
+  context.environment = Object.assign({}, base.environment);
+  return setContextEnvironment(makeContextWrapper(context), options);
+}
+
+module.exports.derive = function (options) {
+  return deriveContext(defaultContext, options);
+}
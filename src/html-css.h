@@ -0,0 +1,109 @@
+/* Generated from src/html.css (see README.build). Do not edit. */
+static const char html_css[] =
+	"/*\n"
+	" * html.css\n"
+	" *\n"
+	" * Built-in user-agent stylesheet for HTML documents.\n"
+	" * Based on the rendering section of the HTML standard and on the default\n"
+	" * stylesheet of netsurf, limited to what libcss supports.\n"
+	" * Compiled into the module as src/html-css.h (see README.build).\n"
+	" *\n"
+	" * Part of the libcss-js project.\n"
+	" */\n"
+	"\n"
+	"/* Hidden elements */\n"
+	"area, base, basefont, datalist, head, link, meta, noembed, noframes,\n"
+	"param, rp, script, style, template, title { display: none; }\n"
+	"[hidden] { display: none; }\n"
+	"\n"
+	"/* Flow content */\n"
+	"html, address, blockquote, body, center, dialog, div, figure, figcaption,\n"
+	"footer, form, header, hr, legend, listing, main, p, plaintext, pre,\n"
+	"search, xmp, article, aside, h1, h2, h3, h4, h5, h6, hgroup, nav,\n"
+	"section, details, summary, fieldset, optgroup, frameset, frame\n"
+	"{ display: block; }\n"
+	"\n"
+	"html { color: black; }\n"
+	"body { margin: 8px; }\n"
+	"\n"
+	"p, blockquote, figure, listing, plaintext, pre, xmp, dl, ol, ul, menu,\n"
+	"dir { margin-top: 1em; margin-bottom: 1em; }\n"
+	"blockquote, figure { margin-left: 40px; margin-right: 40px; }\n"
+	"\n"
+	"address, cite, dfn, em, i, var { font-style: italic; }\n"
+	"b, strong, th { font-weight: bold; }\n"
+	"code, kbd, samp, tt, listing, plaintext, pre, xmp {\n"
+	"	font-family: monospace;\n"
+	"}\n"
+	"listing, plaintext, pre, xmp { white-space: pre; }\n"
+	"center { text-align: center; }\n"
+	"small { font-size: smaller; }\n"
+	"big { font-size: larger; }\n"
+	"sub { vertical-align: sub; font-size: smaller; }\n"
+	"sup { vertical-align: super; font-size: smaller; }\n"
+	"s, strike, del { text-decoration: line-through; }\n"
+	"u, ins { text-decoration: underline; }\n"
+	"abbr[title], acronym[title] { text-decoration: underline; }\n"
+	"mark { background-color: yellow; color: black; }\n"
+	"nobr { white-space: nowrap; }\n"
+	"br { display: inline; }\n"
+	"q:before { content: open-quote; }\n"
+	"q:after { content: close-quote; }\n"
+	"\n"
+	"/* Headings */\n"
+	"h1 { font-size: 2em; margin-top: 0.67em; margin-bottom: 0.67em; }\n"
+	"h2 { font-size: 1.5em; margin-top: 0.83em; margin-bottom: 0.83em; }\n"
+	"h3 { font-size: 1.17em; margin-top: 1em; margin-bottom: 1em; }\n"
+	"h4 { margin-top: 1.33em; margin-bottom: 1.33em; }\n"
+	"h5 { font-size: 0.83em; margin-top: 1.67em; margin-bottom: 1.67em; }\n"
+	"h6 { font-size: 0.67em; margin-top: 2.33em; margin-bottom: 2.33em; }\n"
+	"h1, h2, h3, h4, h5, h6 { font-weight: bold; }\n"
+	"\n"
+	"/* Lists */\n"
+	"dir, dd, menu, ol, ul { display: block; }\n"
+	"li { display: list-item; }\n"
+	"dir, menu, ol, ul { padding-left: 40px; }\n"
+	"dd { margin-left: 40px; }\n"
+	"dl { display: block; }\n"
+	"ol { list-style-type: decimal; }\n"
+	"dir, menu, ul { list-style-type: disc; }\n"
+	"ol ol, ol ul, ul ol, ul ul, ol menu, ul menu, menu ol, menu ul,\n"
+	"ol dir, ul dir, dir ol, dir ul, menu menu, dir dir {\n"
+	"	margin-top: 0; margin-bottom: 0;\n"
+	"}\n"
+	"ol ul, ul ul, menu ul, dir ul, ol menu, ul menu, menu menu, dir menu,\n"
+	"ol dir, ul dir, menu dir, dir dir { list-style-type: circle; }\n"
+	"ol ol ul, ol ul ul, ul ol ul, ul ul ul, ol ol menu, ol ul menu,\n"
+	"ul ol menu, ul ul menu { list-style-type: square; }\n"
+	"\n"
+	"/* Tables */\n"
+	"table { display: table; border-spacing: 2px; border-collapse: separate;\n"
+	"	text-indent: 0; }\n"
+	"caption { display: table-caption; text-align: center; }\n"
+	"colgroup { display: table-column-group; }\n"
+	"col { display: table-column; }\n"
+	"thead { display: table-header-group; vertical-align: middle; }\n"
+	"tbody { display: table-row-group; vertical-align: middle; }\n"
+	"tfoot { display: table-footer-group; vertical-align: middle; }\n"
+	"tr { display: table-row; vertical-align: inherit; }\n"
+	"td, th { display: table-cell; vertical-align: inherit; padding: 1px; }\n"
+	"th { text-align: center; }\n"
+	"\n"
+	"/* Rules */\n"
+	"hr { color: gray; border-style: inset; border-width: 1px;\n"
+	"	margin-top: 0.5em; margin-bottom: 0.5em; }\n"
+	"\n"
+	"/* Links */\n"
+	"a:link { color: #0000ee; text-decoration: underline; }\n"
+	"a:visited { color: #551a8b; text-decoration: underline; }\n"
+	"a:link:active, a:visited:active { color: #ff0000; }\n"
+	"\n"
+	"/* Forms */\n"
+	"fieldset { margin-left: 2px; margin-right: 2px;\n"
+	"	border: 2px groove gray;\n"
+	"	padding: 0.35em 0.625em 0.75em 0.625em; }\n"
+	"legend { padding-left: 2px; padding-right: 2px; }\n"
+	"input, select, button, textarea { display: inline-block; }\n"
+	"input[type=hidden] { display: none; }\n"
+	"textarea { white-space: pre-wrap; }\n"
+	;
@@ -10,23 +10,71 @@
  */
 
 #include "libcss-js.h"
+#include "html-css.h"
 
 css_js_error set_handlers(uint64_t* arr, size_t len);
 css_js_error create_ctx (void);
-css_js_error append_stylesheet_list (css_stylesheet* new_sheet);
+css_js_error append_stylesheet_list (css_js_sheet* new_sheet,
+		css_origin origin, css_media_type media);
 css_js_error free_stylesheet_list (stylesheet_list** sheet_ptr);
+css_js_error create_stylesheet (const char* css_string,
+		css_language_level level, const char* url, bool allow_quirks,
+		css_js_sheet** ret);
+css_js_error release_sheet (css_js_sheet* sheet);
 css_js_error build_style(lwc_string* node, css_media_type media,
 		const char* inline_style, css_select_results** results);
+css_js_error compose_node_style (css_js_node* node,
+		const css_computed_style* parent_style,
+		css_pseudo_element pseudo);
+css_js_error compose_pseudo_element (css_js_node* node,
+		css_pseudo_element pseudo);
 css_js_error build_node_sr (lwc_string* node_str, css_pseudo_element pseudo,
 		css_media_type media, const char* inline_style,
 		css_js_node** ret_node);
-css_js_node* get_last_node (void);
 css_js_node* get_node_by_id (lwc_string* id);
-css_js_node* append_node (
-		lwc_string* id, css_select_results* new_sr, void* new_data);
-css_js_node* update_node (
-		lwc_string* id, css_select_results* new_sr, void* new_data);
-css_js_error free_node (css_js_node** node_ptr);
+css_js_node* append_node (lwc_string* id);
+css_js_error unlink_node (css_js_node* node);
+css_js_error free_node (css_js_node* node);
+css_js_error free_nodes (void);
+css_js_error clear_node_style (css_js_node* node);
+css_js_error select_node (css_js_node* node, css_js_node* parent,
+		lwc_string* parent_id, css_media_type media,
+		const char* inline_style);
+void mark_changed (const char* element, const char* parent, uint8_t scope);
+css_js_error index_stylesheet (const css_stylesheet* sheet,
+		css_media_type media);
+css_media_type get_equivalent_media (css_media_type media);
+uint8_t get_dependency_scope (css_js_dep_kind kind, const char* name,
+		size_t len);
+css_js_error free_dependency_index (void);
+css_computed_style* get_node_style (css_js_node* node,
+		css_pseudo_element pseudo);
+void release_style (css_js_style* style);
+css_js_interned* intern_style (css_computed_style* style,
+		css_js_style* owner);
+void release_interned (css_js_interned* entry);
+css_js_share* get_share_entry (css_js_share* parent, lwc_string* node,
+		css_media_type media);
+css_js_error free_share_cache (void);
+void release_share_entry (css_js_share* entry);
+void intern_lowercase (const char* name, size_t len, lwc_string** ret);
+void* hold_node (lwc_string* node);
+static css_error select_node_classes (void* pw, void* node,
+		lwc_string*** classes, uint32_t* n_classes);
+void release_held_nodes (void);
+css_js_hints* get_hints (lwc_string* node);
+css_js_error free_hints (void);
+css_js_doc_node* get_doc_node (lwc_string* id);
+static double profile_now (void);
+static void profile_selection (lwc_string* node, css_media_type media);
+static void forget_profiled_sheet (const css_stylesheet* sheet);
+static void count_rule_match (css_js_sheet* sheet, uint32_t position);
+static uint32_t count_style_rules (const css_rule* rule);
+static bool find_export_property (const char* name, size_t len,
+		size_t* prop);
+static css_js_error write_property (const css_computed_style* style,
+		size_t prop, char* buf, size_t len);
+void free_node_attributes (css_js_node* node);
 
 css_error resolve_url(void *pw, const char *base,
 		lwc_string *rel, lwc_string **abs);
@@ -131,21 +179,7 @@ bool (*js_node_has_class)(
 bool (*js_node_has_id)(
 		const char* node, const char* search, const char* empty_match
 		) = NULL;
-bool (*js_node_has_attribute)(
-		const char* node, const char* search, const char* empty_match
-		) = NULL;
-bool (*js_node_has_attribute_equal)(
-		const char* node, const char* search, const char* match) = NULL;
-bool (*js_node_has_attribute_dashmatch)(
-		const char* node, const char* search, const char* match) = NULL;
-bool (*js_node_has_attribute_includes)(
-		const char* node, const char* search, const char* match) = NULL;
-bool (*js_node_has_attribute_prefix)(
-		const char* node, const char* search, const char* match) = NULL;
-bool (*js_node_has_attribute_suffix)(
-		const char* node, const char* search, const char* match) = NULL;
-bool (*js_node_has_attribute_substring)(
-		const char* node, const char* search, const char* match) = NULL;
+char* (*js_node_attributes)(const char* node) = NULL;
 bool (*js_node_is_root)(
 		const char* node, const char* empty_search,
 		const char* empty_match) = NULL;
@@ -184,7 +218,13 @@ bool (*js_node_is_target)(
 bool (*js_node_is_lang)(
 		const char* node, const char* search, const char* empty_match
 		) = NULL;
-int32_t (*js_ua_font_size)(void) = NULL;
+
+/* Font size as in index.js; 1ex = 0.6em as in NetSurf */
+#define DEFAULT_ENVIRONMENT { 160, CSS_FONT_FAMILY_SANS_SERIF, 0xff000000, \
+		FLTTOFIX(0.6) }
+
+/* Rendering environment of the current context */
+css_js_env environment = DEFAULT_ENVIRONMENT;
 
 /**
  * Selection callback table for libcss
@@ -193,7 +233,7 @@ static css_select_handler selection_handler = {
 	CSS_SELECT_HANDLER_VERSION_1,
 
 	node_name,
-	node_classes,
+	select_node_classes,
 	node_id,
 	named_ancestor_node,
 	named_parent_node,
@@ -231,7 +271,7 @@ static css_select_handler selection_handler = {
 	get_libcss_node_data,
 };
 
-#define HANDLER_LEN 33
+#define HANDLER_LEN 26
 css_js_error set_handlers(uint64_t* arr, size_t len)
 {
 	if (len != HANDLER_LEN)
@@ -256,808 +296,5747 @@ css_js_error set_handlers(uint64_t* arr, size_t len)
 		arr[10];
 	js_node_has_id = (bool (*)(const char*, const char*, const char*))
 		arr[11];
-	js_node_has_attribute = (bool (*)(const char*, const char*,
-				const char*)) arr[12];
-	js_node_has_attribute_equal = (bool (*)(const char*, const char*,
-				const char*)) arr[13];
-	js_node_has_attribute_dashmatch = (bool (*)(const char*, const char*,
-				const char*)) arr[14];
-	js_node_has_attribute_includes = (bool (*)(const char*, const char*,
-				const char*)) arr[15];
-	js_node_has_attribute_prefix = (bool (*)(const char*, const char*,
-				const char*)) arr[16];
-	js_node_has_attribute_suffix = (bool (*)(const char*, const char*,
-				const char*)) arr[17];
-	js_node_has_attribute_substring = (bool (*)(const char*, const char*,
-				const char*)) arr[18];
 	js_node_is_root = (bool (*)(const char*, const char*, const char*))
-		arr[19];
+		arr[12];
 	js_node_count_siblings = (int32_t (*)(const char*, bool, bool))
-		arr[20];
+		arr[13];
 	js_node_is_empty = (bool (*)(const char*, const char*, const char*))
-		arr[21];
+		arr[14];
 	js_node_is_link = (bool (*)(const char*, const char*, const char*))
-		arr[22];
+		arr[15];
 	js_node_is_visited = (bool (*)(const char*, const char*, const char*))
-		arr[23];
+		arr[16];
 	js_node_is_hover = (bool (*)(const char*, const char*, const char*))
-		arr[24];
+		arr[17];
 	js_node_is_active = (bool (*)(const char*, const char*, const char*))
-		arr[25];
+		arr[18];
 	js_node_is_focus = (bool (*)(const char*, const char*, const char*))
-		arr[26];
+		arr[19];
 	js_node_is_enabled = (bool (*)(const char*, const char*, const char*))
-		arr[27];
+		arr[20];
 	js_node_is_disabled = (bool (*)(const char*, const char*, const char*))
-		arr[28];
+		arr[21];
 	js_node_is_checked = (bool (*)(const char*, const char*, const char*))
-		arr[29];
+		arr[22];
 	js_node_is_target = (bool (*)(const char*, const char*, const char*))
-		arr[30];
+		arr[23];
 	js_node_is_lang = (bool (*)(const char*, const char*, const char*))
-		arr[31];
-	js_ua_font_size = (int32_t (*)(void)) arr[32];
+		arr[24];
+	js_node_attributes = (char* (*)(const char*)) arr[25];
 
 	return CSS_JS_OK;
 }
+
+css_js_error get_handler_count (uint32_t* count)
+{
+	*count = HANDLER_LEN;
+	return CSS_JS_OK;
+}
 #undef HANDLER_LEN
 
 css_select_ctx* select_ctx = NULL;
 stylesheet_list* first_sheet = NULL;
-css_js_node* first_node = NULL;
+uint32_t sheet_count = 0;
 
-css_js_node* get_last_node (void)
-{
-	// printf("Getting last node!\n");
-	if (first_node == NULL) return NULL;
+/*
+ * Node store: a hash table of css_js_node, keyed by the interned id.
+ * Nodes persist between queries, until the stylesheets change or the nodes
+ * are removed; mutation notifications only mark them for restyling.
+ */
+#define NODE_TABLE_MIN 256
+css_js_node** node_table = NULL;
+uint32_t node_table_size = 0;
+uint32_t node_table_count = 0;
+
+/*
+ * Incremented by every mutation notification. See css_js_node.
+ */
+uint32_t restyle_epoch = 0;
 
-	css_js_node* current_node = first_node;
+/*
+ * Computed style intern table: a hash table of css_js_interned. Entries go
+ * away with the last node that has their style.
+ */
+#define INTERN_TABLE_MIN 256
+#define INTERN_DUMP_MAX 16384
+css_js_interned** intern_table = NULL;
+uint32_t intern_table_size = 0;
+uint32_t intern_table_count = 0;
+uint32_t intern_last_id = 0;
+uint32_t intern_dump_bytes = 0;
 
-	while (current_node->next != NULL)
-		current_node = current_node->next;
+/*
+ * Style sharing cache: a hash table of css_js_share, emptied whenever the
+ * stylesheets change.
+ */
+#define SHARE_TABLE_MIN 256
+css_js_share** share_table = NULL;
+uint32_t share_table_size = 0;
+uint32_t share_table_count = 0;
 
-	return current_node;
-}
+/*
+ * Presentational hints: a hash table of css_js_hints. Unlike the node
+ * store, it is only emptied when the hints are replaced.
+ */
+#define HINT_TABLE_MIN 64
+css_js_hints** hint_table = NULL;
+uint32_t hint_table_size = 0;
+uint32_t hint_table_count = 0;
+
+/*
+ * Selector dependency index: a hash table of css_js_dep, plus the union of
+ * the scopes of each kind of name, for when the name is not known, and of
+ * the scopes of the elements whose position among their siblings matters
+ * (positional pseudo-classes and right-hand sides of sibling combinators).
+ */
+#define DEP_TABLE_MIN 64
+css_js_dep** dep_table = NULL;
+uint32_t dep_table_size = 0;
+uint32_t dep_table_count = 0;
+uint8_t dep_any_scope[CSS_JS_DEP_KIND_COUNT] = { 0 };
+uint8_t dep_position_scope = 0;
+
+/*
+ * Distinct media masks of the stylesheets and of their @media rules.
+ * Two media for which each mask matches either both or neither select
+ * from the same rules, so they share their results.
+ */
+css_media_type* media_masks = NULL;
+uint32_t media_mask_count = 0;
+
+/*
+ * Count of the contexts sharing the dependency index and media masks, or
+ * NULL if the current context is their only owner. A derived context
+ * shares those of its base until either of them adds a stylesheet.
+ */
+uint32_t* dep_index_refs = NULL;
+
+/*
+ * Set by the selection callbacks whenever the selection being made depends
+ * on something other than the names, ids and classes of the node and its
+ * ancestors (i.e. siblings, attributes or dynamic state), in which case the
+ * results must not be shared.
+ */
+bool selection_sensitive = false;
+
+/*
+ * Document loaded with load_document. While <document_loaded> is set, the
+ * selection callbacks are answered from it instead of the Javascript
+ * handlers.
+ */
+#define DOC_TABLE_MIN 256
+css_js_doc_node** doc_table = NULL;
+uint32_t doc_table_size = 0;
+uint32_t doc_table_count = 0;
+css_js_doc_node* doc_first_root = NULL;
+css_js_doc_node* doc_last_root = NULL;
+bool document_loaded = false;
+
+/*
+ * Selector profile: a hash table of css_js_profile, keyed by selector, and
+ * the count and time of the selections profiled. <profile_calls> counts
+ * the callbacks of the selector being replayed, and <profile_inexact> tells
+ * whether it has a pseudo-class that the replay can't test.
+ */
+#define PROFILE_TABLE_MIN 64
+bool profiling = false;
+css_js_profile** profile_table = NULL;
+uint32_t profile_table_size = 0;
+uint32_t profile_table_count = 0;
+uint32_t profile_selections = 0;
+double profile_select_time = 0;
+uint32_t profile_calls = 0;
+bool profile_inexact = false;
+
+/*
+ * Rule coverage. Starting a coverage starts a new <coverage_epoch>, which
+ * resets the match counts of the stylesheets as they are next counted.
+ */
+bool coverage = false;
+uint32_t coverage_epoch = 0;
 
 css_js_node* get_node_by_id (lwc_string* id)
 {
-	// printf("Getting node by id %s!\n", lwc_string_data(id));
-	for (css_js_node* current_node = first_node;
+	if (node_table_size == 0)
+		return NULL;
+
+	uint32_t bucket = lwc_string_hash_value(id) & (node_table_size - 1);
+	for (css_js_node* current_node = node_table[bucket];
 	    current_node != NULL;
 	    current_node = current_node->next) {
-		// printf("Current node id: %s\n", lwc_string_data(current_node->id));
-		bool match;
-		lwc_string_isequal(id, current_node->id, &match);
-
-		if (match) {
-			// printf("Found!\n");
+		/* Strings are interned, so comparing the pointers is enough. */
+		if (current_node->id == id)
 			return current_node;
-		}
 	}
-	// printf("Not found!\n");
 
 	return NULL;
 }
 
-css_js_node* append_node (
-		lwc_string* id, css_select_results* new_sr, void* new_data)
+static void grow_node_table (void)
+{
+	uint32_t new_size = node_table_size == 0
+		? NODE_TABLE_MIN : node_table_size * 2;
+	css_js_node** new_table = calloc(new_size, sizeof(css_js_node*));
+
+	for (uint32_t i = 0; i < node_table_size; i++) {
+		css_js_node* node = node_table[i];
+		while (node != NULL) {
+			css_js_node* next = node->next;
+			uint32_t bucket = lwc_string_hash_value(node->id) &
+				(new_size - 1);
+			node->next = new_table[bucket];
+			new_table[bucket] = node;
+			node = next;
+		}
+	}
+
+	free(node_table);
+	node_table = new_table;
+	node_table_size = new_size;
+}
+
+css_js_node* append_node (lwc_string* id)
 {
-	// printf("Appending node for id %s!\n", lwc_string_data(id));
-	css_js_node* new_node = malloc(sizeof(css_js_node));
+	if (node_table_count >= node_table_size)
+		grow_node_table();
+
+	css_js_node* new_node = calloc(1, sizeof(css_js_node));
 	new_node->id = lwc_string_ref(id);
-	new_node->sr = new_sr;
-	new_node->data = new_data;
-	new_node->next = NULL;
 
-	css_js_node* last_node = get_last_node();
-	if (last_node == NULL) {
-		first_node = new_node;
-	}
-	else {
-		last_node->next = new_node;
-	}
+	uint32_t bucket = lwc_string_hash_value(id) & (node_table_size - 1);
+	new_node->next = node_table[bucket];
+	node_table[bucket] = new_node;
+	node_table_count++;
 
 	return new_node;
 }
 
-css_js_node* update_node (
-		lwc_string* id, css_select_results* new_sr, void* new_data)
-{
-	css_js_node* node = get_node_by_id(id);
+/*
+ * Nodes returned to libcss by the handler callbacks during a selection.
+ * libcss doesn't release them, so their references are held until the
+ * selection is over.
+ */
+lwc_string** held_nodes = NULL;
+uint32_t held_nodes_size = 0;
+uint32_t held_nodes_count = 0;
 
-	if (node == NULL) {
-		node = append_node(id, NULL, new_data);
-	} else {
-		// printf("Updating node for id %s!\n", lwc_string_data(id));
-		if (new_sr != NULL)
-			node->sr = new_sr;
-		if (new_data != NULL)
-			node->data = new_data;
+void* hold_node (lwc_string* node)
+{
+	if (held_nodes_count >= held_nodes_size) {
+		held_nodes_size = held_nodes_size == 0 ? 16 : held_nodes_size * 2;
+		held_nodes = realloc(held_nodes,
+				held_nodes_size * sizeof(lwc_string*));
 	}
 
+	held_nodes[held_nodes_count++] = node;
 	return node;
 }
 
-css_js_error free_node (css_js_node** node_ptr)
+/*
+ * Class arrays returned to libcss during a selection. libcss releases the
+ * classes but not the array, which is freed with the held nodes.
+ */
+lwc_string*** held_classes = NULL;
+uint32_t held_classes_size = 0;
+uint32_t held_classes_count = 0;
+
+static css_error select_node_classes (void* pw, void* node,
+		lwc_string*** classes, uint32_t* n_classes)
 {
-	css_js_node* node = *node_ptr;
+	css_error code = node_classes(pw, node, classes, n_classes);
+	if (code != CSS_OK || *classes == NULL)
+		return code;
+
+	if (held_classes_count >= held_classes_size) {
+		held_classes_size = held_classes_size == 0
+			? 4 : held_classes_size * 2;
+		held_classes = realloc(held_classes,
+				held_classes_size * sizeof(lwc_string**));
+	}
 
-	// printf("Freeing node for id %s!\n", node == NULL ? "Node null" : lwc_string_data(node->id));
-	css_error code;
-	css_js_error js_code;
+	held_classes[held_classes_count++] = *classes;
+	return CSS_OK;
+}
 
-	if (node == NULL)
-		return CSS_JS_OK;
+void release_held_nodes (void)
+{
+	for (uint32_t i = 0; i < held_nodes_count; i++)
+		lwc_string_unref(held_nodes[i]);
+	held_nodes_count = 0;
 
-	if (node->next != NULL) {
-		js_code = free_node(&(node->next));
-		if (js_code != CSS_JS_OK)
-			return js_code;
+	for (uint32_t i = 0; i < held_classes_count; i++)
+		free(held_classes[i]);
+	held_classes_count = 0;
+}
+
+/*
+ * Links a node to the stored node it was selected under, after unlinking
+ * it from the previous one, if any. <parent> may be NULL.
+ */
+static void set_node_parent (css_js_node* node, css_js_node* parent)
+{
+	if (node->parent != NULL) {
+		if (node->prev_sibling != NULL)
+			node->prev_sibling->next_sibling = node->next_sibling;
+		else
+			node->parent->children = node->next_sibling;
+		if (node->next_sibling != NULL)
+			node->next_sibling->prev_sibling = node->prev_sibling;
 	}
 
-	if (node->sr != NULL) {
-		code = css_select_results_destroy(node->sr);
-		if (code != CSS_OK)
-			return CSS_JS_DESTROY_STYLE;
+	node->parent = parent;
+	node->prev_sibling = NULL;
+	node->next_sibling = NULL;
+	if (parent != NULL) {
+		node->next_sibling = parent->children;
+		if (parent->children != NULL)
+			parent->children->prev_sibling = node;
+		parent->children = node;
+	}
+}
+
+/*
+ * Drops the styles of a node, so it is selected again when next queried.
+ */
+css_js_error clear_node_style (css_js_node* node)
+{
+	css_error code;
+
+	for (int i = 0; i < CSS_PSEUDO_ELEMENT_COUNT; i++) {
+		release_interned(node->styles[i]);
+		node->styles[i] = NULL;
 	}
 
+	release_style(node->selected);
+	node->selected = NULL;
+
+	/* libcss's data describes the node's ancestors and must be rebuilt */
 	if (node->data != NULL) {
 		code = css_libcss_node_data_handler(&selection_handler,
 				CSS_NODE_DELETED, NULL, node->id, NULL,
 				node->data);
 		if (code != CSS_OK)
 			return CSS_JS_DESTROY_NODE_DATA;
+		node->data = NULL;
 	}
 
-	lwc_string_unref(node->id);
+	if (node->inline_style != NULL) {
+		lwc_string_unref(node->inline_style);
+		node->inline_style = NULL;
+	}
 
-	free(node);
-	*node_ptr = NULL;
+	if (node->parent_id != NULL) {
+		lwc_string_unref(node->parent_id);
+		node->parent_id = NULL;
+	}
+	set_node_parent(node, NULL);
+
+	release_share_entry(node->share);
+	node->share = NULL;
 
 	return CSS_JS_OK;
 }
 
-css_error resolve_url(
-		void *pw, const char *base, lwc_string *rel, lwc_string **abs
-		)
+css_js_error unlink_node (css_js_node* node)
 {
-	UNUSED(pw);
-	size_t base_s = strlen(base);
-	bool has_base = (base_s > 0);
-	char base_str[base_s];
-	strcpy(base_str, base);
-	if (base_str[base_s] == '/')
-		base_str[base_s] = '\0';
+	uint32_t bucket = lwc_string_hash_value(node->id) &
+		(node_table_size - 1);
+	css_js_node** link = &node_table[bucket];
+
+	while (*link != NULL) {
+		if (*link == node) {
+			*link = node->next;
+			node_table_count--;
+			return free_node(node);
+		}
+		link = &(*link)->next;
+	}
 
-	base_s = strlen(base_str);
+	return CSS_JS_OK;
+}
 
-	const char* rel_str = lwc_string_data(rel);
-	const size_t rel_s = strlen(rel_str);
+css_js_error free_node (css_js_node* node)
+{
+	css_js_error js_code = clear_node_style(node);
+	if (js_code != CSS_JS_OK)
+		return js_code;
 
-	char abs_str[base_s + rel_s + 1];
-	strcpy(abs_str, "");
-	if (has_base) {
-		strcat(abs_str, base_str);
-		strcat(abs_str, "/");
-	}
-	strcat(abs_str, rel_str);
+	while (node->children != NULL)
+		set_node_parent(node->children, NULL);
 
-	lwc_intern_string(abs_str, strlen(abs_str), abs);
-	return CSS_OK;
+	free_node_attributes(node);
+	lwc_string_unref(node->id);
+	free(node);
+
+	return CSS_JS_OK;
 }
 
-css_js_error append_stylesheet_list (css_stylesheet* new_sheet)
+css_js_error free_nodes (void)
 {
-	stylesheet_list* new_node = malloc(sizeof(stylesheet_list));
-	new_node->sheet = new_sheet;
-	new_node->next = NULL;
+	css_js_error js_code;
 
-	stylesheet_list* next = first_sheet;
-	while (next != NULL) {
-		next = next->next;
+	for (uint32_t i = 0; i < node_table_size; i++) {
+		css_js_node* node = node_table[i];
+		while (node != NULL) {
+			css_js_node* next = node->next;
+			js_code = free_node(node);
+			if (js_code != CSS_JS_OK)
+				return js_code;
+			node = next;
+		}
 	}
-	next = new_node;
+
+	free(node_table);
+	node_table = NULL;
+	node_table_size = 0;
+	node_table_count = 0;
 
 	return CSS_JS_OK;
 }
 
-css_js_error free_stylesheet_list (stylesheet_list** sheet_ptr)
+/*
+ * Returns the style of a node for a pseudo-element: the composed style if
+ * there is one, otherwise the style from the selection results.
+ */
+css_computed_style* get_node_style (css_js_node* node,
+		css_pseudo_element pseudo)
 {
-	stylesheet_list* sheet = *sheet_ptr;
+	if (node->styles[pseudo] != NULL)
+		return node->styles[pseudo]->style;
 
-	if (sheet == NULL)
-		return CSS_JS_OK;
+	return NULL;
+}
 
-	css_error code;
+void release_style (css_js_style* style)
+{
+	if (style == NULL)
+		return;
 
-	if (sheet->next != NULL) {
-		free_stylesheet_list(&(sheet->next));
+	if (--style->refcnt == 0) {
+		css_select_results_destroy(style->sr);
+		free(style);
 	}
-	if (sheet->sheet != NULL) {
-		code = css_stylesheet_destroy(sheet->sheet);
-		if (code != CSS_OK)
-			return CSS_JS_DESTROY_SHEET;
+}
+
+static void grow_intern_table (void)
+{
+	uint32_t new_size = intern_table_size == 0
+		? INTERN_TABLE_MIN : intern_table_size * 2;
+	css_js_interned** new_table = calloc(new_size,
+			sizeof(css_js_interned*));
+
+	for (uint32_t i = 0; i < intern_table_size; i++) {
+		css_js_interned* entry = intern_table[i];
+		while (entry != NULL) {
+			css_js_interned* next = entry->next;
+			uint32_t bucket = entry->hash & (new_size - 1);
+			entry->next = new_table[bucket];
+			new_table[bucket] = entry;
+			entry = next;
+		}
 	}
 
-	free(sheet);
-	*sheet_ptr = NULL;
+	free(intern_table);
+	intern_table = new_table;
+	intern_table_size = new_size;
+}
 
-	return CSS_JS_OK;
+/*
+ * Returns the entry for a style, with a new reference.
+ * Parameters:
+ * 	style: the style. If <owner> is NULL, it is handed over: it is
+ * 		either kept by the new entry or destroyed in favour of an
+ * 		identical one.
+ * 	owner: the selection results the style belongs to, or NULL.
+ */
+css_js_interned* intern_style (css_computed_style* style, css_js_style* owner)
+{
+	/* libcss interns the styles it computes, so identical styles are the
+	 * same object. The address is mixed, as its low bits are aligned. */
+	uint32_t hash = (uint32_t) (uintptr_t) style;
+	hash = (hash ^ (hash >> 16)) * 0x45d9f3bu;
+	hash ^= hash >> 16;
+
+	if (intern_table_size != 0) {
+		css_js_interned* entry = intern_table[
+			hash & (intern_table_size - 1)];
+		for (; entry != NULL; entry = entry->next) {
+			if (entry->style == style) {
+				/* libcss counts the references to its
+				 * styles, so a handed-over style is
+				 * released even though it is the entry's */
+				if (owner == NULL)
+					css_computed_style_destroy(style);
+				entry->refcnt++;
+				return entry;
+			}
+		}
+	}
+
+	if (intern_table_count >= intern_table_size)
+		grow_intern_table();
+
+	css_js_interned* entry = malloc(sizeof(css_js_interned));
+	entry->style = style;
+	entry->owner = owner;
+	if (owner != NULL)
+		owner->refcnt++;
+	entry->dump = NULL;
+	entry->dump_len = 0;
+	entry->hash = hash;
+	entry->id = ++intern_last_id;
+	entry->refcnt = 1;
+
+	uint32_t bucket = hash & (intern_table_size - 1);
+	entry->next = intern_table[bucket];
+	intern_table[bucket] = entry;
+	intern_table_count++;
+
+	return entry;
 }
 
-css_js_error reset_ctx (void)
+/*
+ * Returns the text of an interned style, one "property: value" line per
+ * property, formatting it when first asked for.
+ */
+static const char* get_interned_dump (css_js_interned* entry)
 {
-	css_error code;
-	css_js_error js_code;
+	if (entry->dump != NULL)
+		return entry->dump;
 
-	if (select_ctx != NULL) {
-		code = css_select_ctx_destroy(select_ctx);
-		if (code != CSS_OK)
-			return CSS_JS_DESTROY_CTX;
+	static char dump[INTERN_DUMP_MAX];
+	size_t len = INTERN_DUMP_MAX;
+	dump_computed_style(entry->style, dump, &len);
 
-		select_ctx = NULL;
-	}
+	entry->dump_len = INTERN_DUMP_MAX - len;
+	entry->dump = malloc(entry->dump_len + 1);
+	memcpy(entry->dump, dump, entry->dump_len);
+	entry->dump[entry->dump_len] = '\0';
+	intern_dump_bytes += entry->dump_len + 1;
 
-	js_code = free_stylesheet_list(&first_sheet);
-	if (js_code != CSS_JS_OK)
-		return js_code;
+	return entry->dump;
+}
 
-	return CSS_JS_OK;
+void release_interned (css_js_interned* entry)
+{
+	if (entry == NULL || --entry->refcnt > 0)
+		return;
+
+	css_js_interned** prev = &intern_table[
+		entry->hash & (intern_table_size - 1)];
+	while (*prev != entry)
+		prev = &(*prev)->next;
+	*prev = entry->next;
+	intern_table_count--;
+
+	if (entry->owner != NULL)
+		release_style(entry->owner);
+	else
+		css_computed_style_destroy(entry->style);
+	if (entry->dump != NULL)
+		intern_dump_bytes -= entry->dump_len + 1;
+	free(entry->dump);
+	free(entry);
 }
 
-css_js_error create_ctx (void) {
-	css_error code = css_select_ctx_create(&select_ctx);
-	if (code != CSS_OK)
-		return CSS_JS_CREATE_CTX;
+static inline uint32_t share_mix (uint32_t hash, uint32_t value)
+{
+	/* FNV-1a, one word at a time */
+	return (hash ^ value) * 16777619u;
+}
 
-	return CSS_JS_OK;
+static uint32_t share_hash (css_js_share* parent, lwc_string* name,
+		lwc_string* id, lwc_string** classes, uint32_t n_classes,
+		css_media_type media)
+{
+	uint32_t hash = 2166136261u;
+
+	hash = share_mix(hash, (uint32_t) (uintptr_t) parent);
+	hash = share_mix(hash,
+			name == NULL ? 0 : lwc_string_hash_value(name));
+	hash = share_mix(hash, id == NULL ? 0 : lwc_string_hash_value(id));
+	for (uint32_t i = 0; i < n_classes; i++)
+		hash = share_mix(hash, lwc_string_hash_value(classes[i]));
+	hash = share_mix(hash, (uint32_t) media);
+
+	return hash;
 }
 
-css_js_error add_stylesheet (
-		const char* css_string,
-		const char* level,
-		const char* origin,
-		const char* media,
-		const char* url,
-                bool allow_quirks
-		)
+static bool share_equal (css_js_share* entry, css_js_share* parent,
+		lwc_string* name, lwc_string* id, lwc_string** classes,
+		uint32_t n_classes, css_media_type media)
 {
-	css_error code;
-	css_js_error js_code;
+	/* Strings are interned, so comparing the pointers is enough. */
+	if (entry->parent != parent || entry->name != name ||
+			entry->id != id || entry->n_classes != n_classes ||
+			entry->media != media)
+		return false;
+
+	for (uint32_t i = 0; i < n_classes; i++) {
+		if (entry->classes[i] != classes[i])
+			return false;
+	}
 
-	css_language_level css_level;
-	if (strcmp(level, "1") == 0)
-		css_level = CSS_LEVEL_1;
-	else if (strcmp(level, "2") == 0)
-		css_level = CSS_LEVEL_2;
-	else if (strcmp(level, "2.1") == 0)
-		css_level = CSS_LEVEL_21;
-	else if (strcmp(level, "3") == 0)
-		css_level = CSS_LEVEL_3;
-	else
-		return CSS_JS_LEVEL;
+	return true;
+}
 
-	css_origin orig;
-	if (strcmp(origin, "author") == 0)
-		orig = CSS_ORIGIN_AUTHOR;
-	else if (strcmp(origin, "user") == 0)
-		orig = CSS_ORIGIN_USER;
-	else if (strcmp(origin, "ua") == 0 ||
-			strcmp(origin, "UA") == 0 ||
-			strcmp(origin, "user agent") == 0 ||
-			strcmp(origin, "user-agent") == 0)
-		orig = CSS_ORIGIN_UA;
-	else
-		return CSS_JS_ORIGIN;
+static void grow_share_table (void)
+{
+	uint32_t new_size = share_table_size == 0
+		? SHARE_TABLE_MIN : share_table_size * 2;
+	css_js_share** new_table = calloc(new_size, sizeof(css_js_share*));
+
+	for (uint32_t i = 0; i < share_table_size; i++) {
+		css_js_share* entry = share_table[i];
+		while (entry != NULL) {
+			css_js_share* next = entry->next;
+			uint32_t bucket = entry->hash & (new_size - 1);
+			entry->next = new_table[bucket];
+			new_table[bucket] = entry;
+			entry = next;
+		}
+	}
 
-	const char *p = media;
-	const char *end = p + strlen(media);
-	css_media_type media_result = 0;
+	free(share_table);
+	share_table = new_table;
+	share_table_size = new_size;
+}
 
-	/* <medium> [ ',' <medium> ]* */
+/*
+ * Gets the entry of the style sharing cache for a node, with a new
+ * reference, creating it if needed.
+ * Parameters:
+ * 	parent: the entry of the node's parent, or NULL if the node is root.
+ * 	node: the node.
+ * 	media: the media being queried.
+ */
+css_js_share* get_share_entry (css_js_share* parent, lwc_string* node,
+		css_media_type media)
+{
+	css_qname qname = { NULL, NULL };
+	lwc_string* name = NULL;
+	lwc_string* id = NULL;
+	lwc_string** classes = NULL;
+	uint32_t n_classes = 0;
+
+	/* Through the selection callbacks, for the document table to be
+	 * used when one is loaded */
+	node_name(NULL, node, &qname);
+	name = qname.name;
+	node_id(NULL, node, &id);
+	node_classes(NULL, node, &classes, &n_classes);
+
+	uint32_t hash = share_hash(parent, name, id, classes, n_classes,
+			media);
+
+	if (share_table_count >= share_table_size)
+		grow_share_table();
+
+	uint32_t bucket = hash & (share_table_size - 1);
+	for (css_js_share* entry = share_table[bucket];
+			entry != NULL;
+			entry = entry->next) {
+		if (entry->hash == hash && share_equal(entry, parent, name,
+					id, classes, n_classes, media)) {
+			if (name != NULL)
+				lwc_string_unref(name);
+			if (id != NULL)
+				lwc_string_unref(id);
+			for (uint32_t i = 0; i < n_classes; i++)
+				lwc_string_unref(classes[i]);
+			free(classes);
+
+			entry->refcnt++;
+			return entry;
+		}
+	}
 
-	while (p < end) {
-		const char *start = p;
+	css_js_share* entry = malloc(sizeof(css_js_share));
+	entry->parent = parent;
+	if (parent != NULL)
+		parent->refcnt++;
+	entry->refcnt = 1;
+	entry->name = name;
+	entry->id = id;
+	entry->classes = classes;
+	entry->n_classes = n_classes;
+	entry->media = media;
+	entry->hash = hash;
+	entry->style = NULL;
+	entry->next = share_table[bucket];
+	share_table[bucket] = entry;
+	share_table_count++;
+
+	return entry;
+}
 
-		/* consume a medium */
-		while (*p != ',' && p < end)
-			p++;
+static void free_share_entry (css_js_share* entry)
+{
+	release_style(entry->style);
+	if (entry->name != NULL)
+		lwc_string_unref(entry->name);
+	if (entry->id != NULL)
+		lwc_string_unref(entry->id);
+	for (uint32_t i = 0; i < entry->n_classes; i++)
+		lwc_string_unref(entry->classes[i]);
+	free(entry->classes);
+	free(entry);
+}
 
-                // printf("%s %d\n", start, p - start);
+/*
+ * Releases a reference to an entry of the style sharing cache, evicting it,
+ * and releasing its parent, if it was the last one.
+ */
+void release_share_entry (css_js_share* entry)
+{
+	while (entry != NULL && --entry->refcnt == 0) {
+		css_js_share** link = &share_table[
+			entry->hash & (share_table_size - 1)];
+		while (*link != entry)
+			link = &(*link)->next;
+		*link = entry->next;
+		share_table_count--;
+
+		css_js_share* parent = entry->parent;
+		free_share_entry(entry);
+		entry = parent;
+	}
+}
 
-		if (p - start == 10 &&
-				strncasecmp(start, "projection", 10) == 0)
-			media_result |= CSS_MEDIA_PROJECTION;
-		else if (p - start == 8 &&
-				strncasecmp(start, "handheld", 8) == 0)
-			media_result |= CSS_MEDIA_HANDHELD;
+css_js_error free_share_cache (void)
+{
+	for (uint32_t i = 0; i < share_table_size; i++) {
+		css_js_share* entry = share_table[i];
+		while (entry != NULL) {
+			css_js_share* next = entry->next;
+			free_share_entry(entry);
+			entry = next;
+		}
+	}
+
+	free(share_table);
+	share_table = NULL;
+	share_table_size = 0;
+	share_table_count = 0;
+
+	return CSS_JS_OK;
+}
+
+static uint32_t dep_hash (css_js_dep_kind kind, lwc_string* name)
+{
+	return (lwc_string_hash_value(name) * 31u) ^ (uint32_t) kind;
+}
+
+void intern_lowercase (const char* name, size_t len, lwc_string** ret)
+{
+	char lower[len + 1];
+	for (size_t i = 0; i < len; i++) {
+		lower[i] = (name[i] >= 'A' && name[i] <= 'Z')
+			? name[i] - 'A' + 'a' : name[i];
+	}
+	lower[len] = '\0';
+	lwc_intern_string(lower, len, ret);
+}
+
+/*
+ * Interns a name as stored in the dependency index.
+ */
+static void intern_dep_name (css_js_dep_kind kind, const char* name,
+		size_t len, lwc_string** ret)
+{
+	if (kind == CSS_JS_DEP_CLASS || kind == CSS_JS_DEP_ID ||
+			kind == CSS_JS_DEP_VALUE) {
+		/* Case-sensitive */
+		lwc_intern_string(name, len, ret);
+		return;
+	}
+
+	intern_lowercase(name, len, ret);
+}
+
+static css_js_dep* find_dep (css_js_dep_kind kind, lwc_string* name)
+{
+	if (dep_table_size == 0)
+		return NULL;
+
+	uint32_t bucket = dep_hash(kind, name) & (dep_table_size - 1);
+	for (css_js_dep* dep = dep_table[bucket]; dep != NULL; dep = dep->next) {
+		if (dep->kind == kind && dep->name == name)
+			return dep;
+	}
+
+	return NULL;
+}
+
+static void grow_dep_table (void)
+{
+	uint32_t new_size = dep_table_size == 0
+		? DEP_TABLE_MIN : dep_table_size * 2;
+	css_js_dep** new_table = calloc(new_size, sizeof(css_js_dep*));
+
+	for (uint32_t i = 0; i < dep_table_size; i++) {
+		css_js_dep* dep = dep_table[i];
+		while (dep != NULL) {
+			css_js_dep* next = dep->next;
+			uint32_t bucket = dep_hash(dep->kind, dep->name) &
+				(new_size - 1);
+			dep->next = new_table[bucket];
+			new_table[bucket] = dep;
+			dep = next;
+		}
+	}
+
+	free(dep_table);
+	dep_table = new_table;
+	dep_table_size = new_size;
+}
+
+static void add_dependency (css_js_dep_kind kind, lwc_string* name,
+		uint8_t scope)
+{
+	lwc_string* key;
+	intern_dep_name(kind, lwc_string_data(name), lwc_string_length(name),
+			&key);
+
+	dep_any_scope[kind] |= scope;
+
+	css_js_dep* dep = find_dep(kind, key);
+	if (dep != NULL) {
+		dep->scope |= scope;
+		lwc_string_unref(key);
+		return;
+	}
+
+	if (dep_table_count >= dep_table_size)
+		grow_dep_table();
+
+	uint32_t bucket = dep_hash(kind, key) & (dep_table_size - 1);
+	dep = malloc(sizeof(css_js_dep));
+	dep->name = key;
+	dep->lower = NULL;
+	dep->kind = kind;
+	dep->scope = scope;
+	dep->next = dep_table[bucket];
+	dep_table[bucket] = dep;
+	dep_table_count++;
+}
+
+/*
+ * Records the value of an attribute selector along with its lowercased
+ * form, which match_attribute_value compares attributes against.
+ */
+static void add_attribute_value (lwc_string* value)
+{
+	if (find_dep(CSS_JS_DEP_VALUE, value) != NULL)
+		return;
+
+	add_dependency(CSS_JS_DEP_VALUE, value, 0);
+	css_js_dep* dep = find_dep(CSS_JS_DEP_VALUE, value);
+	intern_lowercase(lwc_string_data(value), lwc_string_length(value),
+			&dep->lower);
+}
+
+/*
+ * Tells whether a pseudo-class depends on the position of the element
+ * among its siblings.
+ */
+static bool is_positional (lwc_string* name)
+{
+	static const char* positional[] = {
+		"first-child", "last-child", "only-child",
+		"nth-child", "nth-last-child",
+		"first-of-type", "last-of-type", "only-of-type",
+		"nth-of-type", "nth-last-of-type"
+	};
+	const char* data = lwc_string_data(name);
+
+	for (size_t i = 0; i < sizeof(positional) / sizeof(positional[0]);
+			i++) {
+		if (strcasecmp(data, positional[i]) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Records the names of a selector, walking its compound selectors from the
+ * subject (right) to the left.
+ */
+static void index_selector (const css_selector* selector)
+{
+	uint8_t scope = CSS_JS_DEP_SELF;
+
+	while (selector != NULL) {
+		const css_selector_detail* detail = &selector->data;
+
+		for (;;) {
+			switch (detail->type) {
+			case CSS_SELECTOR_CLASS:
+				add_dependency(CSS_JS_DEP_CLASS,
+						detail->qname.name, scope);
+				break;
+			case CSS_SELECTOR_ID:
+				add_dependency(CSS_JS_DEP_ID,
+						detail->qname.name, scope);
+				break;
+			case CSS_SELECTOR_PSEUDO_CLASS:
+				add_dependency(CSS_JS_DEP_PSEUDO_CLASS,
+						detail->qname.name, scope);
+				if (is_positional(detail->qname.name))
+					dep_position_scope |= scope;
+				break;
+			case CSS_SELECTOR_ATTRIBUTE:
+				add_dependency(CSS_JS_DEP_ATTRIBUTE,
+						detail->qname.name, scope);
+				break;
+			case CSS_SELECTOR_ATTRIBUTE_EQUAL:
+			case CSS_SELECTOR_ATTRIBUTE_DASHMATCH:
+			case CSS_SELECTOR_ATTRIBUTE_INCLUDES:
+			case CSS_SELECTOR_ATTRIBUTE_PREFIX:
+			case CSS_SELECTOR_ATTRIBUTE_SUFFIX:
+			case CSS_SELECTOR_ATTRIBUTE_SUBSTRING:
+				add_dependency(CSS_JS_DEP_ATTRIBUTE,
+						detail->qname.name, scope);
+				add_attribute_value(detail->value.string);
+				break;
+			default:
+				break;
+			}
+
+			if (detail->next == 0)
+				break;
+			detail++;
+		}
+
+		/* The combinator relates this compound to the one on its left */
+		switch (selector->data.comb) {
+		case CSS_COMBINATOR_ANCESTOR:
+		case CSS_COMBINATOR_PARENT:
+			scope = CSS_JS_DEP_DESCENDANTS;
+			break;
+		case CSS_COMBINATOR_SIBLING:
+		case CSS_COMBINATOR_GENERIC_SIBLING:
+			/* This compound's element depends on its position */
+			dep_position_scope |= scope;
+			scope = (scope & (CSS_JS_DEP_SELF | CSS_JS_DEP_SIBLINGS))
+				? CSS_JS_DEP_SIBLINGS
+				: CSS_JS_DEP_SIBLING_DESCENDANTS;
+			break;
+		default:
+			break;
+		}
+
+		selector = selector->combinator;
+	}
+}
+
+static void add_media_mask (css_media_type mask)
+{
+	for (uint32_t i = 0; i < media_mask_count; i++) {
+		if (media_masks[i] == mask)
+			return;
+	}
+
+	media_masks = realloc(media_masks,
+			(media_mask_count + 1) * sizeof(css_media_type));
+	media_masks[media_mask_count++] = mask;
+}
+
+static void index_rules (const css_rule* rule)
+{
+	for (; rule != NULL; rule = rule->next) {
+		if (rule->type == CSS_RULE_SELECTOR) {
+			const css_rule_selector* rs =
+				(const css_rule_selector*) rule;
+			for (uint32_t i = 0; i < rule->items; i++)
+				index_selector(rs->selectors[i]);
+		}
+		else if (rule->type == CSS_RULE_MEDIA) {
+			const css_rule_media* rm = (const css_rule_media*) rule;
+			add_media_mask((css_media_type) rm->media);
+			index_rules(rm->first_child);
+		}
+	}
+}
+
+/*
+ * Makes the dependency index and media masks of the current context its
+ * own, copying them if other contexts still share them.
+ */
+static void own_dependency_index (void)
+{
+	if (dep_index_refs == NULL)
+		return;
+
+	if (--(*dep_index_refs) == 0) {
+		free(dep_index_refs);
+		dep_index_refs = NULL;
+		return;
+	}
+	dep_index_refs = NULL;
+
+	css_js_dep** shared = dep_table;
+	dep_table = calloc(dep_table_size, sizeof(css_js_dep*));
+	for (uint32_t i = 0; i < dep_table_size; i++) {
+		css_js_dep** link = &dep_table[i];
+		for (css_js_dep* dep = shared[i]; dep != NULL;
+				dep = dep->next) {
+			css_js_dep* copy = malloc(sizeof(css_js_dep));
+			*copy = *dep;
+			copy->name = lwc_string_ref(dep->name);
+			if (dep->lower != NULL)
+				copy->lower = lwc_string_ref(dep->lower);
+			copy->next = NULL;
+			*link = copy;
+			link = &copy->next;
+		}
+	}
+
+	const css_media_type* shared_masks = media_masks;
+	media_masks = malloc(media_mask_count * sizeof(css_media_type));
+	memcpy(media_masks, shared_masks,
+			media_mask_count * sizeof(css_media_type));
+}
+
+/*
+ * Adds the selectors of a stylesheet, and the media it applies to, to the
+ * dependency index.
+ */
+css_js_error index_stylesheet (const css_stylesheet* sheet,
+		css_media_type media)
+{
+	own_dependency_index();
+	add_media_mask(media);
+	index_rules(sheet->rule_list);
+	return CSS_JS_OK;
+}
+
+/*
+ * Returns the first media type that selects from the same rules as
+ * <media>, so that equivalent media are styled only once.
+ */
+css_media_type get_equivalent_media (css_media_type media)
+{
+	static const css_media_type candidates[] = {
+		CSS_MEDIA_SCREEN, CSS_MEDIA_PRINT, CSS_MEDIA_AURAL,
+		CSS_MEDIA_BRAILLE, CSS_MEDIA_EMBOSSED, CSS_MEDIA_HANDHELD,
+		CSS_MEDIA_PROJECTION, CSS_MEDIA_SPEECH, CSS_MEDIA_TTY,
+		CSS_MEDIA_TV, CSS_MEDIA_ALL
+	};
+
+	for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]);
+			i++) {
+		uint32_t j;
+		for (j = 0; j < media_mask_count; j++) {
+			if (((media_masks[j] & media) != 0) !=
+					((media_masks[j] & candidates[i]) != 0))
+				break;
+		}
+		if (j == media_mask_count)
+			return candidates[i];
+	}
+
+	return media;
+}
+
+/*
+ * Returns the CSS_JS_DEP_* scope of a name, or 0 if no selector uses it.
+ */
+uint8_t get_dependency_scope (css_js_dep_kind kind, const char* name,
+		size_t len)
+{
+	lwc_string* key;
+	intern_dep_name(kind, name, len, &key);
+	css_js_dep* dep = find_dep(kind, key);
+	lwc_string_unref(key);
+
+	return dep == NULL ? 0 : dep->scope;
+}
+
+css_js_error free_dependency_index (void)
+{
+	/* A shared index is freed by the last context using it */
+	bool shared = dep_index_refs != NULL && --(*dep_index_refs) > 0;
+	if (!shared) {
+		free(dep_index_refs);
+		for (uint32_t i = 0; i < dep_table_size; i++) {
+			css_js_dep* dep = dep_table[i];
+			while (dep != NULL) {
+				css_js_dep* next = dep->next;
+				lwc_string_unref(dep->name);
+				if (dep->lower != NULL)
+					lwc_string_unref(dep->lower);
+				free(dep);
+				dep = next;
+			}
+		}
+		free(dep_table);
+		free(media_masks);
+	}
+
+	dep_index_refs = NULL;
+	dep_table = NULL;
+	dep_table_size = 0;
+	dep_table_count = 0;
+	memset(dep_any_scope, 0, sizeof(dep_any_scope));
+	dep_position_scope = 0;
+	media_masks = NULL;
+	media_mask_count = 0;
+
+	return CSS_JS_OK;
+}
+
+css_error resolve_url(
+		void *pw, const char *base, lwc_string *rel, lwc_string **abs
+		)
+{
+	UNUSED(pw);
+	size_t base_s = strlen(base);
+	bool has_base = (base_s > 0);
+	char base_str[base_s];
+	strcpy(base_str, base);
+	if (base_str[base_s] == '/')
+		base_str[base_s] = '\0';
+
+	base_s = strlen(base_str);
+
+	const char* rel_str = lwc_string_data(rel);
+	const size_t rel_s = strlen(rel_str);
+
+	char abs_str[base_s + rel_s + 1];
+	strcpy(abs_str, "");
+	if (has_base) {
+		strcat(abs_str, base_str);
+		strcat(abs_str, "/");
+	}
+	strcat(abs_str, rel_str);
+
+	lwc_intern_string(abs_str, strlen(abs_str), abs);
+	return CSS_OK;
+}
+
+css_js_error append_stylesheet_list (css_js_sheet* new_sheet,
+		css_origin origin, css_media_type media)
+{
+	stylesheet_list* new_node = malloc(sizeof(stylesheet_list));
+	new_node->sheet = new_sheet;
+	new_node->origin = origin;
+	new_node->media = media;
+	new_sheet->refcnt++;
+	new_node->next = NULL;
+
+	stylesheet_list** next = &first_sheet;
+	while (*next != NULL) {
+		next = &(*next)->next;
+	}
+	*next = new_node;
+	sheet_count++;
+
+	return CSS_JS_OK;
+}
+
+css_js_error free_stylesheet_list (stylesheet_list** sheet_ptr)
+{
+	css_js_error js_code;
+
+	while (*sheet_ptr != NULL) {
+		stylesheet_list* sheet = *sheet_ptr;
+		if (sheet->sheet != NULL) {
+			js_code = release_sheet(sheet->sheet);
+			if (js_code != CSS_JS_OK)
+				return js_code;
+		}
+
+		*sheet_ptr = sheet->next;
+		free(sheet);
+		sheet_count--;
+	}
+
+	return CSS_JS_OK;
+}
+
+css_js_error reset_ctx (void)
+{
+	css_error code;
+	css_js_error js_code;
+
+	if (select_ctx != NULL) {
+		code = css_select_ctx_destroy(select_ctx);
+		if (code != CSS_OK)
+			return CSS_JS_DESTROY_CTX;
+
+		select_ctx = NULL;
+	}
+
+	js_code = free_stylesheet_list(&first_sheet);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	js_code = free_nodes();
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	js_code = free_dependency_index();
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	return free_share_cache();
+}
+
+css_js_error create_ctx (void) {
+	css_error code = css_select_ctx_create(&select_ctx);
+	if (code != CSS_OK)
+		return CSS_JS_CREATE_CTX;
+
+	return CSS_JS_OK;
+}
+
+static css_js_error get_level_code (const char* level,
+		css_language_level* ret)
+{
+	if (strcmp(level, "1") == 0)
+		*ret = CSS_LEVEL_1;
+	else if (strcmp(level, "2") == 0)
+		*ret = CSS_LEVEL_2;
+	else if (strcmp(level, "2.1") == 0)
+		*ret = CSS_LEVEL_21;
+	else if (strcmp(level, "3") == 0)
+		*ret = CSS_LEVEL_3;
+	else
+		return CSS_JS_LEVEL;
+
+	return CSS_JS_OK;
+}
+
+static css_js_error get_origin_code (const char* origin, css_origin* ret)
+{
+	if (strcmp(origin, "author") == 0)
+		*ret = CSS_ORIGIN_AUTHOR;
+	else if (strcmp(origin, "user") == 0)
+		*ret = CSS_ORIGIN_USER;
+	else if (strcmp(origin, "ua") == 0 ||
+			strcmp(origin, "UA") == 0 ||
+			strcmp(origin, "user agent") == 0 ||
+			strcmp(origin, "user-agent") == 0)
+		*ret = CSS_ORIGIN_UA;
+	else
+		return CSS_JS_ORIGIN;
+
+	return CSS_JS_OK;
+}
+
+static css_js_error get_media_mask (const char* media, css_media_type* ret)
+{
+	const char *p = media;
+	const char *end = p + strlen(media);
+	css_media_type mask = 0;
+
+	/* <medium> [ ',' <medium> ]* */
+
+	while (p < end) {
+		const char *start = p;
+
+		/* consume a medium */
+		while (*p != ',' && p < end)
+			p++;
+
+                // printf("%s %d\n", start, p - start);
+
+		if (p - start == 10 &&
+				strncasecmp(start, "projection", 10) == 0)
+			mask |= CSS_MEDIA_PROJECTION;
+		else if (p - start == 8 &&
+				strncasecmp(start, "handheld", 8) == 0)
+			mask |= CSS_MEDIA_HANDHELD;
 		else if (p - start == 8 &&
 				strncasecmp(start, "embossed", 8) == 0)
-			media_result |= CSS_MEDIA_EMBOSSED;
+			mask |= CSS_MEDIA_EMBOSSED;
 		else if (p - start == 7 &&
 				strncasecmp(start, "braille", 7) == 0)
-			media_result |= CSS_MEDIA_BRAILLE;
+			mask |= CSS_MEDIA_BRAILLE;
 		else if (p - start == 6 &&
 				strncasecmp(start, "speech", 6) == 0)
-			media_result |= CSS_MEDIA_SPEECH;
+			mask |= CSS_MEDIA_SPEECH;
 		else if (p - start == 6 &&
 				strncasecmp(start, "screen", 6) == 0)
-			media_result |= CSS_MEDIA_SCREEN;
+			mask |= CSS_MEDIA_SCREEN;
 		else if (p - start == 5 &&
 				strncasecmp(start, "print", 5) == 0)
-			media_result |= CSS_MEDIA_PRINT;
+			mask |= CSS_MEDIA_PRINT;
 		else if (p - start == 5 &&
 				strncasecmp(start, "aural", 5) == 0)
-			media_result |= CSS_MEDIA_AURAL;
+			mask |= CSS_MEDIA_AURAL;
 		else if (p - start == 3 &&
 				strncasecmp(start, "tty", 3) == 0)
-			media_result |= CSS_MEDIA_TTY;
+			mask |= CSS_MEDIA_TTY;
 		else if (p - start == 3 &&
 				strncasecmp(start, "all", 3) == 0)
-			media_result |= CSS_MEDIA_ALL;
+			mask |= CSS_MEDIA_ALL;
 		else if (p - start == 2 &&
 				strncasecmp(start, "tv", 2) == 0)
-			media_result |= CSS_MEDIA_TV;
+			mask |= CSS_MEDIA_TV;
+		else
+			return CSS_JS_MEDIA;
+
+		/* Stop if we've reached the end */
+		if (p == end || *p != ',')
+			break;
+
+		/* Consume comma */
+		p++;
+	}
+
+	*ret = mask;
+	return CSS_JS_OK;
+}
+
+css_js_error create_stylesheet (const char* css_string,
+		css_language_level level, const char* url, bool allow_quirks,
+		css_js_sheet** ret)
+{
+	css_error code;
+
+	css_stylesheet_params params;
+	params.params_version = CSS_STYLESHEET_PARAMS_VERSION_1;
+	params.level = level;
+	params.charset = NULL;
+	params.url = url;
+	params.title = NULL;
+	params.allow_quirks = allow_quirks;
+	params.inline_style = false;
+	params.resolve = resolve_url;
+	params.resolve_pw = NULL;
+	params.import = NULL;
+	params.import_pw = NULL;
+	params.color = NULL;
+	params.color_pw = NULL;
+	params.font = NULL;
+	params.font_pw = NULL;
+
+	css_stylesheet *sheet;
+
+	code = css_stylesheet_create(&params, &sheet);
+	if (code != CSS_OK)
+		return CSS_JS_CREATE_SHEET;
+
+	code = css_stylesheet_append_data(
+			sheet,
+			(const uint8_t *) css_string,
+			strlen(css_string) + 1
+			);
+	if (code != CSS_OK && code != CSS_NEEDDATA) {
+		css_stylesheet_destroy(sheet);
+		return CSS_JS_APPEND_DATA;
+	}
+
+	code = css_stylesheet_data_done(sheet);
+	if (code != CSS_OK) {
+		css_stylesheet_destroy(sheet);
+		return CSS_JS_DATA_DONE;
+	}
+
+	*ret = calloc(1, sizeof(css_js_sheet));
+	(*ret)->sheet = sheet;
+	(*ret)->refcnt = 1;
+	if (coverage)
+		(*ret)->source = strdup(css_string);
+	return CSS_JS_OK;
+}
+
+css_js_error release_sheet (css_js_sheet* sheet)
+{
+	if (--sheet->refcnt > 0)
+		return CSS_JS_OK;
+
+	forget_profiled_sheet(sheet->sheet);
+	css_error code = css_stylesheet_destroy(sheet->sheet);
+	free(sheet->source);
+	free(sheet->rule_matches);
+	free(sheet->rule_positions);
+	free(sheet);
+	if (code != CSS_OK)
+		return CSS_JS_DESTROY_SHEET;
+
+	return CSS_JS_OK;
+}
+
+/*
+ * Appends a parsed stylesheet to the current selection context.
+ */
+static css_js_error attach_sheet (css_js_sheet* sheet, css_origin origin,
+		css_media_type media)
+{
+	css_error code;
+	css_js_error js_code;
+
+	/* Referenced by the list from now on, and released by reset_ctx */
+	js_code = append_stylesheet_list(sheet, origin, media);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	if (select_ctx == NULL) {
+		css_js_error js_error = create_ctx();
+		if (js_error != CSS_JS_OK)
+			return js_error;
+	}
+
+        // printf("Appending stylesheet for media %d\n", media);
+	code = css_select_ctx_append_sheet(
+			select_ctx,
+			sheet->sheet,
+			origin,
+			media
+	);
+	if (code != CSS_OK)
+		return CSS_JS_APPEND_SHEET;
+
+	js_code = index_stylesheet(sheet->sheet, media);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	/* Every style may have changed */
+	js_code = free_nodes();
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	return free_share_cache();
+}
+
+css_js_error add_stylesheet (
+		const char* css_string,
+		const char* level,
+		const char* origin,
+		const char* media,
+		const char* url,
+                bool allow_quirks
+		)
+{
+	css_js_error js_code;
+
+	css_language_level css_level;
+	js_code = get_level_code(level, &css_level);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	css_origin orig;
+	js_code = get_origin_code(origin, &orig);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	css_media_type media_result;
+	js_code = get_media_mask(media, &media_result);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	css_js_sheet* sheet;
+	js_code = create_stylesheet(css_string, css_level, url, allow_quirks,
+			&sheet);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	js_code = attach_sheet(sheet, orig, media_result);
+	release_sheet(sheet);
+	return js_code;
+}
+
+css_js_error parse_stylesheet (const char* css_string, const char* level,
+		const char* url, bool allow_quirks, uint32_t* handle)
+{
+	css_language_level css_level;
+	css_js_error js_code = get_level_code(level, &css_level);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	css_js_sheet* sheet;
+	js_code = create_stylesheet(css_string, css_level, url, allow_quirks,
+			&sheet);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	*handle = (uint32_t) (uintptr_t) sheet;
+	return CSS_JS_OK;
+}
+
+css_js_error attach_stylesheet (uint32_t handle, const char* origin,
+		const char* media)
+{
+	css_origin orig;
+	css_js_error js_code = get_origin_code(origin, &orig);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	css_media_type media_result;
+	js_code = get_media_mask(media, &media_result);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	return attach_sheet((css_js_sheet*) (uintptr_t) handle, orig,
+			media_result);
+}
+
+css_js_error release_stylesheet (uint32_t handle)
+{
+	return release_sheet((css_js_sheet*) (uintptr_t) handle);
+}
+
+/* The built-in HTML stylesheet, kept for the lifetime of the module */
+css_js_sheet* html_sheet = NULL;
+
+css_js_error attach_html_stylesheet (void)
+{
+	if (html_sheet == NULL) {
+		css_js_error js_code = create_stylesheet(html_css,
+				CSS_LEVEL_DEFAULT, "", false, &html_sheet);
+		if (js_code != CSS_JS_OK)
+			return js_code;
+	}
+
+	return attach_sheet(html_sheet, CSS_ORIGIN_UA, CSS_MEDIA_ALL);
+}
+
+/*
+ * Selects the style of a node. The inline style, if any, is parsed into a
+ * stylesheet that only lives for the selection.
+ */
+css_js_error build_style(lwc_string* node, css_media_type media,
+		      const char* inline_style,
+		      css_select_results** results)
+{
+	css_error code;
+
+	css_stylesheet* in_style;
+	if (inline_style == NULL || *inline_style == '\0')
+		in_style = NULL;
+	else
+	{
+		css_stylesheet_params params;
+		params.params_version = CSS_STYLESHEET_PARAMS_VERSION_1;
+		params.level = CSS_LEVEL_3;
+		params.charset = NULL;
+		params.url = "";
+		params.title = NULL;
+		params.allow_quirks = false;
+		params.inline_style = true;
+		params.resolve = resolve_url;
+		params.resolve_pw = NULL;
+		params.import = NULL;
+		params.import_pw = NULL;
+		params.color = NULL;
+		params.color_pw = NULL;
+		params.font = NULL;
+		params.font_pw = NULL;
+
+		css_stylesheet* sheet;
+		code = css_stylesheet_create(&params, &sheet);
+		if (code != CSS_OK)
+			return CSS_JS_CREATE_SHEET;
+
+		code = css_stylesheet_append_data(
+				sheet,
+				(const uint8_t *) inline_style,
+				strlen(inline_style) + 1
+				);
+		if (code != CSS_OK && code != CSS_NEEDDATA) {
+			css_stylesheet_destroy(sheet);
+			return CSS_JS_APPEND_DATA;
+		}
+
+		code = css_stylesheet_data_done(sheet);
+		if (code != CSS_OK) {
+			css_stylesheet_destroy(sheet);
+			return CSS_JS_DATA_DONE;
+		}
+
+		in_style = sheet;
+	}
+
+	if (select_ctx == NULL) {
+		css_js_error js_error = create_ctx();
+		if (js_error != CSS_JS_OK) {
+			if (in_style != NULL)
+				css_stylesheet_destroy(in_style);
+			return js_error;
+		}
+	}
+
+        // printf("Creating sr for node %s and media %d\n", lwc_string_data(node), media);
+	double start = profiling ? profile_now() : 0;
+	code = css_select_style(
+			select_ctx,
+			node,
+			media,
+			in_style,
+			&selection_handler,
+			NULL,
+			results
+			);
+
+	if ((profiling || coverage) && code == CSS_OK) {
+		bool sensitive = selection_sensitive;
+		if (profiling) {
+			profile_select_time += profile_now() - start;
+			profile_selections++;
+		}
+		profile_selection(node, media);
+		selection_sensitive = sensitive;
+	}
+
+	/* The results hold their own references to whatever they use */
+	release_held_nodes();
+	if (in_style != NULL)
+		css_stylesheet_destroy(in_style);
+
+	if (code != CSS_OK)
+		return CSS_JS_CREATE_STYLE;
+
+	return CSS_JS_OK;
+}
+
+/*
+ * Selects the style of a node whose selection is missing or out of date.
+ */
+css_js_error select_node (css_js_node* node, css_js_node* parent,
+		lwc_string* parent_id, css_media_type media,
+		const char* inline_style)
+{
+	css_js_error js_code = clear_node_style(node);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	node->share = get_share_entry(parent == NULL ? NULL : parent->share,
+			node->id, media);
+
+	bool has_inline = inline_style != NULL && *inline_style != '\0';
+	/* Hints are not part of the key of the sharing cache */
+	bool has_own_style = has_inline || get_hints(node->id) != NULL;
+	if (!has_own_style && node->share->style != NULL) {
+		node->selected = node->share->style;
+		node->selected->refcnt++;
+	}
+	else {
+		css_select_results* sr;
+		selection_sensitive = false;
+		js_code = build_style(node->id, media, inline_style, &sr);
+		if (js_code != CSS_JS_OK)
+			return js_code;
+
+		css_js_style* style = malloc(sizeof(css_js_style));
+		style->sr = sr;
+		style->refcnt = 1;
+		node->selected = style;
+
+		if (!has_own_style && !selection_sensitive) {
+			node->share->style = style;
+			style->refcnt++;
+		}
+	}
+
+	if (has_inline)
+		lwc_intern_string(inline_style, strlen(inline_style),
+				&node->inline_style);
+	node->parent_id = parent_id == NULL ? NULL : lwc_string_ref(parent_id);
+	set_node_parent(node, parent);
+	node->media = media;
+	node->selected_at = restyle_epoch;
+
+	return CSS_JS_OK;
+}
+
+/*
+ * Composes a selected style of a node with the style it inherits from, or
+ * takes it as is if there is none.
+ */
+css_js_error compose_node_style (css_js_node* node,
+		const css_computed_style* parent_style,
+		css_pseudo_element pseudo)
+{
+	css_error code;
+	css_computed_style *composed;
+
+	if (parent_style == NULL) {
+		node->styles[pseudo] = intern_style(
+				node->selected->sr->styles[pseudo],
+				node->selected);
+		return CSS_JS_OK;
+	}
+
+	code = css_computed_style_compose(parent_style,
+			node->selected->sr->styles[pseudo],
+			compute_font_size, NULL,
+			&composed);
+	if (code != CSS_OK)
+		return CSS_JS_COMPOSE_STYLE;
+
+	node->styles[pseudo] = intern_style(composed, NULL);
+	return CSS_JS_OK;
+}
+
+/*
+ * Composes the style of a pseudo-element, if any rule matched it, with the
+ * style of its originating element.
+ */
+css_js_error compose_pseudo_element (css_js_node* node,
+		css_pseudo_element pseudo)
+{
+	if (node->selected->sr->styles[pseudo] == NULL ||
+			node->styles[pseudo] != NULL)
+		return CSS_JS_OK;
+
+	return compose_node_style(node,
+			get_node_style(node, CSS_PSEUDO_ELEMENT_NONE), pseudo);
+}
+
+/*
+ * Brings the style of a node (and of its ancestors) up to date.
+ * Parameters:
+ * 	node_id: the node.
+ * 	pseudo: the pseudo-element whose style is needed, or
+ * 		CSS_JS_PSEUDO_ELEMENT_ALL.
+ * 	media: the media being queried.
+ * 	inline_style: the node's inline style, "" if none, or NULL if the
+ * 		node is being styled as an ancestor, in which case any
+ * 		inline style it was selected with is kept.
+ * 	ret_node: location to receive the node.
+ */
+css_js_error build_node_sr (lwc_string* node_id, css_pseudo_element pseudo,
+		css_media_type media, const char* inline_style,
+		css_js_node** ret_node)
+{
+	css_js_error js_code;
+
+	/* A node missing from the document gets no entry in the store */
+	css_js_doc_node* doc_node = NULL;
+	if (document_loaded) {
+		doc_node = get_doc_node(node_id);
+		if (doc_node == NULL)
+			return CSS_JS_DOCUMENT;
+	}
+
+	css_js_node* node = get_node_by_id(node_id);
+	if (node == NULL) {
+		node = append_node(node_id);
+	}
+
+	/* Ancestors go first: their state tells whether ours is valid. */
+	css_js_node* parent = NULL;
+	lwc_string* parent_id = NULL;
+	if (document_loaded) {
+		if (doc_node->parent != NULL)
+			parent_id = lwc_string_ref(doc_node->parent->id);
+	}
+	else {
+		get_string(node_id, js_parent_node, &parent_id);
+	}
+	if (parent_id != NULL) {
+		/* Pseudo-elements inherit from their originating element,
+		 * so only the ancestors' element styles are needed. */
+		js_code = build_node_sr(parent_id, CSS_PSEUDO_ELEMENT_NONE,
+				media, NULL, &parent);
+		if (js_code != CSS_JS_OK) {
+			lwc_string_unref(parent_id);
+			return js_code;
+		}
+	}
+
+	node->chain_epoch = 0;
+	if (parent != NULL) {
+		node->chain_epoch = parent->chain_epoch > parent->subtree_epoch
+			? parent->chain_epoch : parent->subtree_epoch;
+	}
+
+	bool valid = node->selected != NULL &&
+		node->media == media &&
+		node->parent_id == parent_id &&
+		node->selected_at >= node->self_epoch &&
+		node->selected_at >= node->chain_epoch &&
+		(parent == NULL ||
+		 node->selected_at >= parent->children_epoch);
+	if (valid && inline_style != NULL) {
+		valid = (*inline_style == '\0')
+			? node->inline_style == NULL
+			: node->inline_style != NULL && strcmp(inline_style,
+					lwc_string_data(node->inline_style)) == 0;
+	}
+
+	if (!valid) {
+		js_code = select_node(node, parent, parent_id, media,
+				inline_style);
+		if (js_code != CSS_JS_OK) {
+			if (parent_id != NULL)
+				lwc_string_unref(parent_id);
+			return js_code;
+		}
+	}
+
+	if (parent_id != NULL)
+		lwc_string_unref(parent_id);
+
+	/* Compose again if the parent's style changed since last time.
+	 * Restyling the parent to an identical style changes nothing. */
+	uint32_t parent_style_id = parent == NULL ? 0 :
+		parent->styles[CSS_PSEUDO_ELEMENT_NONE]->id;
+	if (node->composed_with != parent_style_id) {
+		for (int i = 0; i < CSS_PSEUDO_ELEMENT_COUNT; i++) {
+			release_interned(node->styles[i]);
+			node->styles[i] = NULL;
+		}
+		node->composed_with = parent_style_id;
+	}
+
+	if (node->styles[CSS_PSEUDO_ELEMENT_NONE] == NULL) {
+		js_code = compose_node_style(node,
+				parent == NULL ? NULL : get_node_style(parent,
+					CSS_PSEUDO_ELEMENT_NONE),
+				CSS_PSEUDO_ELEMENT_NONE);
+		if (js_code != CSS_JS_OK)
+			return js_code;
+	}
+
+	if (pseudo == CSS_JS_PSEUDO_ELEMENT_ALL) {
+		for (int i = CSS_PSEUDO_ELEMENT_NONE + 1;
+				i < CSS_PSEUDO_ELEMENT_COUNT; i++) {
+			js_code = compose_pseudo_element(node, i);
+			if (js_code != CSS_JS_OK)
+				return js_code;
+		}
+	}
+	else if (pseudo != CSS_PSEUDO_ELEMENT_NONE) {
+		js_code = compose_pseudo_element(node, pseudo);
+		if (js_code != CSS_JS_OK)
+			return js_code;
+	}
+
+	*ret_node = node;
+	return CSS_JS_OK;
+}
+
+static css_js_error get_pseudo_code (const char* pseudo,
+		css_pseudo_element* ret)
+{
+	if (strcmp(pseudo, "none") == 0)
+		*ret = CSS_PSEUDO_ELEMENT_NONE;
+	else if (strcmp(pseudo, "first-line") == 0)
+		*ret = CSS_PSEUDO_ELEMENT_FIRST_LINE;
+	else if (strcmp(pseudo, "first-letter") == 0)
+		*ret = CSS_PSEUDO_ELEMENT_FIRST_LETTER;
+	else if (strcmp(pseudo, "before") == 0)
+		*ret = CSS_PSEUDO_ELEMENT_BEFORE;
+	else if (strcmp(pseudo, "after") == 0)
+		*ret = CSS_PSEUDO_ELEMENT_AFTER;
+	else if (strcmp(pseudo, "all") == 0)
+		*ret = CSS_JS_PSEUDO_ELEMENT_ALL;
+	else
+		return CSS_JS_PSEUDO;
+
+	return CSS_JS_OK;
+}
+
+/*
+ * Parses a single media type, <len> characters long.
+ */
+static css_js_error get_media_code (const char* media, size_t len,
+		css_media_type* ret)
+{
+	static const struct {
+		const char* name;
+		css_media_type code;
+	} media_types[] = {
+		{ "all", CSS_MEDIA_ALL },
+		{ "tv", CSS_MEDIA_TV },
+		{ "tty", CSS_MEDIA_TTY },
+		{ "aural", CSS_MEDIA_AURAL },
+		{ "print", CSS_MEDIA_PRINT },
+		{ "screen", CSS_MEDIA_SCREEN },
+		{ "speech", CSS_MEDIA_SPEECH },
+		{ "braille", CSS_MEDIA_BRAILLE },
+		{ "embossed", CSS_MEDIA_EMBOSSED },
+		{ "handheld", CSS_MEDIA_HANDHELD },
+		{ "projection", CSS_MEDIA_PROJECTION }
+	};
+
+	for (size_t i = 0; i < sizeof(media_types) / sizeof(media_types[0]);
+			i++) {
+		if (strlen(media_types[i].name) == len &&
+				strncmp(media, media_types[i].name, len) == 0) {
+			*ret = media_types[i].code;
+			return CSS_JS_OK;
+		}
+	}
+
+	return CSS_JS_MEDIA;
+}
+
+/*
+ * Writes the style of a node, or of all its pseudo-elements, to a buffer.
+ * Parameters:
+ * 	ptr: location of the position to write at; receives the position
+ * 		after what was written.
+ * 	len: location of the space left in the buffer; updated likewise.
+ */
+static css_js_error write_style (css_js_node* node, css_pseudo_element pseudo,
+		char** ptr, size_t* len)
+{
+	static const char* pseudo_names[CSS_PSEUDO_ELEMENT_COUNT] = {
+		"none", "first-line", "first-letter", "before", "after"
+	};
+
+	**ptr = '\0';
+
+	for (int i = 0; i < CSS_PSEUDO_ELEMENT_COUNT; i++) {
+		if (pseudo != CSS_JS_PSEUDO_ELEMENT_ALL && (int) pseudo != i)
+			continue;
+
+		/* No rule matched the pseudo-element: it has no style */
+		css_js_interned* style = node->styles[i];
+		if (style == NULL)
+			continue;
+
+		/* With "all", each pseudo-element goes under a heading */
+		if (pseudo == CSS_JS_PSEUDO_ELEMENT_ALL) {
+			int wrote = snprintf(*ptr, *len, "::%s\n",
+					pseudo_names[i]);
+			if (wrote < 0 || (size_t) wrote >= *len)
+				return CSS_JS_RESULTS_LENGTH;
+			*ptr += wrote;
+			*len -= wrote;
+		}
+
+		const char* dump = get_interned_dump(style);
+		if (style->dump_len >= *len)
+			return CSS_JS_RESULTS_LENGTH;
+		memcpy(*ptr, dump, style->dump_len + 1);
+		*ptr += style->dump_len;
+		*len -= style->dump_len;
+	}
+
+	return CSS_JS_OK;
+}
+
+/*
+ * Brings the style of an element up to date for a query.
+ * Parameters:
+ * 	element, pseudo, media and inline_style: same as in get_style.
+ * 	pseudo_code: location to receive the parsed pseudo-element.
+ * 	ret_node: location to receive the element's node.
+ */
+static css_js_error query_node (const char* element, const char* pseudo,
+		const char* media, const char* inline_style,
+		css_pseudo_element* pseudo_code, css_js_node** ret_node)
+{
+	css_js_error js_code;
+
+	js_code = get_pseudo_code(pseudo, pseudo_code);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	css_media_type media_code;
+	js_code = get_media_code(media, strlen(media), &media_code);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	lwc_string* node_id;
+	lwc_intern_string(element, strlen(element), &node_id);
+
+	js_code = build_node_sr(node_id, *pseudo_code,
+		get_equivalent_media(media_code), inline_style, ret_node);
+	lwc_string_unref(node_id);
+
+	return js_code;
+}
+
+css_js_error get_style (const char* element, const char* pseudo,
+			const char* media, const char* inline_style,
+			char* results, size_t len)
+{
+	css_pseudo_element pseudo_code;
+	css_js_node* node;
+
+	css_js_error js_code = query_node(element, pseudo, media, inline_style,
+			&pseudo_code, &node);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	return write_style(node, pseudo_code, &results, &len);
+}
+
+css_js_error get_style_id (const char* element, const char* pseudo,
+			const char* media, const char* inline_style,
+			uint32_t* id)
+{
+	css_pseudo_element pseudo_code;
+	css_js_node* node;
+
+	if (strcmp(pseudo, "all") == 0)
+		return CSS_JS_PSEUDO;
+
+	css_js_error js_code = query_node(element, pseudo, media, inline_style,
+			&pseudo_code, &node);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	*id = node->styles[pseudo_code] == NULL
+		? 0 : node->styles[pseudo_code]->id;
+	return CSS_JS_OK;
+}
+
+css_js_error get_style_handle (const char* element, const char* pseudo,
+			const char* media, const char* inline_style,
+			uint32_t* handle)
+{
+	css_pseudo_element pseudo_code;
+	css_js_node* node;
+
+	if (strcmp(pseudo, "all") == 0)
+		return CSS_JS_PSEUDO;
+
+	css_js_error js_code = query_node(element, pseudo, media, inline_style,
+			&pseudo_code, &node);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	/* The handle keeps the style alive after the node is restyled */
+	css_js_interned* entry = node->styles[pseudo_code];
+	if (entry != NULL)
+		entry->refcnt++;
+
+	*handle = (uint32_t) (uintptr_t) entry;
+	return CSS_JS_OK;
+}
+
+css_js_error get_handle_property (uint32_t handle, const char* property,
+		char* results, size_t len)
+{
+	css_js_interned* entry = (css_js_interned*) (uintptr_t) handle;
+	size_t name_len = strlen(property);
+
+	size_t prop;
+	if (find_export_property(property, name_len, &prop))
+		return write_property(entry->style, prop, results, len);
+
+	*results = '\0';
+
+	/* Other properties have no accessor in export_properties: they are
+	 * found in the text of the style, which has one "property: value"
+	 * line per property */
+	const char* line = get_interned_dump(entry);
+	while (*line != '\0') {
+		const char* end = strchr(line, '\n');
+		if (end == NULL)
+			end = line + strlen(line);
+
+		if (strncmp(line, property, name_len) == 0 &&
+				line[name_len] == ':') {
+			const char* value = line + name_len + 1;
+			while (value < end && *value == ' ')
+				value++;
+
+			size_t value_len = end - value;
+			if (value_len >= len)
+				return CSS_JS_RESULTS_LENGTH;
+			memcpy(results, value, value_len);
+			results[value_len] = '\0';
+			return CSS_JS_OK;
+		}
+
+		line = *end == '\0' ? end : end + 1;
+	}
+
+	return CSS_JS_OK;
+}
+
+css_js_error release_style_handle (uint32_t handle)
+{
+	release_interned((css_js_interned*) (uintptr_t) handle);
+	return CSS_JS_OK;
+}
+
+css_js_error get_style_media (const char* element, const char* pseudo,
+			const char* media, const char* inline_style,
+			char* results, size_t len)
+{
+	css_js_error js_code;
+
+	css_pseudo_element pseudo_code;
+	js_code = get_pseudo_code(pseudo, &pseudo_code);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	/* Parse the list, noting which media share their results */
+	css_media_type requested[CSS_JS_MEDIA_MAX];
+	css_media_type equivalent[CSS_JS_MEDIA_MAX];
+	const char* names[CSS_JS_MEDIA_MAX];
+	size_t lengths[CSS_JS_MEDIA_MAX];
+	size_t count = 0;
+
+	const char* p = media;
+	while (*p != '\0') {
+		const char* start = p;
+		while (*p != '\0' && *p != ',')
+			p++;
+
+		if (count == CSS_JS_MEDIA_MAX)
+			return CSS_JS_MEDIA;
+		js_code = get_media_code(start, p - start, &requested[count]);
+		if (js_code != CSS_JS_OK)
+			return js_code;
+		equivalent[count] = get_equivalent_media(requested[count]);
+		names[count] = start;
+		lengths[count] = p - start;
+		count++;
+
+		if (*p == ',')
+			p++;
+	}
+
+	lwc_string* node_id;
+	lwc_intern_string(element, strlen(element), &node_id);
+
+	char* ptr = results;
+	*ptr = '\0';
+	bool done[CSS_JS_MEDIA_MAX] = { false };
+	for (size_t i = 0; i < count; i++) {
+		if (done[i])
+			continue;
+
+		/* One heading for all the media that share the results */
+		int wrote = snprintf(ptr, len, "@media ");
+		for (size_t j = i; j < count && wrote >= 0 &&
+				(size_t) wrote < len; j++) {
+			if (equivalent[j] != equivalent[i])
+				continue;
+			done[j] = true;
+			wrote += snprintf(ptr + wrote, len - wrote, "%s%.*s",
+					j == i ? "" : ",",
+					(int) lengths[j], names[j]);
+		}
+		if (wrote < 0 || (size_t) wrote + 1 >= len) {
+			lwc_string_unref(node_id);
+			return CSS_JS_RESULTS_LENGTH;
+		}
+		ptr[wrote++] = '\n';
+		ptr += wrote;
+		len -= wrote;
+
+		css_js_node* node;
+		js_code = build_node_sr(node_id, pseudo_code, equivalent[i],
+				inline_style, &node);
+		if (js_code == CSS_JS_OK)
+			js_code = write_style(node, pseudo_code, &ptr, &len);
+		if (js_code != CSS_JS_OK) {
+			lwc_string_unref(node_id);
+			return js_code;
+		}
+	}
+
+	lwc_string_unref(node_id);
+	return CSS_JS_OK;
+}
+
+/*
+ * Text of the values of the properties in export_properties, as written in
+ * get_style's results, indexed by the type returned by libcss's accessor.
+ * NULL stands for the types that have a value, written as such.
+ */
+static const char* const display_names[] = {
+	"inherit", "inline", "block", "list-item", "run-in", "inline-block",
+	"table", "inline-table", "table-row-group", "table-header-group",
+	"table-footer-group", "table-row", "table-column-group",
+	"table-column", "table-cell", "table-caption", "none", "flex",
+	"inline-flex"
+};
+static const char* const position_names[] = {
+	"inherit", "static", "relative", "absolute", "fixed"
+};
+static const char* const float_names[] = {
+	"inherit", "left", "right", "none"
+};
+static const char* const clear_names[] = {
+	"inherit", "none", "left", "right", "both"
+};
+static const char* const visibility_names[] = {
+	"inherit", "visible", "hidden", "collapse"
+};
+static const char* const overflow_names[] = {
+	"inherit", "visible", "hidden", "scroll", "auto"
+};
+static const char* const white_space_names[] = {
+	"inherit", "normal", "pre", "nowrap", "pre-wrap", "pre-line"
+};
+static const char* const text_align_names[] = {
+	"inherit", NULL, "left", "right", "center", "justify", "default",
+	"-libcss-left", "-libcss-center", "-libcss-right"
+};
+static const char* const font_weight_names[] = {
+	"inherit", "normal", "bold", "bolder", "lighter", "100", "200", "300",
+	"400", "500", "600", "700", "800", "900"
+};
+static const char* const font_style_names[] = {
+	"inherit", "normal", "italic", "oblique"
+};
+static const char* const border_style_names[] = {
+	"inherit", "none", "hidden", "dotted", "dashed", "solid", "double",
+	"groove", "ridge", "inset", "outset"
+};
+static const char* const auto_names[] = { "inherit", NULL, "auto" };
+static const char* const none_names[] = { "inherit", NULL, "none" };
+static const char* const normal_names[] = { "inherit", NULL, "normal" };
+static const char* const current_color_names[] = {
+	"inherit", NULL, "currentColor"
+};
+static const char* const value_names[] = { "inherit", NULL };
+static const char* const border_width_names[] = {
+	"inherit", "thin", "medium", "thick", NULL
+};
+static const char* const font_size_names[] = {
+	"inherit", "xx-small", "x-small", "small", "medium", "large",
+	"x-large", "xx-large", "larger", "smaller", NULL
+};
+static const char* const line_height_names[] = {
+	"inherit", NULL, NULL, "normal"
+};
+static const char* const vertical_align_names[] = {
+	"inherit", "baseline", "sub", "super", "top", "text-top", "middle",
+	"bottom", "text-bottom", NULL
+};
+
+#define NAMES(k) (k), sizeof(k) / sizeof((k)[0])
+
+/*
+ * Properties that export_columns can write, with libcss's accessor for
+ * each kind of column and the names of their values.
+ */
+static const struct {
+	const char* name;
+	css_js_column_kind kind;
+	union {
+		uint8_t (*keyword)(const css_computed_style*);
+		uint8_t (*length)(const css_computed_style*, css_fixed*,
+				css_unit*);
+		uint8_t (*number)(const css_computed_style*, css_fixed*);
+		uint8_t (*color)(const css_computed_style*, css_color*);
+		uint8_t (*integer)(const css_computed_style*, int32_t*);
+	} get;
+	const char* const* names;
+	size_t n_names;
+} export_properties[] = {
+	{ "display", CSS_JS_COLUMN_KEYWORD,
+		{ .keyword = css_computed_display_static },
+		NAMES(display_names) },
+	{ "position", CSS_JS_COLUMN_KEYWORD,
+		{ .keyword = css_computed_position },
+		NAMES(position_names) },
+	{ "float", CSS_JS_COLUMN_KEYWORD, { .keyword = css_computed_float },
+		NAMES(float_names) },
+	{ "clear", CSS_JS_COLUMN_KEYWORD, { .keyword = css_computed_clear },
+		NAMES(clear_names) },
+	{ "visibility", CSS_JS_COLUMN_KEYWORD,
+		{ .keyword = css_computed_visibility },
+		NAMES(visibility_names) },
+	{ "overflow-x", CSS_JS_COLUMN_KEYWORD,
+		{ .keyword = css_computed_overflow_x },
+		NAMES(overflow_names) },
+	{ "overflow-y", CSS_JS_COLUMN_KEYWORD,
+		{ .keyword = css_computed_overflow_y },
+		NAMES(overflow_names) },
+	{ "white-space", CSS_JS_COLUMN_KEYWORD,
+		{ .keyword = css_computed_white_space },
+		NAMES(white_space_names) },
+	{ "text-align", CSS_JS_COLUMN_KEYWORD,
+		{ .keyword = css_computed_text_align },
+		NAMES(text_align_names) },
+	{ "font-weight", CSS_JS_COLUMN_KEYWORD,
+		{ .keyword = css_computed_font_weight },
+		NAMES(font_weight_names) },
+	{ "font-style", CSS_JS_COLUMN_KEYWORD,
+		{ .keyword = css_computed_font_style },
+		NAMES(font_style_names) },
+	{ "border-top-style", CSS_JS_COLUMN_KEYWORD,
+		{ .keyword = css_computed_border_top_style },
+		NAMES(border_style_names) },
+	{ "border-right-style", CSS_JS_COLUMN_KEYWORD,
+		{ .keyword = css_computed_border_right_style },
+		NAMES(border_style_names) },
+	{ "border-bottom-style", CSS_JS_COLUMN_KEYWORD,
+		{ .keyword = css_computed_border_bottom_style },
+		NAMES(border_style_names) },
+	{ "border-left-style", CSS_JS_COLUMN_KEYWORD,
+		{ .keyword = css_computed_border_left_style },
+		NAMES(border_style_names) },
+	{ "width", CSS_JS_COLUMN_LENGTH, { .length = css_computed_width },
+		NAMES(auto_names) },
+	{ "height", CSS_JS_COLUMN_LENGTH, { .length = css_computed_height },
+		NAMES(auto_names) },
+	{ "min-width", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_min_width },
+		NAMES(auto_names) },
+	{ "min-height", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_min_height },
+		NAMES(auto_names) },
+	{ "max-width", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_max_width },
+		NAMES(none_names) },
+	{ "max-height", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_max_height },
+		NAMES(none_names) },
+	{ "top", CSS_JS_COLUMN_LENGTH, { .length = css_computed_top },
+		NAMES(auto_names) },
+	{ "right", CSS_JS_COLUMN_LENGTH, { .length = css_computed_right },
+		NAMES(auto_names) },
+	{ "bottom", CSS_JS_COLUMN_LENGTH, { .length = css_computed_bottom },
+		NAMES(auto_names) },
+	{ "left", CSS_JS_COLUMN_LENGTH, { .length = css_computed_left },
+		NAMES(auto_names) },
+	{ "margin-top", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_margin_top },
+		NAMES(auto_names) },
+	{ "margin-right", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_margin_right },
+		NAMES(auto_names) },
+	{ "margin-bottom", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_margin_bottom },
+		NAMES(auto_names) },
+	{ "margin-left", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_margin_left },
+		NAMES(auto_names) },
+	{ "padding-top", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_padding_top },
+		NAMES(value_names) },
+	{ "padding-right", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_padding_right },
+		NAMES(value_names) },
+	{ "padding-bottom", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_padding_bottom },
+		NAMES(value_names) },
+	{ "padding-left", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_padding_left },
+		NAMES(value_names) },
+	{ "border-top-width", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_border_top_width },
+		NAMES(border_width_names) },
+	{ "border-right-width", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_border_right_width },
+		NAMES(border_width_names) },
+	{ "border-bottom-width", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_border_bottom_width },
+		NAMES(border_width_names) },
+	{ "border-left-width", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_border_left_width },
+		NAMES(border_width_names) },
+	{ "font-size", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_font_size },
+		NAMES(font_size_names) },
+	{ "line-height", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_line_height },
+		NAMES(line_height_names) },
+	{ "letter-spacing", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_letter_spacing },
+		NAMES(normal_names) },
+	{ "word-spacing", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_word_spacing },
+		NAMES(normal_names) },
+	{ "text-indent", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_text_indent },
+		NAMES(value_names) },
+	{ "vertical-align", CSS_JS_COLUMN_LENGTH,
+		{ .length = css_computed_vertical_align },
+		NAMES(vertical_align_names) },
+	{ "opacity", CSS_JS_COLUMN_NUMBER,
+		{ .number = css_computed_opacity },
+		NAMES(value_names) },
+	{ "color", CSS_JS_COLUMN_COLOR, { .color = css_computed_color },
+		NAMES(value_names) },
+	{ "background-color", CSS_JS_COLUMN_COLOR,
+		{ .color = css_computed_background_color },
+		NAMES(value_names) },
+	{ "border-top-color", CSS_JS_COLUMN_COLOR,
+		{ .color = css_computed_border_top_color },
+		NAMES(current_color_names) },
+	{ "border-right-color", CSS_JS_COLUMN_COLOR,
+		{ .color = css_computed_border_right_color },
+		NAMES(current_color_names) },
+	{ "border-bottom-color", CSS_JS_COLUMN_COLOR,
+		{ .color = css_computed_border_bottom_color },
+		NAMES(current_color_names) },
+	{ "border-left-color", CSS_JS_COLUMN_COLOR,
+		{ .color = css_computed_border_left_color },
+		NAMES(current_color_names) },
+	{ "z-index", CSS_JS_COLUMN_INTEGER,
+		{ .integer = css_computed_z_index },
+		NAMES(auto_names) }
+};
+
+#define EXPORT_PROPERTY_COUNT \
+	(sizeof(export_properties) / sizeof(export_properties[0]))
+
+/*
+ * Reads a property of a style into an element of each kind of column.
+ * Parameters:
+ * 	prop: the index of the property in export_properties.
+ * 	type, value and unit: locations to receive the property's value,
+ * 		as described for css_js_column_kind.
+ */
+static void read_property (const css_computed_style* style, size_t prop,
+		uint8_t* type, uint32_t* value, uint8_t* unit)
+{
+	css_fixed fixed = 0;
+	css_unit fixed_unit = CSS_UNIT_PX;
+	css_color color = 0;
+	int32_t integer = 0;
+
+	switch (export_properties[prop].kind) {
+	case CSS_JS_COLUMN_KEYWORD:
+		*type = export_properties[prop].get.keyword(style);
+		break;
+	case CSS_JS_COLUMN_LENGTH:
+		*type = export_properties[prop].get.length(style, &fixed,
+				&fixed_unit);
+		*(float*) value = FIXTOFLT(fixed);
+		*unit = fixed_unit;
+		break;
+	case CSS_JS_COLUMN_NUMBER:
+		*type = export_properties[prop].get.number(style, &fixed);
+		*(float*) value = FIXTOFLT(fixed);
+		break;
+	case CSS_JS_COLUMN_COLOR:
+		*type = export_properties[prop].get.color(style, &color);
+		*value = color;
+		break;
+	case CSS_JS_COLUMN_INTEGER:
+		*type = export_properties[prop].get.integer(style, &integer);
+		*(int32_t*) value = integer;
+		break;
+	}
+}
+
+/*
+ * Finds a property, given by its name of <len> characters, in
+ * export_properties.
+ */
+static bool find_export_property (const char* name, size_t len,
+		size_t* prop)
+{
+	for (size_t i = 0; i < EXPORT_PROPERTY_COUNT; i++) {
+		if (strlen(export_properties[i].name) == len &&
+				strncmp(name, export_properties[i].name,
+					len) == 0) {
+			*prop = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Writes a fixed-point number as get_style's results do: with three
+ * decimals, of which dump_computed_style drops the leading zeros (0.001 is
+ * written "0.100").
+ */
+static int write_fixed (char* buf, size_t len, css_fixed value)
+{
+	uint32_t abs = value < 0 ? -value : value;
+	uint32_t fraction = ((abs & 0x3ff) * 1000 + 500) / (1 << 10);
+
+	return snprintf(buf, len, "%s%u.%u%s", value < 0 ? "-" : "",
+			FIXTOINT(abs), fraction,
+			fraction < 10 ? "00" : fraction < 100 ? "0" : "");
+}
+
+/*
+ * Writes a length as get_style's results do: integers without decimals,
+ * followed by the unit.
+ */
+static int write_length (char* buf, size_t len, css_fixed value,
+		css_unit unit)
+{
+	static const char* unit_names[] = {
+		"px", "ex", "em", "in", "cm", "mm", "pt", "pc", "cap", "ch",
+		"ic", "rem", "lh", "rlh", "vh", "vw", "vi", "vb", "vmin",
+		"vmax", "q", "%", "deg", "grad", "rad", "ms", "s", "Hz", "kHz"
+	};
+	const char* name = (size_t) unit <
+		sizeof(unit_names) / sizeof(unit_names[0])
+		? unit_names[unit] : "";
+
+	if (INTTOFIX(FIXTOINT(value)) == value)
+		return snprintf(buf, len, "%d%s", FIXTOINT(value), name);
+
+	int wrote = write_fixed(buf, len, value);
+	if (wrote < 0 || (size_t) wrote >= len)
+		return wrote;
+	return wrote + snprintf(buf + wrote, len - wrote, "%s", name);
+}
+
+/*
+ * Writes a property of a style as get_style's results do, reading it with
+ * libcss's accessor.
+ * Parameters:
+ * 	prop: the index of the property in export_properties.
+ * 	buf: a buffer of size <len> to receive the value.
+ */
+static css_js_error write_property (const css_computed_style* style,
+		size_t prop, char* buf, size_t len)
+{
+	css_fixed fixed = 0;
+	css_unit unit = CSS_UNIT_PX;
+	css_color color = 0;
+	int32_t integer = 0;
+	uint8_t type = 0;
+
+	switch (export_properties[prop].kind) {
+	case CSS_JS_COLUMN_KEYWORD:
+		type = export_properties[prop].get.keyword(style);
+		break;
+	case CSS_JS_COLUMN_LENGTH:
+		type = export_properties[prop].get.length(style, &fixed, &unit);
+		break;
+	case CSS_JS_COLUMN_NUMBER:
+		type = export_properties[prop].get.number(style, &fixed);
+		break;
+	case CSS_JS_COLUMN_COLOR:
+		type = export_properties[prop].get.color(style, &color);
+		break;
+	case CSS_JS_COLUMN_INTEGER:
+		type = export_properties[prop].get.integer(style, &integer);
+		break;
+	}
+
+	int wrote = 0;
+	*buf = '\0';
+	if (type < export_properties[prop].n_names &&
+			export_properties[prop].names[type] != NULL) {
+		wrote = snprintf(buf, len, "%s",
+				export_properties[prop].names[type]);
+	}
+	else {
+		switch (export_properties[prop].kind) {
+		case CSS_JS_COLUMN_KEYWORD:
+			/* Not a computed value */
+			break;
+		case CSS_JS_COLUMN_LENGTH:
+			/* A unitless line height is a number */
+			if (export_properties[prop].get.length ==
+					css_computed_line_height &&
+					type == CSS_LINE_HEIGHT_NUMBER)
+				wrote = write_fixed(buf, len, fixed);
+			else
+				wrote = write_length(buf, len, fixed, unit);
+			break;
+		case CSS_JS_COLUMN_NUMBER:
+			wrote = write_fixed(buf, len, fixed);
+			break;
+		case CSS_JS_COLUMN_COLOR:
+			wrote = snprintf(buf, len, "#%08x", color);
+			break;
+		case CSS_JS_COLUMN_INTEGER:
+			wrote = snprintf(buf, len, "%d", integer);
+			break;
+		}
+	}
+
+	if (wrote < 0 || (size_t) wrote >= len)
+		return CSS_JS_RESULTS_LENGTH;
+	return CSS_JS_OK;
+}
+
+css_js_error export_columns (const char* elements, const char* inline_styles,
+		uint32_t count, const char* media, const char* properties,
+		uint64_t* columns, uint8_t* kinds)
+{
+	css_js_error js_code;
+
+	css_media_type media_code;
+	js_code = get_media_code(media, strlen(media), &media_code);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+	media_code = get_equivalent_media(media_code);
+
+	/* Look the properties up once, not once per element */
+	uint32_t n_props = 0;
+	for (const char* p = properties; *p != '\0'; p++) {
+		if (*p == ',')
+			n_props++;
+	}
+	if (*properties != '\0')
+		n_props++;
+
+	uint32_t props[n_props > 0 ? n_props : 1];
+	const char* p = properties;
+	for (uint32_t i = 0; i < n_props; i++) {
+		const char* start = p;
+		while (*p != '\0' && *p != ',')
+			p++;
+
+		size_t j;
+		if (!find_export_property(start, p - start, &j))
+			return CSS_JS_PROPERTY;
+
+		props[i] = j;
+		kinds[i] = export_properties[j].kind;
+		if (*p == ',')
+			p++;
+	}
+
+	const char* element = elements;
+	const char* inline_style = inline_styles;
+	for (uint32_t n = 0; n < count; n++) {
+		lwc_string* node_id;
+		lwc_intern_string(element, strlen(element), &node_id);
+		css_js_node* node;
+
+		js_code = build_node_sr(node_id, CSS_PSEUDO_ELEMENT_NONE,
+				media_code, inline_style, &node);
+		lwc_string_unref(node_id);
+		if (js_code != CSS_JS_OK)
+			return js_code;
+
+		const css_computed_style* style =
+			get_node_style(node, CSS_PSEUDO_ELEMENT_NONE);
+
+		for (uint32_t i = 0; i < n_props; i++) {
+			uint8_t* type = (uint8_t*) (uintptr_t) columns[3 * i];
+			uint32_t* value =
+				(uint32_t*) (uintptr_t) columns[3 * i + 1];
+			uint8_t* unit = (uint8_t*) (uintptr_t) columns[3 * i + 2];
+			read_property(style, props[i], &type[n], &value[n],
+					&unit[n]);
+		}
+
+		element += strlen(element) + 1;
+		inline_style += strlen(inline_style) + 1;
+	}
+
+	return CSS_JS_OK;
+}
+
+css_js_error get_numeric_properties (char* names, size_t len, uint8_t* kinds,
+		uint32_t* count)
+{
+	char* ptr = names;
+
+	*ptr = '\0';
+	for (size_t i = 0; i < EXPORT_PROPERTY_COUNT; i++) {
+		int wrote = snprintf(ptr, len, "%s%s", i == 0 ? "" : ",",
+				export_properties[i].name);
+		if (wrote < 0 || (size_t) wrote >= len)
+			return CSS_JS_RESULTS_LENGTH;
+		ptr += wrote;
+		len -= wrote;
+		kinds[i] = export_properties[i].kind;
+	}
+
+	*count = EXPORT_PROPERTY_COUNT;
+	return CSS_JS_OK;
+}
+
+css_js_error get_style_numeric (const char* element, const char* pseudo,
+			const char* media, const char* inline_style,
+			uint8_t* types, uint32_t* values, uint8_t* units,
+			bool* has_style)
+{
+	css_pseudo_element pseudo_code;
+	css_js_node* node;
+
+	if (strcmp(pseudo, "all") == 0)
+		return CSS_JS_PSEUDO;
+
+	css_js_error js_code = query_node(element, pseudo, media, inline_style,
+			&pseudo_code, &node);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	const css_computed_style* style = get_node_style(node, pseudo_code);
+	*has_style = style != NULL;
+	if (style == NULL)
+		return CSS_JS_OK;
+
+	for (size_t i = 0; i < EXPORT_PROPERTY_COUNT; i++)
+		read_property(style, i, &types[i], &values[i], &units[i]);
+
+	return CSS_JS_OK;
+}
+
+/*
+ * Marks the styles that may depend on an element for restyling.
+ * Parameters:
+ * 	element: the element on which something changed.
+ * 	parent: the element's parent, or "" (empty string) if it is root.
+ * 	scope: CSS_JS_DEP_* flags telling which elements, relative to
+ * 		<element>, may be affected.
+ * Nothing can be stored below a parent that is not stored itself, so
+ * marks are only needed on stored nodes.
+ */
+void mark_changed (const char* element, const char* parent, uint8_t scope)
+{
+	lwc_string* id;
+	css_js_node* node;
+
+	if (scope == 0)
+		return;
+
+	restyle_epoch++;
+
+	lwc_intern_string(element, strlen(element), &id);
+	node = get_node_by_id(id);
+	lwc_string_unref(id);
+	if (node != NULL) {
+		if (scope & CSS_JS_DEP_SELF)
+			node->self_epoch = restyle_epoch;
+		if (scope & CSS_JS_DEP_DESCENDANTS)
+			node->subtree_epoch = restyle_epoch;
+	}
+
+	if (*parent == '\0')
+		return;
+
+	lwc_intern_string(parent, strlen(parent), &id);
+	node = get_node_by_id(id);
+	lwc_string_unref(id);
+	if (node != NULL) {
+		if (scope & CSS_JS_DEP_SIBLINGS)
+			node->children_epoch = restyle_epoch;
+		if (scope & CSS_JS_DEP_SIBLING_DESCENDANTS)
+			node->subtree_epoch = restyle_epoch;
+	}
+}
+
+static bool is_html_space (char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\f' || c == '\r';
+}
+
+static bool has_class (const char* classes, const char* name, size_t len)
+{
+	const char* p = classes;
+
+	while (*p != '\0') {
+		while (is_html_space(*p))
+			p++;
+		const char* start = p;
+		while (*p != '\0' && !is_html_space(*p))
+			p++;
+		if ((size_t) (p - start) == len && strncmp(start, name, len) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Scope of the classes that are in one class attribute but not the other.
+ */
+static uint8_t class_change_scope (const char* from, const char* to)
+{
+	uint8_t scope = 0;
+	const char* p = from;
+
+	while (*p != '\0') {
+		while (is_html_space(*p))
+			p++;
+		const char* start = p;
+		while (*p != '\0' && !is_html_space(*p))
+			p++;
+		if (p > start && !has_class(to, start, p - start))
+			scope |= get_dependency_scope(CSS_JS_DEP_CLASS, start,
+					p - start);
+	}
+
+	return scope;
+}
+
+css_js_error attribute_changed (const char* element, const char* parent,
+		const char* name, const char* old_value,
+		const char* new_value, bool has_old_value)
+{
+	lwc_string* id;
+	css_js_node* node;
+
+	/* The attribute table is refetched even if no selector cares */
+	lwc_intern_string(element, strlen(element), &id);
+	node = get_node_by_id(id);
+	lwc_string_unref(id);
+	if (node != NULL)
+		free_node_attributes(node);
+
+	uint8_t scope = get_dependency_scope(CSS_JS_DEP_ATTRIBUTE, name,
+			strlen(name));
+
+	if (strcasecmp(name, "class") == 0) {
+		if (has_old_value) {
+			scope |= class_change_scope(old_value, new_value);
+			scope |= class_change_scope(new_value, old_value);
+		}
+		else {
+			scope |= dep_any_scope[CSS_JS_DEP_CLASS];
+		}
+	}
+	else if (strcasecmp(name, "id") == 0) {
+		if (has_old_value) {
+			if (strcmp(old_value, new_value) != 0) {
+				scope |= get_dependency_scope(CSS_JS_DEP_ID,
+						old_value, strlen(old_value));
+				scope |= get_dependency_scope(CSS_JS_DEP_ID,
+						new_value, strlen(new_value));
+			}
+		}
+		else {
+			scope |= dep_any_scope[CSS_JS_DEP_ID];
+		}
+	}
+	else if (strcasecmp(name, "style") == 0) {
+		/* The inline style is the element's own business */
+		scope |= CSS_JS_DEP_SELF;
+	}
+
+	mark_changed(element, parent, scope);
+	return CSS_JS_OK;
+}
+
+css_js_error state_changed (const char* element, const char* parent,
+		const char* state)
+{
+	mark_changed(element, parent, get_dependency_scope(
+				CSS_JS_DEP_PSEUDO_CLASS, state, strlen(state)));
+	return CSS_JS_OK;
+}
+
+css_js_error children_changed (const char* element, const char* parent)
+{
+	lwc_string* id;
+	css_js_node* node;
+
+	/* The children moved among their siblings */
+	uint8_t scope = dep_position_scope;
+	if (scope != 0) {
+		restyle_epoch++;
+		lwc_intern_string(element, strlen(element), &id);
+		node = get_node_by_id(id);
+		lwc_string_unref(id);
+		if (node != NULL) {
+			if (scope & (CSS_JS_DEP_SELF | CSS_JS_DEP_SIBLINGS))
+				node->children_epoch = restyle_epoch;
+			if (scope & (CSS_JS_DEP_DESCENDANTS |
+						CSS_JS_DEP_SIBLING_DESCENDANTS))
+				node->subtree_epoch = restyle_epoch;
+		}
+	}
+
+	/* The element itself may have become (non-)empty */
+	mark_changed(element, parent, get_dependency_scope(
+				CSS_JS_DEP_PSEUDO_CLASS, "empty", 5));
+	return CSS_JS_OK;
+}
+
+/*
+ * Unlinks a node and the stored nodes selected under it.
+ */
+static css_js_error unlink_subtree (css_js_node* node)
+{
+	while (node->children != NULL) {
+		css_js_error js_code = unlink_subtree(node->children);
+		if (js_code != CSS_JS_OK)
+			return js_code;
+	}
+
+	return unlink_node(node);
+}
+
+css_js_error node_removed (const char* element)
+{
+	lwc_string* id;
+
+	lwc_intern_string(element, strlen(element), &id);
+	css_js_node* node = get_node_by_id(id);
+	lwc_string_unref(id);
+
+	if (node == NULL)
+		return CSS_JS_OK;
+
+	return unlink_subtree(node);
+}
+
+css_js_error drop_nodes (void)
+{
+	return free_nodes();
+}
+
+css_js_error get_node_parent (const char* element, const char** parent)
+{
+	lwc_string* id;
+	css_js_node* node;
+
+	lwc_intern_string(element, strlen(element), &id);
+	node = get_node_by_id(id);
+	lwc_string_unref(id);
+
+	/* The parent is recorded when the node is selected */
+	*parent = NULL;
+	if (node != NULL && node->selected != NULL)
+		*parent = node->parent_id == NULL
+			? "" : lwc_string_data(node->parent_id);
+
+	return CSS_JS_OK;
+}
+
+/*
+ * Presentational hints.
+ */
+
+struct hint_keyword {
+	const char* name;
+	uint8_t status;
+};
+
+static const struct hint_keyword width_keywords[] = {
+	{ "auto", CSS_WIDTH_AUTO }, { NULL, 0 }
+};
+static const struct hint_keyword height_keywords[] = {
+	{ "auto", CSS_HEIGHT_AUTO }, { NULL, 0 }
+};
+static const struct hint_keyword margin_keywords[] = {
+	{ "auto", CSS_MARGIN_AUTO }, { NULL, 0 }
+};
+static const struct hint_keyword border_width_keywords[] = {
+	{ "thin", CSS_BORDER_WIDTH_THIN },
+	{ "medium", CSS_BORDER_WIDTH_MEDIUM },
+	{ "thick", CSS_BORDER_WIDTH_THICK },
+	{ NULL, 0 }
+};
+static const struct hint_keyword border_style_keywords[] = {
+	{ "none", CSS_BORDER_STYLE_NONE },
+	{ "hidden", CSS_BORDER_STYLE_HIDDEN },
+	{ "dotted", CSS_BORDER_STYLE_DOTTED },
+	{ "dashed", CSS_BORDER_STYLE_DASHED },
+	{ "solid", CSS_BORDER_STYLE_SOLID },
+	{ "double", CSS_BORDER_STYLE_DOUBLE },
+	{ "groove", CSS_BORDER_STYLE_GROOVE },
+	{ "ridge", CSS_BORDER_STYLE_RIDGE },
+	{ "inset", CSS_BORDER_STYLE_INSET },
+	{ "outset", CSS_BORDER_STYLE_OUTSET },
+	{ NULL, 0 }
+};
+static const struct hint_keyword text_align_keywords[] = {
+	{ "left", CSS_TEXT_ALIGN_LEFT },
+	{ "right", CSS_TEXT_ALIGN_RIGHT },
+	{ "center", CSS_TEXT_ALIGN_CENTER },
+	{ "justify", CSS_TEXT_ALIGN_JUSTIFY },
+	{ NULL, 0 }
+};
+static const struct hint_keyword vertical_align_keywords[] = {
+	{ "baseline", CSS_VERTICAL_ALIGN_BASELINE },
+	{ "sub", CSS_VERTICAL_ALIGN_SUB },
+	{ "super", CSS_VERTICAL_ALIGN_SUPER },
+	{ "top", CSS_VERTICAL_ALIGN_TOP },
+	{ "text-top", CSS_VERTICAL_ALIGN_TEXT_TOP },
+	{ "middle", CSS_VERTICAL_ALIGN_MIDDLE },
+	{ "bottom", CSS_VERTICAL_ALIGN_BOTTOM },
+	{ "text-bottom", CSS_VERTICAL_ALIGN_TEXT_BOTTOM },
+	{ NULL, 0 }
+};
+static const struct hint_keyword float_keywords[] = {
+	{ "left", CSS_FLOAT_LEFT },
+	{ "right", CSS_FLOAT_RIGHT },
+	{ "none", CSS_FLOAT_NONE },
+	{ NULL, 0 }
+};
+static const struct hint_keyword clear_keywords[] = {
+	{ "none", CSS_CLEAR_NONE },
+	{ "left", CSS_CLEAR_LEFT },
+	{ "right", CSS_CLEAR_RIGHT },
+	{ "both", CSS_CLEAR_BOTH },
+	{ NULL, 0 }
+};
+static const struct hint_keyword white_space_keywords[] = {
+	{ "normal", CSS_WHITE_SPACE_NORMAL },
+	{ "pre", CSS_WHITE_SPACE_PRE },
+	{ "nowrap", CSS_WHITE_SPACE_NOWRAP },
+	{ "pre-wrap", CSS_WHITE_SPACE_PRE_WRAP },
+	{ "pre-line", CSS_WHITE_SPACE_PRE_LINE },
+	{ NULL, 0 }
+};
+static const struct hint_keyword font_weight_keywords[] = {
+	{ "normal", CSS_FONT_WEIGHT_NORMAL },
+	{ "bold", CSS_FONT_WEIGHT_BOLD },
+	{ "bolder", CSS_FONT_WEIGHT_BOLDER },
+	{ "lighter", CSS_FONT_WEIGHT_LIGHTER },
+	{ NULL, 0 }
+};
+static const struct hint_keyword font_style_keywords[] = {
+	{ "normal", CSS_FONT_STYLE_NORMAL },
+	{ "italic", CSS_FONT_STYLE_ITALIC },
+	{ "oblique", CSS_FONT_STYLE_OBLIQUE },
+	{ NULL, 0 }
+};
+static const struct hint_keyword font_size_keywords[] = {
+	{ "xx-small", CSS_FONT_SIZE_XX_SMALL },
+	{ "x-small", CSS_FONT_SIZE_X_SMALL },
+	{ "small", CSS_FONT_SIZE_SMALL },
+	{ "medium", CSS_FONT_SIZE_MEDIUM },
+	{ "large", CSS_FONT_SIZE_LARGE },
+	{ "x-large", CSS_FONT_SIZE_X_LARGE },
+	{ "xx-large", CSS_FONT_SIZE_XX_LARGE },
+	{ "larger", CSS_FONT_SIZE_LARGER },
+	{ "smaller", CSS_FONT_SIZE_SMALLER },
+	{ NULL, 0 }
+};
+static const struct hint_keyword no_keywords[] = { { NULL, 0 } };
+
+typedef enum hint_value {
+	HINT_KEYWORD,
+	HINT_LENGTH,
+	HINT_COLOR
+} hint_value;
+
+/*
+ * Properties that can be given as hints: those of HTML's presentational
+ * attributes. <status> is that of a length or color value.
+ */
+static const struct hint_property {
+	const char* name;
+	uint32_t prop;
+	hint_value value;
+	uint8_t status;
+	const struct hint_keyword* keywords;
+} hint_properties[] = {
+	{ "width", CSS_PROP_WIDTH, HINT_LENGTH, CSS_WIDTH_SET,
+		width_keywords },
+	{ "height", CSS_PROP_HEIGHT, HINT_LENGTH, CSS_HEIGHT_SET,
+		height_keywords },
+	{ "margin-top", CSS_PROP_MARGIN_TOP, HINT_LENGTH, CSS_MARGIN_SET,
+		margin_keywords },
+	{ "margin-right", CSS_PROP_MARGIN_RIGHT, HINT_LENGTH, CSS_MARGIN_SET,
+		margin_keywords },
+	{ "margin-bottom", CSS_PROP_MARGIN_BOTTOM, HINT_LENGTH,
+		CSS_MARGIN_SET, margin_keywords },
+	{ "margin-left", CSS_PROP_MARGIN_LEFT, HINT_LENGTH, CSS_MARGIN_SET,
+		margin_keywords },
+	{ "padding-top", CSS_PROP_PADDING_TOP, HINT_LENGTH, CSS_PADDING_SET,
+		no_keywords },
+	{ "padding-right", CSS_PROP_PADDING_RIGHT, HINT_LENGTH,
+		CSS_PADDING_SET, no_keywords },
+	{ "padding-bottom", CSS_PROP_PADDING_BOTTOM, HINT_LENGTH,
+		CSS_PADDING_SET, no_keywords },
+	{ "padding-left", CSS_PROP_PADDING_LEFT, HINT_LENGTH,
+		CSS_PADDING_SET, no_keywords },
+	{ "border-top-width", CSS_PROP_BORDER_TOP_WIDTH, HINT_LENGTH,
+		CSS_BORDER_WIDTH_WIDTH, border_width_keywords },
+	{ "border-right-width", CSS_PROP_BORDER_RIGHT_WIDTH, HINT_LENGTH,
+		CSS_BORDER_WIDTH_WIDTH, border_width_keywords },
+	{ "border-bottom-width", CSS_PROP_BORDER_BOTTOM_WIDTH, HINT_LENGTH,
+		CSS_BORDER_WIDTH_WIDTH, border_width_keywords },
+	{ "border-left-width", CSS_PROP_BORDER_LEFT_WIDTH, HINT_LENGTH,
+		CSS_BORDER_WIDTH_WIDTH, border_width_keywords },
+	{ "border-top-style", CSS_PROP_BORDER_TOP_STYLE, HINT_KEYWORD, 0,
+		border_style_keywords },
+	{ "border-right-style", CSS_PROP_BORDER_RIGHT_STYLE, HINT_KEYWORD, 0,
+		border_style_keywords },
+	{ "border-bottom-style", CSS_PROP_BORDER_BOTTOM_STYLE, HINT_KEYWORD,
+		0, border_style_keywords },
+	{ "border-left-style", CSS_PROP_BORDER_LEFT_STYLE, HINT_KEYWORD, 0,
+		border_style_keywords },
+	{ "border-top-color", CSS_PROP_BORDER_TOP_COLOR, HINT_COLOR,
+		CSS_BORDER_COLOR_COLOR, no_keywords },
+	{ "border-right-color", CSS_PROP_BORDER_RIGHT_COLOR, HINT_COLOR,
+		CSS_BORDER_COLOR_COLOR, no_keywords },
+	{ "border-bottom-color", CSS_PROP_BORDER_BOTTOM_COLOR, HINT_COLOR,
+		CSS_BORDER_COLOR_COLOR, no_keywords },
+	{ "border-left-color", CSS_PROP_BORDER_LEFT_COLOR, HINT_COLOR,
+		CSS_BORDER_COLOR_COLOR, no_keywords },
+	{ "color", CSS_PROP_COLOR, HINT_COLOR, CSS_COLOR_COLOR, no_keywords },
+	{ "background-color", CSS_PROP_BACKGROUND_COLOR, HINT_COLOR,
+		CSS_BACKGROUND_COLOR_COLOR, no_keywords },
+	{ "text-align", CSS_PROP_TEXT_ALIGN, HINT_KEYWORD, 0,
+		text_align_keywords },
+	{ "vertical-align", CSS_PROP_VERTICAL_ALIGN, HINT_LENGTH,
+		CSS_VERTICAL_ALIGN_SET, vertical_align_keywords },
+	{ "float", CSS_PROP_FLOAT, HINT_KEYWORD, 0, float_keywords },
+	{ "clear", CSS_PROP_CLEAR, HINT_KEYWORD, 0, clear_keywords },
+	{ "white-space", CSS_PROP_WHITE_SPACE, HINT_KEYWORD, 0,
+		white_space_keywords },
+	{ "font-weight", CSS_PROP_FONT_WEIGHT, HINT_KEYWORD, 0,
+		font_weight_keywords },
+	{ "font-style", CSS_PROP_FONT_STYLE, HINT_KEYWORD, 0,
+		font_style_keywords },
+	{ "font-size", CSS_PROP_FONT_SIZE, HINT_LENGTH,
+		CSS_FONT_SIZE_DIMENSION, font_size_keywords }
+};
+
+#define HINT_PROPERTY_COUNT \
+	(sizeof(hint_properties) / sizeof(hint_properties[0]))
+
+static const struct {
+	const char* name;
+	css_unit unit;
+} hint_units[] = {
+	{ "px", CSS_UNIT_PX }, { "em", CSS_UNIT_EM }, { "ex", CSS_UNIT_EX },
+	{ "in", CSS_UNIT_IN }, { "cm", CSS_UNIT_CM }, { "mm", CSS_UNIT_MM },
+	{ "pt", CSS_UNIT_PT }, { "pc", CSS_UNIT_PC }, { "%", CSS_UNIT_PCT }
+};
+
+/*
+ * Fills a hint from its property, keyword or unit and value, as given to
+ * set_hints.
+ */
+static css_js_error make_hint (const char* property, const char* keyword,
+		double value, css_hint* hint)
+{
+	const struct hint_property* prop = NULL;
+	for (size_t i = 0; i < HINT_PROPERTY_COUNT; i++) {
+		if (strcmp(property, hint_properties[i].name) == 0) {
+			prop = &hint_properties[i];
+			break;
+		}
+	}
+	if (prop == NULL)
+		return CSS_JS_HINT;
+
+	hint->prop = prop->prop;
+
+	for (const struct hint_keyword* k = prop->keywords; k->name != NULL;
+			k++) {
+		if (strcmp(keyword, k->name) == 0) {
+			hint->status = k->status;
+			return CSS_JS_OK;
+		}
+	}
+
+	if (prop->value == HINT_COLOR && *keyword == '\0') {
+		hint->data.color = (css_color) value;
+		hint->status = prop->status;
+		return CSS_JS_OK;
+	}
+
+	if (prop->value == HINT_LENGTH) {
+		for (size_t i = 0; i < sizeof(hint_units) / sizeof(hint_units[0]);
+				i++) {
+			if (strcmp(keyword, hint_units[i].name) == 0) {
+				hint->data.length.value = FLTTOFIX(value);
+				hint->data.length.unit = hint_units[i].unit;
+				hint->status = prop->status;
+				return CSS_JS_OK;
+			}
+		}
+	}
+
+	return CSS_JS_HINT;
+}
+
+css_js_hints* get_hints (lwc_string* node)
+{
+	if (hint_table_size == 0)
+		return NULL;
+
+	uint32_t bucket = lwc_string_hash_value(node) & (hint_table_size - 1);
+	for (css_js_hints* entry = hint_table[bucket]; entry != NULL;
+			entry = entry->next) {
+		if (entry->node == node)
+			return entry;
+	}
+
+	return NULL;
+}
+
+static void grow_hint_table (void)
+{
+	uint32_t new_size = hint_table_size == 0
+		? HINT_TABLE_MIN : hint_table_size * 2;
+	css_js_hints** new_table = calloc(new_size, sizeof(css_js_hints*));
+
+	for (uint32_t i = 0; i < hint_table_size; i++) {
+		css_js_hints* entry = hint_table[i];
+		while (entry != NULL) {
+			css_js_hints* next = entry->next;
+			uint32_t bucket = lwc_string_hash_value(entry->node) &
+				(new_size - 1);
+			entry->next = new_table[bucket];
+			new_table[bucket] = entry;
+			entry = next;
+		}
+	}
+
+	free(hint_table);
+	hint_table = new_table;
+	hint_table_size = new_size;
+}
+
+/*
+ * Replaces the hints of a node, taking <hints>, or removes them if
+ * <n_hints> is 0. Returns whether they changed.
+ */
+static bool store_hints (lwc_string* node, css_hint* hints,
+		uint32_t n_hints)
+{
+	css_js_hints** link = NULL;
+	css_js_hints* entry = NULL;
+
+	if (hint_table_size > 0) {
+		uint32_t bucket = lwc_string_hash_value(node) &
+			(hint_table_size - 1);
+		for (link = &hint_table[bucket]; *link != NULL;
+				link = &(*link)->next) {
+			if ((*link)->node == node) {
+				entry = *link;
+				break;
+			}
+		}
+	}
+
+	if (entry == NULL) {
+		if (n_hints == 0)
+			return false;
+
+		if (hint_table_count >= hint_table_size)
+			grow_hint_table();
+
+		entry = malloc(sizeof(css_js_hints));
+		entry->node = lwc_string_ref(node);
+		entry->hints = hints;
+		entry->n_hints = n_hints;
+
+		uint32_t bucket = lwc_string_hash_value(node) &
+			(hint_table_size - 1);
+		entry->next = hint_table[bucket];
+		hint_table[bucket] = entry;
+		hint_table_count++;
+		return true;
+	}
+
+	if (n_hints == 0) {
+		*link = entry->next;
+		lwc_string_unref(entry->node);
+		free(entry->hints);
+		free(entry);
+		hint_table_count--;
+		return true;
+	}
+
+	if (entry->n_hints == n_hints && memcmp(entry->hints, hints,
+				n_hints * sizeof(css_hint)) == 0) {
+		free(hints);
+		return false;
+	}
+
+	free(entry->hints);
+	entry->hints = hints;
+	entry->n_hints = n_hints;
+	return true;
+}
+
+css_js_error free_hints (void)
+{
+	for (uint32_t i = 0; i < hint_table_size; i++) {
+		css_js_hints* entry = hint_table[i];
+		while (entry != NULL) {
+			css_js_hints* next = entry->next;
+			lwc_string_unref(entry->node);
+			free(entry->hints);
+			free(entry);
+			entry = next;
+		}
+	}
+
+	free(hint_table);
+	hint_table = NULL;
+	hint_table_size = 0;
+	hint_table_count = 0;
+
+	return CSS_JS_OK;
+}
+
+/*
+ * Checks every hint given to set_hints, so that invalid hints are rejected
+ * before any is stored.
+ */
+static css_js_error check_hints (const char* strings, const double* values,
+		uint32_t count)
+{
+	const char* s = strings;
+	const double* v = values;
+
+	for (uint32_t i = 0; i < count; i++) {
+		s += strlen(s) + 1;
+
+		uint32_t n_hints = (uint32_t) *v++;
+		for (uint32_t j = 0; j < n_hints; j++) {
+			const char* property = s;
+			s += strlen(s) + 1;
+			const char* keyword = s;
+			s += strlen(s) + 1;
+
+			css_hint hint;
+			css_js_error js_code = make_hint(property, keyword,
+					*v++, &hint);
+			if (js_code != CSS_JS_OK)
+				return js_code;
+		}
+	}
+
+	return CSS_JS_OK;
+}
+
+css_js_error set_hints (const char* strings, const double* values,
+		uint32_t count)
+{
+	const char* s = strings;
+	const double* v = values;
+
+	css_js_error js_code = check_hints(strings, values, count);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	for (uint32_t i = 0; i < count; i++) {
+		const char* element = s;
+		s += strlen(s) + 1;
+
+		uint32_t n_hints = (uint32_t) *v++;
+		/* Zeroed, so that the hints can be compared as memory */
+		css_hint* hints = n_hints == 0
+			? NULL : calloc(n_hints, sizeof(css_hint));
+
+		for (uint32_t j = 0; j < n_hints; j++) {
+			const char* property = s;
+			s += strlen(s) + 1;
+			const char* keyword = s;
+			s += strlen(s) + 1;
+
+			/* Already checked */
+			make_hint(property, keyword, *v++, &hints[j]);
+		}
+
+		lwc_string* id;
+		lwc_intern_string(element, strlen(element), &id);
+		bool changed = store_hints(id, hints, n_hints);
+		lwc_string_unref(id);
+
+		/* Hints only change the element's own selection */
+		if (changed)
+			mark_changed(element, "", CSS_JS_DEP_SELF);
+	}
+
+	return CSS_JS_OK;
+}
+
+static void count_string (lwc_string* str, void* pw)
+{
+	UNUSED(str);
+	(*(uint32_t*) pw)++;
+}
+
+css_js_error get_memory_stats (uint32_t* stats)
+{
+	struct mallinfo info = mallinfo();
+	stats[CSS_JS_STAT_HEAP] = info.uordblks;
+
+	stats[CSS_JS_STAT_STRINGS] = 0;
+	lwc_iterate_strings(count_string, &stats[CSS_JS_STAT_STRINGS]);
+
+	stats[CSS_JS_STAT_NODES] = node_table_count;
+	stats[CSS_JS_STAT_STYLES] = intern_table_count;
+	stats[CSS_JS_STAT_SHEETS] = sheet_count;
+	stats[CSS_JS_STAT_TEXT] = intern_dump_bytes;
+	stats[CSS_JS_STAT_SHARES] = share_table_count;
+	return CSS_JS_OK;
+}
+
+/*
+ * Selection contexts. <current_context> is where the globals are saved when
+ * another context is used.
+ */
+css_js_context default_context;
+css_js_context* current_context = &default_context;
+
+static void save_context (css_js_context* context)
+{
+	context->select_ctx = select_ctx;
+	context->first_sheet = first_sheet;
+	context->sheet_count = sheet_count;
+	context->node_table = node_table;
+	context->node_table_size = node_table_size;
+	context->node_table_count = node_table_count;
+	context->share_table = share_table;
+	context->share_table_size = share_table_size;
+	context->share_table_count = share_table_count;
+	context->dep_table = dep_table;
+	context->dep_table_size = dep_table_size;
+	context->dep_table_count = dep_table_count;
+	context->dep_position_scope = dep_position_scope;
+	context->media_masks = media_masks;
+	context->media_mask_count = media_mask_count;
+	context->dep_index_refs = dep_index_refs;
+	context->doc_table = doc_table;
+	context->doc_table_size = doc_table_size;
+	context->doc_table_count = doc_table_count;
+	context->doc_first_root = doc_first_root;
+	context->doc_last_root = doc_last_root;
+	context->document_loaded = document_loaded;
+	context->hint_table = hint_table;
+	context->hint_table_size = hint_table_size;
+	context->hint_table_count = hint_table_count;
+	context->environment = environment;
+	memcpy(context->dep_any_scope, dep_any_scope, sizeof(dep_any_scope));
+}
+
+static void load_context (const css_js_context* context)
+{
+	select_ctx = context->select_ctx;
+	first_sheet = context->first_sheet;
+	sheet_count = context->sheet_count;
+	node_table = context->node_table;
+	node_table_size = context->node_table_size;
+	node_table_count = context->node_table_count;
+	share_table = context->share_table;
+	share_table_size = context->share_table_size;
+	share_table_count = context->share_table_count;
+	dep_table = context->dep_table;
+	dep_table_size = context->dep_table_size;
+	dep_table_count = context->dep_table_count;
+	dep_position_scope = context->dep_position_scope;
+	media_masks = context->media_masks;
+	media_mask_count = context->media_mask_count;
+	dep_index_refs = context->dep_index_refs;
+	doc_table = context->doc_table;
+	doc_table_size = context->doc_table_size;
+	doc_table_count = context->doc_table_count;
+	doc_first_root = context->doc_first_root;
+	doc_last_root = context->doc_last_root;
+	document_loaded = context->document_loaded;
+	hint_table = context->hint_table;
+	hint_table_size = context->hint_table_size;
+	hint_table_count = context->hint_table_count;
+	environment = context->environment;
+	memcpy(dep_any_scope, context->dep_any_scope, sizeof(dep_any_scope));
+}
+
+css_js_error create_context (uint32_t* handle)
+{
+	/* All empty, as the globals are before the first sheet is added */
+	css_js_context* context = calloc(1, sizeof(css_js_context));
+	context->environment = (css_js_env) DEFAULT_ENVIRONMENT;
+	context->next = default_context.next;
+	default_context.next = context;
+	*handle = (uint32_t) (uintptr_t) context;
+	return CSS_JS_OK;
+}
+
+css_js_error use_context (uint32_t handle)
+{
+	css_js_context* context = handle == 0
+		? &default_context : (css_js_context*) (uintptr_t) handle;
+
+	if (context != current_context) {
+		save_context(current_context);
+		load_context(context);
+		current_context = context;
+	}
+
+	return CSS_JS_OK;
+}
+
+css_js_error destroy_context (uint32_t handle)
+{
+	css_js_error js_code;
+
+	/* The default context is only ever reset */
+	if (handle == 0)
+		return CSS_JS_DESTROY_CTX;
+
+	js_code = use_context(handle);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	js_code = unload_document();
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	js_code = free_hints();
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	js_code = reset_ctx();
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	/* Nothing left to save */
+	load_context(&default_context);
+	current_context = &default_context;
+
+	css_js_context** link = &default_context.next;
+	while (*link != (css_js_context*) (uintptr_t) handle)
+		link = &(*link)->next;
+	*link = (*link)->next;
+	free((css_js_context*) (uintptr_t) handle);
+
+	return CSS_JS_OK;
+}
+
+css_js_error set_environment (int32_t font_size, const char* font_family,
+		uint32_t color, double ex_ratio)
+{
+	static const struct {
+		const char* name;
+		uint8_t family;
+	} families[] = {
+		{ "serif", CSS_FONT_FAMILY_SERIF },
+		{ "sans-serif", CSS_FONT_FAMILY_SANS_SERIF },
+		{ "cursive", CSS_FONT_FAMILY_CURSIVE },
+		{ "fantasy", CSS_FONT_FAMILY_FANTASY },
+		{ "monospace", CSS_FONT_FAMILY_MONOSPACE }
+	};
+	css_js_env env;
+
+	if (font_size <= 0 || !(ex_ratio > 0))
+		return CSS_JS_ENVIRONMENT;
+
+	size_t i;
+	for (i = 0; i < sizeof(families) / sizeof(families[0]); i++) {
+		if (strcmp(font_family, families[i].name) == 0)
+			break;
+	}
+	if (i == sizeof(families) / sizeof(families[0]))
+		return CSS_JS_ENVIRONMENT;
+
+	env.font_size = font_size;
+	env.font_family = families[i].family;
+	env.color = color;
+	env.ex_ratio = FLTTOFIX(ex_ratio);
+
+	if (env.font_size == environment.font_size &&
+			env.font_family == environment.font_family &&
+			env.color == environment.color &&
+			env.ex_ratio == environment.ex_ratio)
+		return CSS_JS_OK;
+	environment = env;
+
+	/* Every style may have changed */
+	css_js_error js_code = free_nodes();
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	return free_share_cache();
+}
+
+/*
+ * Drops the styles of every context, so that each node is selected again
+ * when next queried.
+ */
+static css_js_error free_all_styles (void)
+{
+	css_js_error js_code = CSS_JS_OK;
+
+	save_context(current_context);
+	for (css_js_context* context = &default_context; context != NULL;
+			context = context->next) {
+		load_context(context);
+		js_code = free_nodes();
+		if (js_code == CSS_JS_OK)
+			js_code = free_share_cache();
+		save_context(context);
+		if (js_code != CSS_JS_OK)
+			break;
+	}
+	load_context(current_context);
+
+	return js_code;
+}
+
+/*
+ * Shares the dependency index and media masks of another context with the
+ * current one, which must have none. Whichever adds a stylesheet first
+ * copies them (see own_dependency_index).
+ */
+static void share_dependency_index (css_js_context* from)
+{
+	if (from->dep_table == NULL && from->media_masks == NULL)
+		return;
+
+	if (from->dep_index_refs == NULL) {
+		from->dep_index_refs = malloc(sizeof(uint32_t));
+		*from->dep_index_refs = 1;
+	}
+	(*from->dep_index_refs)++;
+	dep_index_refs = from->dep_index_refs;
+
+	dep_table = from->dep_table;
+	dep_table_size = from->dep_table_size;
+	dep_table_count = from->dep_table_count;
+	memcpy(dep_any_scope, from->dep_any_scope, sizeof(dep_any_scope));
+	dep_position_scope = from->dep_position_scope;
+
+	media_masks = from->media_masks;
+	media_mask_count = from->media_mask_count;
+}
+
+css_js_error derive_context (uint32_t base, uint32_t* handle)
+{
+	css_error code;
+	css_js_error js_code;
+	uint32_t previous = current_context == &default_context
+		? 0 : (uint32_t) (uintptr_t) current_context;
+
+	js_code = create_context(handle);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	/* Leaves the state of <base> saved in its css_js_context */
+	js_code = use_context(base);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+	css_js_context* from = current_context;
+	js_code = use_context(*handle);
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	if (from->first_sheet != NULL) {
+		js_code = create_ctx();
+		if (js_code != CSS_JS_OK)
+			return js_code;
+	}
+
+	/* The sheets carry their own selector hashes: nothing is parsed */
+	for (stylesheet_list* entry = from->first_sheet; entry != NULL;
+			entry = entry->next) {
+		js_code = append_stylesheet_list(entry->sheet, entry->origin,
+				entry->media);
+		if (js_code != CSS_JS_OK)
+			return js_code;
+
+		code = css_select_ctx_append_sheet(select_ctx,
+				entry->sheet->sheet, entry->origin, entry->media);
+		if (code != CSS_OK)
+			return CSS_JS_APPEND_SHEET;
+	}
+
+	share_dependency_index(from);
+	environment = from->environment;
+
+	return use_context(previous);
+}
+
+/******************************************************************************
+ * Attribute tables							      *
+ ******************************************************************************/
+
+/*
+ * Reads the next null-terminated field of a buffer of fields.
+ */
+static const char* next_field (const char** data)
+{
+	const char* field = *data;
+	*data += strlen(field) + 1;
+	return field;
+}
+
+static void intern_attribute (const char* name, const char* value,
+		css_js_attr* attr)
+{
+	intern_lowercase(name, strlen(name), &attr->name);
+	lwc_intern_string(value, strlen(value), &attr->value);
+	intern_lowercase(value, strlen(value), &attr->lower_value);
+}
+
+static void free_attributes (css_js_attr* attrs, uint32_t n_attrs)
+{
+	for (uint32_t i = 0; i < n_attrs; i++) {
+		lwc_string_unref(attrs[i].name);
+		lwc_string_unref(attrs[i].value);
+		lwc_string_unref(attrs[i].lower_value);
+	}
+	free(attrs);
+}
+
+void free_node_attributes (css_js_node* node)
+{
+	free_attributes(node->attrs, node->n_attrs);
+	node->attrs = NULL;
+	node->n_attrs = 0;
+	node->attrs_loaded = false;
+}
+
+/*
+ * Gets the attribute table of a node: that of the loaded document, if any,
+ * or else the one kept in the node store, which is fetched from the
+ * handlers the first time. js_node_attributes gives the count of
+ * attributes followed by their names and values, all null-terminated.
+ */
+static void get_attributes (lwc_string* id, css_js_attr** attrs,
+		uint32_t* n_attrs)
+{
+	if (document_loaded) {
+		css_js_doc_node* doc_node = get_doc_node(id);
+		*attrs = doc_node == NULL ? NULL : doc_node->attrs;
+		*n_attrs = doc_node == NULL ? 0 : doc_node->n_attrs;
+		return;
+	}
+
+	css_js_node* node = get_node_by_id(id);
+	if (node == NULL)
+		node = append_node(id);
+
+	if (!node->attrs_loaded) {
+		char* js_results = (*js_node_attributes)(lwc_string_data(id));
+		const char* data = js_results;
+
+		node->n_attrs = strtoul(next_field(&data), NULL, 10);
+		node->attrs = node->n_attrs == 0
+			? NULL : calloc(node->n_attrs, sizeof(css_js_attr));
+		for (uint32_t i = 0; i < node->n_attrs; i++) {
+			const char* name = next_field(&data);
+			const char* value = next_field(&data);
+			intern_attribute(name, value, &node->attrs[i]);
+		}
+
+		free(js_results);
+		node->attrs_loaded = true;
+	}
+
+	*attrs = node->attrs;
+	*n_attrs = node->n_attrs;
+}
+
+static css_js_attr* find_attribute (css_js_attr* attrs, uint32_t n_attrs,
+		lwc_string* name)
+{
+	for (uint32_t i = 0; i < n_attrs; i++) {
+		bool equal;
+		/* Names are lowercased, as selectors usually are */
+		if (attrs[i].name == name || (lwc_string_caseless_isequal(
+				attrs[i].name, name, &equal) ==
+					lwc_error_ok && equal))
+			return &attrs[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Finds the first occurrence of <needle>, which must not be empty, in
+ * <haystack>. Candidates are found with memchr, which libc vectorizes.
+ */
+static const char* find_bytes (const char* haystack, size_t len,
+		const char* needle, size_t needle_len)
+{
+	const char* end = haystack + len;
+	const char* p = haystack;
+
+	while ((size_t) (end - p) >= needle_len) {
+		p = memchr(p, needle[0], end - p - needle_len + 1);
+		if (p == NULL)
+			return NULL;
+		if (memcmp(p + 1, needle + 1, needle_len - 1) == 0)
+			return p;
+		p++;
+	}
+
+	return NULL;
+}
+
+/*
+ * Tells whether the whitespace-separated list <list> contains <word>.
+ */
+static bool has_word (const char* list, size_t len, const char* word,
+		size_t word_len)
+{
+	const char* end = list + len;
+	const char* p = list;
+
+	while ((p = find_bytes(p, end - p, word, word_len)) != NULL) {
+		if ((p == list || is_html_space(p[-1])) &&
+				(p + word_len == end ||
+				 is_html_space(p[word_len])))
+			return true;
+		p++;
+	}
+
+	return false;
+}
+
+/*
+ * Case-insensitive match of an attribute value against that of an
+ * attribute selector. Following Selectors Level 3, [att~=val] matches
+ * words of a whitespace-separated list, [att|=val] matches val or a prefix
+ * val followed by "-", and an empty val matches nothing for ~=, ^=, $= and
+ * *=. The selector value is folded when its stylesheet is indexed.
+ */
+static bool match_attribute_value (const css_js_attr* attr,
+		lwc_string* value, css_selector_type type)
+{
+	lwc_string* lower;
+	css_js_dep* dep = find_dep(CSS_JS_DEP_VALUE, value);
+	if (dep != NULL)
+		lower = lwc_string_ref(dep->lower);
+	else
+		intern_lowercase(lwc_string_data(value),
+				lwc_string_length(value), &lower);
+
+	const char* data = lwc_string_data(attr->lower_value);
+	size_t len = lwc_string_length(attr->lower_value);
+	const char* v = lwc_string_data(lower);
+	size_t v_len = lwc_string_length(lower);
+	bool match = false;
+
+	switch (type) {
+	case CSS_SELECTOR_ATTRIBUTE_EQUAL:
+		/* Both are interned */
+		match = attr->lower_value == lower;
+		break;
+	case CSS_SELECTOR_ATTRIBUTE_DASHMATCH:
+		match = attr->lower_value == lower || (len > v_len &&
+				data[v_len] == '-' &&
+				memcmp(data, v, v_len) == 0);
+		break;
+	case CSS_SELECTOR_ATTRIBUTE_INCLUDES:
+		match = v_len > 0 && strpbrk(v, " \t\n\f\r") == NULL &&
+			has_word(data, len, v, v_len);
+		break;
+	case CSS_SELECTOR_ATTRIBUTE_PREFIX:
+		match = v_len > 0 && len >= v_len &&
+			memcmp(data, v, v_len) == 0;
+		break;
+	case CSS_SELECTOR_ATTRIBUTE_SUFFIX:
+		match = v_len > 0 && len >= v_len &&
+			memcmp(data + len - v_len, v, v_len) == 0;
+		break;
+	case CSS_SELECTOR_ATTRIBUTE_SUBSTRING:
+		match = v_len > 0 && find_bytes(data, len, v, v_len) != NULL;
+		break;
+	default:
+		break;
+	}
+
+	lwc_string_unref(lower);
+	return match;
+}
+
+static css_error has_attribute_value (void* node, const css_qname* qname,
+		lwc_string* value, css_selector_type type, bool* match)
+{
+	css_js_attr* attrs;
+	uint32_t n_attrs;
+	get_attributes((lwc_string*) node, &attrs, &n_attrs);
+
+	css_js_attr* attr = find_attribute(attrs, n_attrs, qname->name);
+	*match = attr != NULL && match_attribute_value(attr, value, type);
+	return CSS_OK;
+}
+
+/******************************************************************************
+ * Loaded document							      *
+ ******************************************************************************/
+
+css_js_doc_node* get_doc_node (lwc_string* id)
+{
+	if (doc_table_size == 0)
+		return NULL;
+
+	uint32_t bucket = lwc_string_hash_value(id) & (doc_table_size - 1);
+	for (css_js_doc_node* node = doc_table[bucket];
+			node != NULL;
+			node = node->next) {
+		if (node->id == id)
+			return node;
+	}
+
+	return NULL;
+}
+
+
+static void set_doc_classes (css_js_doc_node* node, const char* value)
+{
+	const char* p = value;
+	uint32_t num = 0;
+
+	while (*p != '\0') {
+		while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\f' ||
+				*p == '\r')
+			p++;
+		if (*p == '\0')
+			break;
+		const char* start = p;
+		while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\n' &&
+				*p != '\f' && *p != '\r')
+			p++;
+
+		node->classes = realloc(node->classes,
+				(num + 1) * sizeof(lwc_string*));
+		lwc_intern_string(start, p - start, &node->classes[num]);
+		num++;
+	}
+
+	node->n_classes = num;
+}
+
+static void free_doc_node (css_js_doc_node* node)
+{
+	lwc_string_unref(node->id);
+	if (node->name != NULL)
+		lwc_string_unref(node->name);
+	if (node->lower_name != NULL)
+		lwc_string_unref(node->lower_name);
+	if (node->id_attr != NULL)
+		lwc_string_unref(node->id_attr);
+	for (uint32_t i = 0; i < node->n_classes; i++)
+		lwc_string_unref(node->classes[i]);
+	free(node->classes);
+	free_attributes(node->attrs, node->n_attrs);
+	free(node);
+}
+
+css_js_error unload_document (void)
+{
+	for (uint32_t i = 0; i < doc_table_size; i++) {
+		css_js_doc_node* node = doc_table[i];
+		while (node != NULL) {
+			css_js_doc_node* next = node->next;
+			free_doc_node(node);
+			node = next;
+		}
+	}
+
+	free(doc_table);
+	doc_table = NULL;
+	doc_table_size = 0;
+	doc_table_count = 0;
+	doc_first_root = NULL;
+	doc_last_root = NULL;
+	document_loaded = false;
+
+	/* Styles were selected against the document */
+	css_js_error js_code = free_nodes();
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	return free_share_cache();
+}
+
+/*
+ * Numbers the siblings of a list, in total and by name.
+ */
+static void count_doc_siblings (css_js_doc_node* first)
+{
+	int32_t index = 0;
+	css_js_doc_node* last = NULL;
+
+	for (css_js_doc_node* node = first; node != NULL;
+			node = node->next_sibling) {
+		node->index = index++;
+		node->same_name_before = 0;
+		for (css_js_doc_node* prev = node->prev_sibling; prev != NULL;
+				prev = prev->prev_sibling) {
+			if (prev->lower_name == node->lower_name) {
+				node->same_name_before =
+					prev->same_name_before + 1;
+				break;
+			}
+		}
+		last = node;
+	}
+
+	for (css_js_doc_node* node = last; node != NULL;
+			node = node->prev_sibling) {
+		node->after = index - node->index - 1;
+		node->same_name_after = 0;
+		for (css_js_doc_node* next = node->next_sibling; next != NULL;
+				next = next->next_sibling) {
+			if (next->lower_name == node->lower_name) {
+				node->same_name_after =
+					next->same_name_after + 1;
+				break;
+			}
+		}
+	}
+}
+
+css_js_error load_document (const char* data, uint32_t count)
+{
+	css_js_error js_code = unload_document();
+	if (js_code != CSS_JS_OK)
+		return js_code;
+
+	doc_table_size = DOC_TABLE_MIN;
+	while (doc_table_size < count)
+		doc_table_size *= 2;
+	doc_table = calloc(doc_table_size, sizeof(css_js_doc_node*));
+	document_loaded = true;
+
+	for (uint32_t n = 0; n < count; n++) {
+		const char* id = next_field(&data);
+		const char* name = next_field(&data);
+		const char* parent_id = next_field(&data);
+		const char* n_attrs = next_field(&data);
+
+		css_js_doc_node* node = calloc(1, sizeof(css_js_doc_node));
+		lwc_intern_string(id, strlen(id), &node->id);
+		lwc_intern_string(name, strlen(name), &node->name);
+		intern_lowercase(name, strlen(name), &node->lower_name);
+
+		if (get_doc_node(node->id) != NULL) {
+			free_doc_node(node);
+			unload_document();
+			return CSS_JS_DOCUMENT;
+		}
+
+		node->n_attrs = strtoul(n_attrs, NULL, 10);
+		node->attrs = calloc(node->n_attrs, sizeof(css_js_attr));
+		for (uint32_t i = 0; i < node->n_attrs; i++) {
+			const char* attr = next_field(&data);
+			const char* value = next_field(&data);
+
+			intern_attribute(attr, value, &node->attrs[i]);
+
+			if (strcmp(lwc_string_data(node->attrs[i].name),
+						"id") == 0 &&
+					node->id_attr == NULL &&
+					*value != '\0')
+				node->id_attr = lwc_string_ref(
+						node->attrs[i].value);
+			else if (strcmp(lwc_string_data(node->attrs[i].name),
+						"class") == 0 &&
+					node->classes == NULL)
+				set_doc_classes(node, value);
+		}
+
+		node->has_text = *next_field(&data) == '1';
+
+		/* Parents come before their children */
+		css_js_doc_node* parent = NULL;
+		if (*parent_id != '\0') {
+			lwc_string* parent_str;
+			lwc_intern_string(parent_id, strlen(parent_id),
+					&parent_str);
+			parent = get_doc_node(parent_str);
+			lwc_string_unref(parent_str);
+			if (parent == NULL) {
+				free_doc_node(node);
+				unload_document();
+				return CSS_JS_DOCUMENT;
+			}
+		}
+
+		node->parent = parent;
+		css_js_doc_node** last = parent == NULL
+			? &doc_last_root : &parent->last_child;
+		node->prev_sibling = *last;
+		if (*last != NULL)
+			(*last)->next_sibling = node;
+		else if (parent == NULL)
+			doc_first_root = node;
 		else
-			return CSS_JS_MEDIA;
+			parent->first_child = node;
+		*last = node;
+
+		uint32_t bucket = lwc_string_hash_value(node->id) &
+			(doc_table_size - 1);
+		node->next = doc_table[bucket];
+		doc_table[bucket] = node;
+		doc_table_count++;
+	}
+
+	count_doc_siblings(doc_first_root);
+	for (uint32_t i = 0; i < doc_table_size; i++) {
+		for (css_js_doc_node* node = doc_table[i]; node != NULL;
+				node = node->next)
+			count_doc_siblings(node->first_child);
+	}
+
+	return CSS_JS_OK;
+}
+
+static bool doc_has_name (css_js_doc_node* node, lwc_string* name)
+{
+	bool equal;
+	if (lwc_string_length(name) == 1 && *lwc_string_data(name) == '*')
+		return true;
+
+	return node->name == name || node->lower_name == name ||
+		(lwc_string_caseless_isequal(node->name, name, &equal) ==
+		 lwc_error_ok && equal);
+}
+
+static css_error doc_relative (void* node, const css_qname* qname,
+		css_combinator relation, void** ret)
+{
+	css_js_doc_node* n = get_doc_node((lwc_string*) node);
+	css_js_doc_node* found = NULL;
+
+	if (n != NULL) {
+		switch (relation) {
+		case CSS_COMBINATOR_ANCESTOR:
+			for (found = n->parent; found != NULL &&
+					!doc_has_name(found, qname->name);
+					found = found->parent)
+				;
+			break;
+		case CSS_COMBINATOR_PARENT:
+			found = n->parent;
+			if (found != NULL && !doc_has_name(found, qname->name))
+				found = NULL;
+			break;
+		case CSS_COMBINATOR_SIBLING:
+			found = n->prev_sibling;
+			if (found != NULL && !doc_has_name(found, qname->name))
+				found = NULL;
+			break;
+		case CSS_COMBINATOR_GENERIC_SIBLING:
+			for (found = n->prev_sibling; found != NULL &&
+					!doc_has_name(found, qname->name);
+					found = found->prev_sibling)
+				;
+			break;
+		default:
+			break;
+		}
+	}
+
+	*ret = found == NULL ? NULL : found->id;
+	return CSS_OK;
+}
+
+static css_error doc_node_classes (void* node, lwc_string*** classes,
+		uint32_t* n_classes)
+{
+	css_js_doc_node* n = get_doc_node((lwc_string*) node);
+
+	*classes = NULL;
+	*n_classes = 0;
+	if (n == NULL || n->n_classes == 0)
+		return CSS_OK;
+
+	/* Freed by the caller; see select_node_classes */
+	*classes = malloc(n->n_classes * sizeof(lwc_string*));
+	for (uint32_t i = 0; i < n->n_classes; i++)
+		(*classes)[i] = lwc_string_ref(n->classes[i]);
+	*n_classes = n->n_classes;
+	return CSS_OK;
+}
+
+static bool doc_has_class (css_js_doc_node* node, lwc_string* name)
+{
+	for (uint32_t i = 0; i < node->n_classes; i++) {
+		if (node->classes[i] == name)
+			return true;
+	}
+
+	return false;
+}
+
+static bool doc_is_link (css_js_doc_node* node)
+{
+	if (strcmp(lwc_string_data(node->lower_name), "a") != 0)
+		return false;
+
+	for (uint32_t i = 0; i < node->n_attrs; i++) {
+		if (strcmp(lwc_string_data(node->attrs[i].name),
+					"href") == 0)
+			return lwc_string_length(node->attrs[i].value) > 0;
+	}
+
+	return false;
+}
+
+static css_js_attr* doc_get_attr (css_js_doc_node* node, const char* name)
+{
+	for (uint32_t i = 0; i < node->n_attrs; i++) {
+		if (strcmp(lwc_string_data(node->attrs[i].name), name) == 0)
+			return &node->attrs[i];
+	}
+
+	return NULL;
+}
+
+/* Elements that can be disabled, as HTML defines them */
+static bool doc_is_form_control (css_js_doc_node* node)
+{
+	static const char* const names[] = { "button", "input", "select",
+		"textarea", "optgroup", "option", "fieldset" };
+	const char* name = lwc_string_data(node->lower_name);
+
+	for (uint32_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (strcmp(name, names[i]) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+static bool doc_is_checked (css_js_doc_node* node)
+{
+	if (doc_get_attr(node, "checked") != NULL)
+		return true;
+
+	return strcmp(lwc_string_data(node->lower_name), "option") == 0 &&
+		doc_get_attr(node, "selected") != NULL;
+}
+
+/*
+ * Whether the language of a node, from the lang attribute of the node or
+ * of its closest ancestor that has one, is <lang> or a sublanguage of it.
+ */
+static bool doc_is_lang (css_js_doc_node* node, lwc_string* lang)
+{
+	css_js_attr* attr = NULL;
+	for (; node != NULL && attr == NULL; node = node->parent)
+		attr = doc_get_attr(node, "lang");
+	if (attr == NULL)
+		return false;
+
+	size_t len = lwc_string_length(lang);
+	const char* value = lwc_string_data(attr->value);
+	return lwc_string_length(attr->value) >= len &&
+		strncasecmp(value, lwc_string_data(lang), len) == 0 &&
+		(value[len] == '\0' || value[len] == '-');
+}
+
+static int32_t doc_count_siblings (css_js_doc_node* node, bool same_name,
+		bool after)
+{
+	if (same_name)
+		return after ? node->same_name_after : node->same_name_before;
+
+	return after ? node->after : node->index;
+}
+
+/**
+ * Font size computation callback for libcss
+ *
+ * \param pw      Computation context
+ * \param parent  Parent font size (absolute)
+ * \param size    Font size to compute
+ * \return CSS_OK on success
+ *
+ * \post \a size will be an absolute font size
+ *
+ * Slightly adapted from NetSurf's original implementation.
+ */
+css_error compute_font_size(void *pw, const css_hint *parent,
+		css_hint *size)
+{
+	UNUSED(pw);
+	int32_t ua_font_size = environment.font_size;
+	/**
+	 * Table of font-size keyword scale factors
+	 *
+	 * These are multiplied by the configured default font size
+	 * to produce an absolute size for the relevant keyword
+	 */
+	static const css_fixed factors[] = {
+		FLTTOFIX(0.5625), /* xx-small */
+		FLTTOFIX(0.6250), /* x-small */
+		FLTTOFIX(0.8125), /* small */
+		FLTTOFIX(1.0000), /* medium */
+		FLTTOFIX(1.1250), /* large */
+		FLTTOFIX(1.5000), /* x-large */
+		FLTTOFIX(2.0000)  /* xx-large */
+	};
+	css_hint_length parent_size;
+
+	/* Grab parent size, defaulting to medium if none */
+	if (parent == NULL) {
+		parent_size.value = FDIV(FMUL(factors[CSS_FONT_SIZE_MEDIUM - 1],
+					INTTOFIX(ua_font_size)),
+				INTTOFIX(10));
+		parent_size.unit = CSS_UNIT_PT;
+	} else {
+		assert(parent->status == CSS_FONT_SIZE_DIMENSION);
+		assert(parent->data.length.unit != CSS_UNIT_EM);
+		assert(parent->data.length.unit != CSS_UNIT_EX);
+		assert(parent->data.length.unit != CSS_UNIT_PCT);
+
+		parent_size = parent->data.length;
+	}
+
+	assert(size->status != CSS_FONT_SIZE_INHERIT);
+
+	if (size->status < CSS_FONT_SIZE_LARGER) {
+		/* Keyword -- simple */
+		size->data.length.value = FDIV(FMUL(factors[size->status - 1],
+					INTTOFIX(ua_font_size)), F_10);
+		size->data.length.unit = CSS_UNIT_PT;
+	} else if (size->status == CSS_FONT_SIZE_LARGER) {
+		/** \todo Step within table, if appropriate */
+		size->data.length.value =
+			FMUL(parent_size.value, FLTTOFIX(1.2));
+		size->data.length.unit = parent_size.unit;
+	} else if (size->status == CSS_FONT_SIZE_SMALLER) {
+		/** \todo Step within table, if appropriate */
+		size->data.length.value =
+			FDIV(parent_size.value, FLTTOFIX(1.2));
+		size->data.length.unit = parent_size.unit;
+	} else if (size->data.length.unit == CSS_UNIT_EM ||
+			size->data.length.unit == CSS_UNIT_EX) {
+		size->data.length.value =
+			FMUL(size->data.length.value, parent_size.value);
+
+		if (size->data.length.unit == CSS_UNIT_EX) {
+			size->data.length.value = FMUL(size->data.length.value,
+					environment.ex_ratio);
+		}
+
+		size->data.length.unit = parent_size.unit;
+	} else if (size->data.length.unit == CSS_UNIT_PCT) {
+		size->data.length.value = FDIV(FMUL(size->data.length.value,
+					parent_size.value), INTTOFIX(100));
+		size->data.length.unit = parent_size.unit;
+	}
+
+	size->status = CSS_FONT_SIZE_DIMENSION;
+	return CSS_OK;
+}
+
+/*
+ * Generic get function to be used by callbacks. Must yield string.
+ */
+css_error get_string (
+		void *node,
+		char* (*js_fun)(const char*),
+		lwc_string** ret
+		)
+{
+	lwc_string* n = (lwc_string*) node;
+	const char* node_string = lwc_string_data(n);
+
+	// printf("get_string querying node: %s\n", node_string);
+
+	char* js_results =
+		(*js_fun)(node_string);
+
+	// printf("get_string got: %s\n", js_results);
+
+	if (*js_results == '\0')
+	{
+		*ret = NULL;
+	  // printf("Null string\n");
+	}
+	else
+	{
+		lwc_intern_string(js_results, strlen(js_results), ret);
+	}
+
+	free(js_results);
+	return CSS_OK;
+}
+
+/*
+ * Generic search function to be used by callbacks. Must yield boolean.
+ */
+css_error match_bool (
+		void *node,
+		lwc_string* search_parameter,
+		lwc_string* match_parameter,
+		bool (*js_fun)(const char*, const char*, const char*),
+		bool* ret
+		)
+{
+	lwc_string* n = (lwc_string*) node;
+	const char* node_string = lwc_string_data(n);
+
+	const char null_str[1] = "";
+
+	lwc_string* s = search_parameter;
+	const char* search_string = s == NULL
+		? null_str : lwc_string_data(s);
+
+	lwc_string* m = match_parameter;
+	const char* match_str = m == NULL
+		? null_str : lwc_string_data(m);
+
+	*ret = (*js_fun)(node_string, search_string, match_str);
+
+	// printf("match_bool got: %s\n", *ret ? "true" : "false");
+	return CSS_OK;
+}
+
+/*
+ * Generic search function to be used by callbacks. Must yield string.
+ */
+css_error match_string (
+		void *node,
+		lwc_string* search_parameter,
+		char* (*js_fun)(const char*, const char*),
+		void** ret
+		)
+{
+	lwc_string* n = node;
+	const char* node_string = lwc_string_data(n);
+	lwc_string* s = search_parameter;
+	const char* match_str = lwc_string_data(s);
+
+	char* js_results =
+		(*js_fun)(node_string, match_str);
+
+	// printf("match_string got: %s\n", js_results);
+
+	if (*js_results == '\0')
+	{
+	  // printf("Null string\n");
+		*ret = NULL;
+	}
+	else
+	{
+		lwc_string *results;
+		lwc_intern_string(js_results, strlen(js_results), &results);
+		*ret = hold_node(results);
+	}
+
+	free(js_results);
+	return CSS_OK;
+}
+
+/*
+ * Not sure this is needed for node_name
+ void set_namespace (css_qname* qname, const char* ns)
+ {
+ lwc_string *namespace_ptr;
+ lwc_intern_string(ns, strlen(ns), &namespace_ptr);
+ qname->ns = namespace_ptr;
+ }
+ */
+
+
+/******************************************************************************
+ * Selector profiler							      *
+ ******************************************************************************/
+
+static const char* const origin_names[] = {
+	[CSS_ORIGIN_UA] = "ua",
+	[CSS_ORIGIN_USER] = "user",
+	[CSS_ORIGIN_AUTHOR] = "author"
+};
+
+static double profile_now (void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static void text_append (css_js_text* text, const char* data, size_t len)
+{
+	if (text->len + len + 1 > text->size) {
+		text->size = (text->len + len + 1) * 2;
+		text->data = realloc(text->data, text->size);
+	}
+
+	memcpy(text->data + text->len, data, len);
+	text->len += len;
+	text->data[text->len] = '\0';
+}
+
+static void text_append_string (css_js_text* text, const char* data)
+{
+	text_append(text, data, strlen(data));
+}
+
+/*
+ * Finds the end of a comment, whose text starts at <p>.
+ */
+static const char* comment_end (const char* p, const char* end)
+{
+	for (; end - p >= 2; p++) {
+		if (p[0] == '*' && p[1] == '/')
+			return p + 2;
+	}
+	return end;
+}
+
+static bool is_universal (lwc_string* name)
+{
+	return lwc_string_length(name) == 1 && lwc_string_data(name)[0] == '*';
+}
+
+static void write_detail (css_js_text* text, const css_selector_detail* detail)
+{
+	static const char* const operators[] = {
+		[CSS_SELECTOR_ATTRIBUTE_EQUAL] = "=",
+		[CSS_SELECTOR_ATTRIBUTE_DASHMATCH] = "|=",
+		[CSS_SELECTOR_ATTRIBUTE_INCLUDES] = "~=",
+		[CSS_SELECTOR_ATTRIBUTE_PREFIX] = "^=",
+		[CSS_SELECTOR_ATTRIBUTE_SUFFIX] = "$=",
+		[CSS_SELECTOR_ATTRIBUTE_SUBSTRING] = "*="
+	};
+	const char* name = lwc_string_data(detail->qname.name);
+	char nth[32];
+
+	if (detail->negate)
+		text_append_string(text, ":not(");
+
+	switch (detail->type) {
+	case CSS_SELECTOR_ELEMENT:
+		text_append_string(text, name);
+		break;
+	case CSS_SELECTOR_CLASS:
+		text_append_string(text, ".");
+		text_append_string(text, name);
+		break;
+	case CSS_SELECTOR_ID:
+		text_append_string(text, "#");
+		text_append_string(text, name);
+		break;
+	case CSS_SELECTOR_PSEUDO_CLASS:
+		text_append_string(text, ":");
+		text_append_string(text, name);
+		if (detail->value_type == CSS_SELECTOR_DETAIL_VALUE_NTH) {
+			snprintf(nth, sizeof(nth), "(%dn%+d)",
+					detail->value.nth.a,
+					detail->value.nth.b);
+			text_append_string(text, nth);
+		}
+		else if (detail->value.string != NULL) {
+			text_append_string(text, "(");
+			text_append_string(text,
+					lwc_string_data(detail->value.string));
+			text_append_string(text, ")");
+		}
+		break;
+	case CSS_SELECTOR_PSEUDO_ELEMENT:
+		text_append_string(text, "::");
+		text_append_string(text, name);
+		break;
+	case CSS_SELECTOR_ATTRIBUTE:
+		text_append_string(text, "[");
+		text_append_string(text, name);
+		text_append_string(text, "]");
+		break;
+	default:
+		text_append_string(text, "[");
+		text_append_string(text, name);
+		text_append_string(text, operators[detail->type]);
+		text_append_string(text, "\"");
+		text_append_string(text, lwc_string_data(detail->value.string));
+		text_append_string(text, "\"]");
+		break;
+	}
+
+	if (detail->negate)
+		text_append_string(text, ")");
+}
+
+/*
+ * Writes a selector as CSS, from its leftmost compound selector.
+ */
+static void write_selector (css_js_text* text, const css_selector* selector)
+{
+	if (selector->combinator != NULL) {
+		write_selector(text, selector->combinator);
+		switch (selector->data.comb) {
+		case CSS_COMBINATOR_PARENT:
+			text_append_string(text, " > ");
+			break;
+		case CSS_COMBINATOR_SIBLING:
+			text_append_string(text, " + ");
+			break;
+		case CSS_COMBINATOR_GENERIC_SIBLING:
+			text_append_string(text, " ~ ");
+			break;
+		default:
+			text_append_string(text, " ");
+			break;
+		}
+	}
+
+	const css_selector_detail* detail = &selector->data;
+	/* The universal selector is implied before other simple selectors */
+	if (detail->next != 0 && detail->type == CSS_SELECTOR_ELEMENT &&
+			!detail->negate && is_universal(detail->qname.name))
+		detail++;
+
+	for (;;) {
+		write_detail(text, detail);
+		if (detail->next == 0)
+			break;
+		detail++;
+	}
+}
+
+static css_js_profile* get_profile_entry (const css_selector* selector,
+		const stylesheet_list* entry, uint32_t sheet_index,
+		uint32_t rule)
+{
+	uint32_t bucket;
+
+	if (profile_table_size != 0) {
+		bucket = ((uintptr_t) selector >> 3) & (profile_table_size - 1);
+		for (css_js_profile* profile = profile_table[bucket];
+				profile != NULL; profile = profile->next) {
+			if (profile->selector == selector)
+				return profile;
+		}
+	}
+
+	if (profile_table_count >= profile_table_size * 3 / 4) {
+		uint32_t new_size = profile_table_size == 0
+			? PROFILE_TABLE_MIN : profile_table_size * 2;
+		css_js_profile** new_table =
+			calloc(new_size, sizeof(css_js_profile*));
+
+		for (uint32_t i = 0; i < profile_table_size; i++) {
+			css_js_profile* profile = profile_table[i];
+			while (profile != NULL) {
+				css_js_profile* next = profile->next;
+				bucket = ((uintptr_t) profile->selector >> 3) &
+					(new_size - 1);
+				profile->next = new_table[bucket];
+				new_table[bucket] = profile;
+				profile = next;
+			}
+		}
+
+		free(profile_table);
+		profile_table = new_table;
+		profile_table_size = new_size;
+	}
+
+	css_js_text text = { NULL, 0, 0 };
+	write_selector(&text, selector);
+
+	const css_stylesheet* sheet = entry->sheet->sheet;
+	css_js_profile* profile = calloc(1, sizeof(css_js_profile));
+	profile->selector = selector;
+	profile->sheet = sheet;
+	profile->text = text.data;
+	profile->url = strdup(sheet->url == NULL ? "" : sheet->url);
+	profile->origin = entry->origin;
+	profile->sheet_index = sheet_index;
+	profile->rule = rule;
+
+	bucket = ((uintptr_t) selector >> 3) & (profile_table_size - 1);
+	profile->next = profile_table[bucket];
+	profile_table[bucket] = profile;
+	profile_table_count++;
+
+	return profile;
+}
+
+/*
+ * Keeps the profiles of the selectors of a stylesheet being freed, without
+ * their selectors, whose addresses may be reused.
+ */
+static void forget_profiled_sheet (const css_stylesheet* sheet)
+{
+	for (uint32_t i = 0; i < profile_table_size; i++) {
+		for (css_js_profile* profile = profile_table[i];
+				profile != NULL; profile = profile->next) {
+			if (profile->sheet == sheet) {
+				profile->selector = NULL;
+				profile->sheet = NULL;
+			}
+		}
+	}
+}
+
+static void free_profile (void)
+{
+	for (uint32_t i = 0; i < profile_table_size; i++) {
+		css_js_profile* profile = profile_table[i];
+		while (profile != NULL) {
+			css_js_profile* next = profile->next;
+			free(profile->text);
+			free(profile->url);
+			free(profile);
+			profile = next;
+		}
+	}
+
+	free(profile_table);
+	profile_table = NULL;
+	profile_table_size = 0;
+	profile_table_count = 0;
+	profile_selections = 0;
+	profile_select_time = 0;
+}
+
+/*
+ * Same as libcss's match_nth: whether an element at 1-based position
+ * <count> is matched by an+b.
+ */
+static bool profile_match_nth (int32_t a, int32_t b, int32_t count)
+{
+	if (a == 0)
+		return b == count;
+
+	int32_t delta = count - b;
+	return ((delta > 0) == (a > 0) || delta == 0) && delta % a == 0;
+}
+
+/*
+ * Tests a pseudo-class as libcss does. libcss only parses the pseudo-classes
+ * listed here; any other is reported through <profile_inexact>.
+ */
+static bool profile_match_pseudo_class (void* node,
+		const css_selector_detail* detail)
+{
+	static const struct {
+		const char* name;
+		css_error (*test)(void* pw, void* node, bool* match);
+	} states[] = {
+		{ "root", node_is_root },
+		{ "empty", node_is_empty },
+		{ "link", node_is_link },
+		{ "visited", node_is_visited },
+		{ "hover", node_is_hover },
+		{ "active", node_is_active },
+		{ "focus", node_is_focus },
+		{ "enabled", node_is_enabled },
+		{ "disabled", node_is_disabled },
+		{ "checked", node_is_checked },
+		{ "target", node_is_target }
+	};
+	/* Counted among the siblings of the same name or all of them, from
+	 * the first or the last one */
+	static const struct {
+		const char* name;
+		bool same_name;
+		bool last;
+		bool nth;
+	} positions[] = {
+		{ "first-child", false, false, false },
+		{ "last-child", false, true, false },
+		{ "first-of-type", true, false, false },
+		{ "last-of-type", true, true, false },
+		{ "nth-child", false, false, true },
+		{ "nth-last-child", false, true, true },
+		{ "nth-of-type", true, false, true },
+		{ "nth-last-of-type", true, true, true }
+	};
+	/* Page pseudo-classes, which no element matches */
+	static const char* const pages[] = { "first", "left", "right" };
+	char name[32];
+	bool match = false;
+	int32_t count;
+
+	size_t len = lwc_string_length(detail->qname.name);
+	if (len >= sizeof(name)) {
+		profile_inexact = true;
+		return false;
+	}
+	for (size_t i = 0; i < len; i++)
+		name[i] = tolower((unsigned char)
+				lwc_string_data(detail->qname.name)[i]);
+	name[len] = '\0';
+
+	if (strcmp(name, "lang") == 0) {
+		profile_calls++;
+		node_is_lang(NULL, node, detail->value.string, &match);
+		return match;
+	}
+
+	for (size_t i = 0; i < sizeof(states) / sizeof(states[0]); i++) {
+		if (strcmp(name, states[i].name) == 0) {
+			profile_calls++;
+			states[i].test(NULL, node, &match);
+			return match;
+		}
+	}
+
+	for (size_t i = 0; i < sizeof(positions) / sizeof(positions[0]);
+			i++) {
+		if (strcmp(name, positions[i].name) != 0)
+			continue;
+		profile_calls++;
+		node_count_siblings(NULL, node, positions[i].same_name,
+				positions[i].last, &count);
+		if (positions[i].nth)
+			return profile_match_nth(detail->value.nth.a,
+					detail->value.nth.b, count + 1);
+		return count == 0;
+	}
+
+	bool only_child = strcmp(name, "only-child") == 0;
+	if (only_child || strcmp(name, "only-of-type") == 0) {
+		bool same_name = !only_child;
+		profile_calls += 2;
+		node_count_siblings(NULL, node, same_name, false, &count);
+		if (count != 0)
+			return false;
+		node_count_siblings(NULL, node, same_name, true, &count);
+		return count == 0;
+	}
+
+	for (size_t i = 0; i < sizeof(pages) / sizeof(pages[0]); i++) {
+		if (strcmp(name, pages[i]) == 0)
+			return false;
+	}
+
+	profile_inexact = true;
+	return false;
+}
+
+static bool profile_match_detail (void* node,
+		const css_selector_detail* detail)
+{
+	bool match = false;
 
-		/* Stop if we've reached the end */
-		if (p == end || *p != ',')
+	switch (detail->type) {
+	case CSS_SELECTOR_ELEMENT:
+		if (is_universal(detail->qname.name)) {
+			match = true;
 			break;
-
-		/* Consume comma */
-		p++;
+		}
+		profile_calls++;
+		node_has_name(NULL, node, &detail->qname, &match);
+		break;
+	case CSS_SELECTOR_CLASS:
+		profile_calls++;
+		node_has_class(NULL, node, detail->qname.name, &match);
+		break;
+	case CSS_SELECTOR_ID:
+		profile_calls++;
+		node_has_id(NULL, node, detail->qname.name, &match);
+		break;
+	case CSS_SELECTOR_PSEUDO_CLASS:
+		match = profile_match_pseudo_class(node, detail);
+		break;
+	case CSS_SELECTOR_PSEUDO_ELEMENT:
+		/* Only decides which style the selector applies to */
+		match = true;
+		break;
+	case CSS_SELECTOR_ATTRIBUTE:
+		profile_calls++;
+		node_has_attribute(NULL, node, &detail->qname, &match);
+		break;
+	default:
+		profile_calls++;
+		has_attribute_value(node, &detail->qname, detail->value.string,
+				detail->type, &match);
+		break;
 	}
 
-	css_stylesheet_params params;
-	params.params_version = CSS_STYLESHEET_PARAMS_VERSION_1;
-	params.level = css_level;
-	params.charset = NULL;
-	params.url = url;
-	params.title = NULL;
-	params.allow_quirks = allow_quirks;
-	params.inline_style = false;
-	params.resolve = resolve_url;
-	params.resolve_pw = NULL;
-	params.import = NULL;
-	params.import_pw = NULL;
-	params.color = NULL;
-	params.color_pw = NULL;
-	params.font = NULL;
-	params.font_pw = NULL;
+	return detail->negate ? !match : match;
+}
 
-	css_stylesheet *sheet;
+static bool profile_match_compound (void* node, const css_selector* selector)
+{
+	const css_selector_detail* detail = &selector->data;
+
+	for (;;) {
+		if (!profile_match_detail(node, detail))
+			return false;
+		if (detail->next == 0)
+			return true;
+		detail++;
+	}
+}
 
-	code = css_stylesheet_create(&params, &sheet);
-	if (code != CSS_OK)
-		return CSS_JS_CREATE_SHEET;
+/*
+ * Finds the element matched by the compound selector <left>, related to
+ * <node> by <comb>. As libcss does, it stops at the nearest one, without
+ * backtracking.
+ */
+static void* profile_match_combinator (void* node, css_combinator comb,
+		const css_selector* left)
+{
+	const css_qname* qname = &left->data.qname;
+	bool named = !is_universal(qname->name);
+
+	for (;;) {
+		void* next = NULL;
+
+		profile_calls++;
+		switch (comb) {
+		case CSS_COMBINATOR_ANCESTOR:
+			if (named)
+				named_ancestor_node(NULL, node, qname, &next);
+			else
+				parent_node(NULL, node, &next);
+			break;
+		case CSS_COMBINATOR_PARENT:
+			if (named)
+				named_parent_node(NULL, node, qname, &next);
+			else
+				parent_node(NULL, node, &next);
+			break;
+		case CSS_COMBINATOR_SIBLING:
+			if (named)
+				named_sibling_node(NULL, node, qname, &next);
+			else
+				sibling_node(NULL, node, &next);
+			break;
+		case CSS_COMBINATOR_GENERIC_SIBLING:
+			if (named)
+				named_generic_sibling_node(NULL, node, qname,
+						&next);
+			else
+				sibling_node(NULL, node, &next);
+			break;
+		default:
+			break;
+		}
 
-	code = css_stylesheet_append_data(
-			sheet,
-			(const uint8_t *) css_string,
-			strlen(css_string) + 1
-			);
-	if (code != CSS_OK && code != CSS_NEEDDATA)
-		return CSS_JS_APPEND_DATA;
+		if (next == NULL)
+			return NULL;
+		if (profile_match_compound(next, left))
+			return next;
+		if (comb == CSS_COMBINATOR_PARENT ||
+				comb == CSS_COMBINATOR_SIBLING)
+			return NULL;
+		node = next;
+	}
+}
 
-	code = css_stylesheet_data_done(sheet);
-	if (code != CSS_OK)
-		return CSS_JS_DATA_DONE;
+static bool profile_match_selector (void* node, const css_selector* selector)
+{
+	if (!profile_match_compound(node, selector))
+		return false;
+
+	for (; selector->combinator != NULL; selector = selector->combinator) {
+		node = profile_match_combinator(node, selector->data.comb,
+				selector->combinator);
+		if (node == NULL)
+			return false;
+	}
 
-	js_code = append_stylesheet_list(sheet);
-	if (js_code != CSS_JS_OK)
-		return js_code;
+	return true;
+}
 
-	if (select_ctx == NULL) {
-		css_js_error js_error = create_ctx();
-		if (js_error != CSS_JS_OK)
-			return js_error;
+/*
+ * Candidates of the selection being replayed, reused from one stylesheet
+ * to the next.
+ */
+css_js_candidate* candidates = NULL;
+uint32_t candidates_size = 0;
+uint32_t candidates_count = 0;
+
+static void collect_rule_positions (const css_rule* rule,
+		css_js_rule_position* positions, uint32_t* count)
+{
+	for (; rule != NULL; rule = rule->next) {
+		if (rule->type == CSS_RULE_MEDIA) {
+			collect_rule_positions(
+					((const css_rule_media*) rule)->first_child,
+					positions, count);
+		}
+		else if (rule->type == CSS_RULE_SELECTOR) {
+			positions[*count].rule = rule;
+			positions[*count].position = *count;
+			(*count)++;
+		}
 	}
+}
 
-        // printf("Appending stylesheet for media %d\n", media_result);
-	code = css_select_ctx_append_sheet(
-			select_ctx,
-			sheet,
-			orig,
-			media_result
-	);
-	if (code != CSS_OK)
-		return CSS_JS_APPEND_SHEET;
+static int compare_rule_positions (const void* a, const void* b)
+{
+	const css_rule* ra = ((const css_js_rule_position*) a)->rule;
+	const css_rule* rb = ((const css_js_rule_position*) b)->rule;
 
-	return CSS_JS_OK;
+	return ra < rb ? -1 : ra > rb ? 1 : 0;
 }
 
 /*
- * Warning: if inline_style is set, the resulting stylesheet will not
- * be destroyed! This implementation leaks memory.
+ * Returns the position of a style rule of <sheet> in source order.
  */
-css_js_error build_style(lwc_string* node, css_media_type media,
-		      const char* inline_style,
-		      css_select_results** results)
+static uint32_t get_rule_position (css_js_sheet* sheet, const css_rule* rule)
 {
-	css_error code;
+	if (sheet->rule_positions == NULL) {
+		uint32_t count = 0;
+		sheet->n_style_rules = count_style_rules(
+				sheet->sheet->rule_list);
+		sheet->rule_positions = malloc((sheet->n_style_rules + 1) *
+				sizeof(css_js_rule_position));
+		collect_rule_positions(sheet->sheet->rule_list,
+				sheet->rule_positions, &count);
+		qsort(sheet->rule_positions, count,
+				sizeof(css_js_rule_position),
+				compare_rule_positions);
+	}
 
-	const css_stylesheet* in_style;
-	if (inline_style == NULL || *inline_style == '\0')
-		in_style = NULL;
-	else
-	{
-		css_stylesheet_params params;
-		params.params_version = CSS_STYLESHEET_PARAMS_VERSION_1;
-		params.level = CSS_LEVEL_3;
-		params.charset = NULL;
-		params.url = "";
-		params.title = NULL;
-		params.allow_quirks = false;
-		params.inline_style = true;
-		params.resolve = resolve_url;
-		params.resolve_pw = NULL;
-		params.import = NULL;
-		params.import_pw = NULL;
-		params.color = NULL;
-		params.color_pw = NULL;
-		params.font = NULL;
-		params.font_pw = NULL;
+	css_js_rule_position key = { rule, 0 };
+	const css_js_rule_position* found = bsearch(&key,
+			sheet->rule_positions, sheet->n_style_rules,
+			sizeof(css_js_rule_position), compare_rule_positions);
+	return found->position;
+}
 
-		css_stylesheet* sheet;
-		code = css_stylesheet_create(&params, &sheet);
-		if (code != CSS_OK)
-			return CSS_JS_CREATE_SHEET;
+/*
+ * Adds the selectors of a chain of the selector hash to the candidates.
+ */
+static void add_candidates (css_js_sheet* sheet,
+		const struct css_hash_selection_requirments* req,
+		css_selector_hash_iterator iterator,
+		const css_selector** selectors)
+{
+	while (selectors != NULL && *selectors != NULL) {
+		if (candidates_count >= candidates_size) {
+			candidates_size = candidates_size == 0
+				? 64 : candidates_size * 2;
+			candidates = realloc(candidates,
+					candidates_size *
+					sizeof(css_js_candidate));
+		}
+		candidates[candidates_count].selector = *selectors;
+		candidates[candidates_count].rule = get_rule_position(sheet,
+				(*selectors)->rule);
+		candidates_count++;
 
-		code = css_stylesheet_append_data(
-				sheet,
-				(const uint8_t *) inline_style,
-				strlen(inline_style) + 1
-				);
-		if (code != CSS_OK && code != CSS_NEEDDATA)
-			return CSS_JS_APPEND_DATA;
+		if (iterator(req, selectors, &selectors) != CSS_OK)
+			break;
+	}
+}
 
-		code = css_stylesheet_data_done(sheet);
-		if (code != CSS_OK)
-			return CSS_JS_DATA_DONE;
+static int compare_candidates (const void* a, const void* b)
+{
+	const css_js_candidate* ca = a;
+	const css_js_candidate* cb = b;
 
-		in_style = sheet;
-	}
+	if (ca->rule != cb->rule)
+		return ca->rule < cb->rule ? -1 : 1;
+	return ca->selector < cb->selector ? -1 :
+		ca->selector > cb->selector ? 1 : 0;
+}
 
-	if (select_ctx == NULL) {
-		css_js_error js_error = create_ctx();
-		if (js_error != CSS_JS_OK)
-			return js_error;
+/*
+ * Finds the selectors of a stylesheet that libcss tests against the
+ * element, in its selector hash: those filed under the element name, each
+ * class and the id of the element, and the universal ones. The bloom
+ * filter lets every selector through, as the replay has no ancestor bloom.
+ */
+static void find_candidates (css_js_sheet* sheet, css_media_type media,
+		const css_js_element_keys* keys)
+{
+	static const css_bloom any_ancestors[CSS_BLOOM_SIZE] = {
+		0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff
+	};
+	static lwc_string* universal = NULL;
+	css_selector_hash* hash = sheet->sheet->selectors;
+	css_selector_hash_iterator iterator;
+	const css_selector** selectors;
+
+	if (universal == NULL)
+		lwc_intern_string("*", 1, &universal);
+
+	struct css_hash_selection_requirments req;
+	memset(&req, 0, sizeof(req));
+	req.qname.name = keys->name;
+	req.uni = universal;
+	req.media = media;
+	req.node_bloom = any_ancestors;
+
+	candidates_count = 0;
+	if (keys->name != NULL && css__selector_hash_find(hash, &req,
+				&iterator, &selectors) == CSS_OK)
+		add_candidates(sheet, &req, iterator, selectors);
+
+	for (uint32_t i = 0; i < keys->n_classes; i++) {
+		req.class = keys->classes[i];
+		if (css__selector_hash_find_by_class(hash, &req, &iterator,
+					&selectors) == CSS_OK)
+			add_candidates(sheet, &req, iterator, selectors);
+	}
+	req.class = NULL;
+
+	if (keys->id != NULL) {
+		req.id = keys->id;
+		if (css__selector_hash_find_by_id(hash, &req, &iterator,
+					&selectors) == CSS_OK)
+			add_candidates(sheet, &req, iterator, selectors);
+		req.id = NULL;
 	}
 
-        // printf("Creating sr for node %s and media %d\n", lwc_string_data(node), media);
-	code = css_select_style(
-			select_ctx,
-			node,
-			media,
-			in_style,
-			&selection_handler,
-			NULL,
-			results
-			);
-	if (code != CSS_OK)
-		return CSS_JS_CREATE_STYLE;
+	if (css__selector_hash_find_universal(hash, &req, &iterator,
+				&selectors) == CSS_OK)
+		add_candidates(sheet, &req, iterator, selectors);
 
-	return CSS_JS_OK;
+	/* Grouped by rule, for the coverage */
+	qsort(candidates, candidates_count, sizeof(css_js_candidate),
+			compare_candidates);
 }
 
-css_js_error build_node_sr (lwc_string* node_id, css_pseudo_element pseudo,
-		css_media_type media, const char* inline_style,
-		css_js_node** ret_node)
+/*
+ * Replays the candidates of a stylesheet, rule by rule.
+ */
+static void profile_candidates (void* node, const stylesheet_list* entry,
+		uint32_t sheet_index)
 {
-	css_error code;
-	css_js_error js_code;
+	for (uint32_t i = 0; i < candidates_count; ) {
+		uint32_t rule = candidates[i].rule;
+		bool rule_matched = false;
+
+		for (; i < candidates_count && candidates[i].rule == rule;
+				i++) {
+			const css_selector* selector = candidates[i].selector;
+
+			/* A selector the replay can't test counts as matched
+			 * for the coverage, so that pruning keeps its rule */
+			if (!profiling) {
+				/* Coverage only needs one matching selector */
+				if (rule_matched)
+					continue;
+				profile_inexact = false;
+				rule_matched = profile_match_selector(node,
+						selector) || profile_inexact;
+				continue;
+			}
+
+			css_js_profile* profile = get_profile_entry(selector,
+					entry, sheet_index, rule);
+			profile_calls = 0;
+			profile_inexact = false;
+			double start = profile_now();
+			bool match = profile_match_selector(node, selector);
+			profile->time += profile_now() - start;
+			profile->tests++;
+			profile->matches += match;
+			profile->calls += profile_calls;
+			profile->inexact |= profile_inexact;
+			rule_matched |= match || profile_inexact;
+		}
 
-	css_js_node* node = get_node_by_id(node_id);
-	if (node != NULL && node->sr != NULL) {
-		*ret_node = node;
-		return CSS_JS_OK;
+		if (coverage && rule_matched)
+			count_rule_match(entry->sheet, rule);
 	}
+}
 
-	if (node == NULL) {
-		node = append_node(node_id, NULL, NULL);
+/*
+ * Replays the selection of a node for the stylesheets of the current
+ * context, selector by selector, for the profile and the rule coverage.
+ */
+static void profile_selection (lwc_string* node, css_media_type media)
+{
+	css_js_element_keys keys;
+	css_qname qname = { NULL, NULL };
+
+	node_name(NULL, node, &qname);
+	keys.name = qname.name;
+	node_id(NULL, node, &keys.id);
+	node_classes(NULL, node, &keys.classes, &keys.n_classes);
+
+	uint32_t sheet_index = 0;
+	for (stylesheet_list* entry = first_sheet; entry != NULL;
+			entry = entry->next, sheet_index++) {
+		if ((entry->media & media) == 0)
+			continue;
+		find_candidates(entry->sheet, media, &keys);
+		profile_candidates(node, entry, sheet_index);
 	}
-	css_select_results* sr;
-	js_code = build_style(node_id, media, inline_style, &sr);
-	if (js_code != CSS_JS_OK)
-		return js_code;
 
-	node->sr = sr;
+	if (keys.name != NULL)
+		lwc_string_unref(keys.name);
+	if (keys.id != NULL)
+		lwc_string_unref(keys.id);
+	for (uint32_t i = 0; i < keys.n_classes; i++)
+		lwc_string_unref(keys.classes[i]);
+	free(keys.classes);
+}
 
-	lwc_string* parent_id = NULL;
-	get_string(node_id, js_parent_node, &parent_id);
-	if (parent_id != NULL) {
-		css_js_node* parent;
-		js_code = build_node_sr(parent_id, pseudo, media, NULL,
-				&parent);
+css_js_error set_profiling (bool enabled)
+{
+	if (enabled && !profiling) {
+		free_profile();
+		/* Styles already known would not be selected, nor profiled */
+		css_js_error js_code = free_all_styles();
 		if (js_code != CSS_JS_OK)
 			return js_code;
+	}
+	profiling = enabled;
+	return CSS_JS_OK;
+}
 
-		css_computed_style *composed;
-		code = css_computed_style_compose(
-				parent->sr->styles[pseudo],
-				node->sr->styles[pseudo],
-				compute_font_size, NULL,
-				&composed);
-		if (code != CSS_OK)
-			return CSS_JS_COMPOSE_STYLE;
+static int compare_profiles (const void* a, const void* b)
+{
+	const css_js_profile* pa = *(const css_js_profile* const*) a;
+	const css_js_profile* pb = *(const css_js_profile* const*) b;
 
-		css_computed_style_destroy(node->sr->styles[pseudo]);
-		node->sr->styles[pseudo] = composed;
+	if (pa->time != pb->time)
+		return pa->time < pb->time ? 1 : -1;
+	return pa->calls < pb->calls ? 1 : pa->calls > pb->calls ? -1 : 0;
+}
 
-		lwc_string_unref(parent_id);
+css_js_error get_profile (uint32_t top, double* totals, uint32_t* count,
+		char** report)
+{
+	css_js_profile** profiles =
+		malloc((profile_table_count + 1) * sizeof(css_js_profile*));
+	uint32_t n = 0;
+
+	for (uint32_t i = 0; i < profile_table_size; i++) {
+		for (css_js_profile* profile = profile_table[i];
+				profile != NULL; profile = profile->next)
+			profiles[n++] = profile;
+	}
+	qsort(profiles, n, sizeof(css_js_profile*), compare_profiles);
+	if (top != 0 && top < n)
+		n = top;
+
+	css_js_text text = { NULL, 0, 0 };
+	text_append(&text, "", 0);
+	for (uint32_t i = 0; i < n; i++) {
+		const css_js_profile* profile = profiles[i];
+		char numbers[128];
+
+		text_append(&text, profile->text, strlen(profile->text) + 1);
+		text_append(&text, profile->url, strlen(profile->url) + 1);
+		text_append_string(&text, origin_names[profile->origin]);
+		int len = snprintf(numbers, sizeof(numbers),
+				"%c%u%c%u%c%u%c%u%c%u%c%.0f%c%c",
+				'\0', profile->sheet_index, '\0', profile->rule,
+				'\0', profile->tests, '\0', profile->matches,
+				'\0', profile->calls, '\0', profile->time,
+				'\0', profile->inexact ? '0' : '1');
+		text_append(&text, numbers, len + 1);
 	}
 
-	*ret_node = node;
+	free(profiles);
+	totals[0] = profile_selections;
+	totals[1] = profile_select_time;
+	*count = n;
+	*report = text.data;
 	return CSS_JS_OK;
 }
 
-css_js_error get_style (const char* element, const char* pseudo,
-			const char* media, const char* inline_style,
-			char* results, size_t len)
-{
-	css_error code;
-	css_js_error js_code;
-
-	css_pseudo_element pseudo_code;
-	if (strcmp(pseudo, "none") == 0)
-		pseudo_code = CSS_PSEUDO_ELEMENT_NONE;
-	else if (strcmp(pseudo, "first-line") == 0)
-		pseudo_code = CSS_PSEUDO_ELEMENT_FIRST_LINE;
-	else if (strcmp(pseudo, "first-letter") == 0)
-		pseudo_code = CSS_PSEUDO_ELEMENT_FIRST_LETTER;
-	else if (strcmp(pseudo, "before") == 0)
-		pseudo_code = CSS_PSEUDO_ELEMENT_BEFORE;
-	else if (strcmp(pseudo, "after") == 0)
-		pseudo_code = CSS_PSEUDO_ELEMENT_AFTER;
-	else
-		return CSS_JS_PSEUDO;
-
-	css_media_type media_code;
-	if (strcmp(media, "all") == 0)
-		media_code = CSS_MEDIA_ALL;
-	else if (strcmp(media, "tv") == 0)
-		media_code = CSS_MEDIA_TV;
-	else if (strcmp(media, "tty") == 0)
-		media_code = CSS_MEDIA_TTY;
-	else if (strcmp(media, "aural") == 0)
-		media_code = CSS_MEDIA_AURAL;
-	else if (strcmp(media, "print") == 0)
-		media_code = CSS_MEDIA_PRINT;
-	else if (strcmp(media, "screen") == 0)
-		media_code = CSS_MEDIA_SCREEN;
-	else if (strcmp(media, "speech") == 0)
-		media_code = CSS_MEDIA_SPEECH;
-	else if (strcmp(media, "braille") == 0)
-		media_code = CSS_MEDIA_BRAILLE;
-	else if (strcmp(media, "embossed") == 0)
-		media_code = CSS_MEDIA_EMBOSSED;
-	else if (strcmp(media, "handheld") == 0)
-		media_code = CSS_MEDIA_HANDHELD;
-	else if (strcmp(media, "projection") == 0)
-		media_code = CSS_MEDIA_PROJECTION;
-	else
-		return CSS_JS_MEDIA;
+/******************************************************************************
+ * Rule coverage							      *
+ ******************************************************************************/
 
-	lwc_string* node_id;
-	lwc_intern_string(element, strlen(element), &node_id);
-	css_js_node* node;
+static uint32_t count_style_rules (const css_rule* rule)
+{
+	uint32_t count = 0;
+
+	for (; rule != NULL; rule = rule->next) {
+		if (rule->type == CSS_RULE_SELECTOR)
+			count++;
+		else if (rule->type == CSS_RULE_MEDIA)
+			count += count_style_rules(
+					((const css_rule_media*) rule)->first_child);
+	}
 
-	js_code = build_node_sr(node_id, pseudo_code, media_code,
-		inline_style, &node);
-	if (js_code != CSS_JS_OK)
-		return js_code;
+	return count;
+}
 
-	lwc_string_unref(node_id);
+/*
+ * Gets the match counts of a stylesheet, which start over with each
+ * coverage, or NULL if it matched nothing in this one.
+ */
+static uint32_t* get_rule_matches (const css_js_sheet* sheet)
+{
+	return sheet->coverage_epoch == coverage_epoch
+		? sheet->rule_matches : NULL;
+}
 
-	dump_computed_style(node->sr->styles[pseudo_code], results, &len);
+static void count_rule_match (css_js_sheet* sheet, uint32_t position)
+{
+	if (sheet->coverage_epoch != coverage_epoch) {
+		free(sheet->rule_matches);
+		sheet->n_style_rules = count_style_rules(
+				sheet->sheet->rule_list);
+		sheet->rule_matches = calloc(sheet->n_style_rules,
+				sizeof(uint32_t));
+		sheet->coverage_epoch = coverage_epoch;
+	}
 
-	js_code = free_node(&first_node); // Cleans data for next selection
-	if (js_code != CSS_JS_OK)
-		return js_code;
+	sheet->rule_matches[position]++;
+}
 
+css_js_error set_coverage (bool enabled)
+{
+	if (enabled && !coverage) {
+		coverage_epoch++;
+		/* Styles already known would not be selected, nor counted */
+		css_js_error js_code = free_all_styles();
+		if (js_code != CSS_JS_OK)
+			return js_code;
+	}
+	coverage = enabled;
 	return CSS_JS_OK;
 }
 
-/**
- * Font size computation callback for libcss
- *
- * \param pw      Computation context
- * \param parent  Parent font size (absolute)
- * \param size    Font size to compute
- * \return CSS_OK on success
- *
- * \post \a size will be an absolute font size
- *
- * Slightly adapted from NetSurf's original implementation.
- */
-css_error compute_font_size(void *pw, const css_hint *parent,
-		css_hint *size)
+static void write_rule_coverage (css_js_text* text, const css_rule* rule,
+		const uint32_t* matches, uint32_t* position)
 {
-	UNUSED(pw);
-	int32_t ua_font_size = (*js_ua_font_size)();
-	/**
-	 * Table of font-size keyword scale factors
-	 *
-	 * These are multiplied by the configured default font size
-	 * to produce an absolute size for the relevant keyword
-	 */
-	static const css_fixed factors[] = {
-		FLTTOFIX(0.5625), /* xx-small */
-		FLTTOFIX(0.6250), /* x-small */
-		FLTTOFIX(0.8125), /* small */
-		FLTTOFIX(1.0000), /* medium */
-		FLTTOFIX(1.1250), /* large */
-		FLTTOFIX(1.5000), /* x-large */
-		FLTTOFIX(2.0000)  /* xx-large */
-	};
-	css_hint_length parent_size;
+	for (; rule != NULL; rule = rule->next) {
+		if (rule->type == CSS_RULE_MEDIA) {
+			write_rule_coverage(text,
+					((const css_rule_media*) rule)->first_child,
+					matches, position);
+			continue;
+		}
+		if (rule->type != CSS_RULE_SELECTOR)
+			continue;
+
+		const css_rule_selector* rs = (const css_rule_selector*) rule;
+		char number[16];
+		for (uint32_t i = 0; i < rule->items; i++) {
+			if (i > 0)
+				text_append_string(text, ", ");
+			write_selector(text, rs->selectors[i]);
+		}
+		int len = snprintf(number, sizeof(number), "%c%u", '\0',
+				matches == NULL ? 0 : matches[*position]);
+		text_append(text, number, len + 1);
+		(*position)++;
+	}
+}
+
+css_js_error get_coverage (uint32_t* count, char** report)
+{
+	css_js_text text = { NULL, 0, 0 };
+	text_append(&text, "", 0);
+	*count = 0;
+
+	for (stylesheet_list* entry = first_sheet; entry != NULL;
+			entry = entry->next) {
+		const css_stylesheet* sheet = entry->sheet->sheet;
+		const char* url = sheet->url == NULL ? "" : sheet->url;
+		char fields[32];
+		uint32_t position = 0;
+
+		text_append(&text, url, strlen(url) + 1);
+		text_append_string(&text, origin_names[entry->origin]);
+		int len = snprintf(fields, sizeof(fields), "%c%c%c%u", '\0',
+				entry->sheet->source == NULL ? '0' : '1', '\0',
+				count_style_rules(sheet->rule_list));
+		text_append(&text, fields, len + 1);
+		write_rule_coverage(&text, sheet->rule_list,
+				get_rule_matches(entry->sheet), &position);
+		(*count)++;
+	}
 
-	/* Grab parent size, defaulting to medium if none */
-	if (parent == NULL) {
-		parent_size.value = FDIV(FMUL(factors[CSS_FONT_SIZE_MEDIUM - 1],
-					INTTOFIX(ua_font_size)),
-				INTTOFIX(10));
-		parent_size.unit = CSS_UNIT_PT;
-	} else {
-		assert(parent->status == CSS_FONT_SIZE_DIMENSION);
-		assert(parent->data.length.unit != CSS_UNIT_EM);
-		assert(parent->data.length.unit != CSS_UNIT_EX);
-		assert(parent->data.length.unit != CSS_UNIT_PCT);
+	*report = text.data;
+	return CSS_JS_OK;
+}
 
-		parent_size = parent->data.length;
+static const char* skip_space (const char* p, const char* end)
+{
+	while (p < end) {
+		if (is_html_space(*p))
+			p++;
+		else if (end - p >= 2 && p[0] == '/' && p[1] == '*')
+			p = comment_end(p + 2, end);
+		else if (end - p >= 4 && strncmp(p, "<!--", 4) == 0)
+			p += 4;
+		else if (end - p >= 3 && strncmp(p, "-->", 3) == 0)
+			p += 3;
+		else
+			break;
 	}
 
-	assert(size->status != CSS_FONT_SIZE_INHERIT);
+	return p;
+}
 
-	if (size->status < CSS_FONT_SIZE_LARGER) {
-		/* Keyword -- simple */
-		size->data.length.value = FDIV(FMUL(factors[size->status - 1],
-					INTTOFIX(ua_font_size)), F_10);
-		size->data.length.unit = CSS_UNIT_PT;
-	} else if (size->status == CSS_FONT_SIZE_LARGER) {
-		/** \todo Step within table, if appropriate */
-		size->data.length.value =
-			FMUL(parent_size.value, FLTTOFIX(1.2));
-		size->data.length.unit = parent_size.unit;
-	} else if (size->status == CSS_FONT_SIZE_SMALLER) {
-		/** \todo Step within table, if appropriate */
-		size->data.length.value =
-			FDIV(parent_size.value, FLTTOFIX(1.2));
-		size->data.length.unit = parent_size.unit;
-	} else if (size->data.length.unit == CSS_UNIT_EM ||
-			size->data.length.unit == CSS_UNIT_EX) {
-		size->data.length.value =
-			FMUL(size->data.length.value, parent_size.value);
+/*
+ * Finds the end of the statement at <p>: past its semicolon or its block,
+ * skipping strings, comments and nested brackets.
+ */
+static const char* statement_end (const char* p, const char* end)
+{
+	uint32_t depth = 0;
 
-		if (size->data.length.unit == CSS_UNIT_EX) {
-			/* 1ex = 0.6em in NetSurf */
-			size->data.length.value = FMUL(size->data.length.value,
-					FLTTOFIX(0.6));
+	while (p < end) {
+		char c = *p++;
+		if (c == '\\') {
+			if (p < end)
+				p++;
+		}
+		else if (c == '"' || c == '\'') {
+			while (p < end && *p != c && *p != '\n') {
+				if (*p == '\\' && p + 1 < end)
+					p++;
+				p++;
+			}
+			if (p < end)
+				p++;
 		}
+		else if (c == '/' && p < end && *p == '*') {
+			p = comment_end(p + 1, end);
+		}
+		else if (c == '{' || c == '(' || c == '[') {
+			depth++;
+		}
+		else if (c == '}' || c == ')' || c == ']') {
+			if (depth > 0)
+				depth--;
+			if (c == '}' && depth == 0)
+				return p;
+		}
+		else if (c == ';' && depth == 0) {
+			return p;
+		}
+	}
 
-		size->data.length.unit = parent_size.unit;
-	} else if (size->data.length.unit == CSS_UNIT_PCT) {
-		size->data.length.value = FDIV(FMUL(size->data.length.value,
-					parent_size.value), INTTOFIX(100));
-		size->data.length.unit = parent_size.unit;
+	return end;
+}
+
+static bool is_at_keyword (const char* p, const char* end,
+		const char* keyword)
+{
+	size_t len = strlen(keyword);
+	return (size_t) (end - p) > len && strncasecmp(p, keyword, len) == 0 &&
+		!isalnum((unsigned char) p[len]) && p[len] != '-';
+}
+
+/*
+ * Parses a statement of <sheet> alone, after the @namespace rules that
+ * precede it, and returns the type of the rule it yields, or
+ * CSS_RULE_UNKNOWN if it yields none.
+ */
+static css_rule_type parse_statement (const css_stylesheet* sheet,
+		const css_js_text* namespaces, const char* start,
+		const char* end)
+{
+	css_js_text statement = { NULL, 0, 0 };
+	css_js_sheet* parsed;
+	css_rule_type type = CSS_RULE_UNKNOWN;
+
+	text_append(&statement, namespaces->data, namespaces->len);
+	text_append(&statement, start, end - start);
+	if (create_stylesheet(statement.data, sheet->level,
+				sheet->url == NULL ? "" : sheet->url,
+				sheet->quirks_allowed, &parsed) == CSS_JS_OK) {
+		if (parsed->sheet->rule_list != NULL)
+			type = parsed->sheet->rule_list->type;
+		release_sheet(parsed);
 	}
 
-	size->status = CSS_FONT_SIZE_DIMENSION;
-	return CSS_OK;
+	free(statement.data);
+	return type;
 }
 
 /*
- * Generic get function to be used by callbacks. Must yield string.
+ * Writes the used style rules of an @media block, whose statements lie
+ * between <p> and <end>. Returns false if they don't match the rules of
+ * the block.
  */
-css_error get_string (
-		void *node,
-		char* (*js_fun)(const char*),
-		lwc_string** ret
-		)
+static bool prune_media (css_js_text* text, const css_stylesheet* sheet,
+		const css_js_text* namespaces, const css_rule* child,
+		const char* p, const char* end, const uint32_t* matches,
+		uint32_t* position)
 {
-	lwc_string* n = (lwc_string*) node;
-	const char* node_string = lwc_string_data(n);
+	while ((p = skip_space(p, end)) < end) {
+		const char* stmt_end = statement_end(p, end);
+		if (parse_statement(sheet, namespaces, p, stmt_end) ==
+				CSS_RULE_SELECTOR) {
+			if (child == NULL || child->type != CSS_RULE_SELECTOR)
+				return false;
+			if (matches != NULL && matches[*position] > 0) {
+				text_append_string(text, "\t");
+				text_append(text, p, stmt_end - p);
+				text_append_string(text, "\n");
+			}
+			(*position)++;
+			child = child->next;
+		}
+		p = stmt_end;
+	}
 
-	// printf("get_string querying node: %s\n", node_string);
+	return child == NULL;
+}
 
-	char* js_results =
-		(*js_fun)(node_string);
+css_js_error get_pruned_sheet (uint32_t index, char** text)
+{
+	stylesheet_list* entry = first_sheet;
+	for (uint32_t i = 0; entry != NULL && i < index; i++)
+		entry = entry->next;
+	if (entry == NULL)
+		return CSS_JS_SHEET;
+
+	const char* p = entry->sheet->source;
+	if (p == NULL)
+		return CSS_JS_SOURCE;
+
+	const css_stylesheet* sheet = entry->sheet->sheet;
+	const uint32_t* matches = get_rule_matches(entry->sheet);
+	const char* end = p + strlen(p);
+	const css_rule* rule = sheet->rule_list;
+	css_js_text pruned = { NULL, 0, 0 };
+	css_js_text namespaces = { NULL, 0, 0 };
+	uint32_t position = 0;
+	bool had_rule = false;
+	bool ok = true;
+
+	text_append(&pruned, "", 0);
+	text_append(&namespaces, "", 0);
+
+	/* Each statement is parsed alone to find the rule it yields */
+	while (ok && (p = skip_space(p, end)) < end) {
+		const char* stmt_end = statement_end(p, end);
+
+		if (is_at_keyword(p, stmt_end, "@namespace")) {
+			text_append(&namespaces, p, stmt_end - p);
+			text_append(&pruned, p, stmt_end - p);
+			text_append_string(&pruned, "\n");
+			p = stmt_end;
+			continue;
+		}
 
-	// printf("get_string got: %s\n", js_results);
+		css_rule_type type = parse_statement(sheet, &namespaces, p,
+				stmt_end);
+		/* Which libcss ignores after other rules */
+		if ((type == CSS_RULE_CHARSET &&
+					(had_rule || rule != sheet->rule_list)) ||
+				(type == CSS_RULE_IMPORT && had_rule))
+			type = CSS_RULE_UNKNOWN;
+
+		if (type == CSS_RULE_UNKNOWN) {
+			p = stmt_end;
+			continue;
+		}
+		if (rule == NULL || rule->type != type) {
+			ok = false;
+			break;
+		}
+		if (type != CSS_RULE_CHARSET && type != CSS_RULE_IMPORT)
+			had_rule = true;
+
+		if (type == CSS_RULE_SELECTOR) {
+			if (matches != NULL && matches[position] > 0) {
+				text_append(&pruned, p, stmt_end - p);
+				text_append_string(&pruned, "\n");
+			}
+			position++;
+		}
+		else if (type == CSS_RULE_MEDIA) {
+			const char* block = p;
+			while (block < stmt_end && *block != '{')
+				block++;
+			const char* block_end = stmt_end[-1] == '}'
+				? stmt_end - 1 : stmt_end;
+			if (block == stmt_end) {
+				ok = false;
+				break;
+			}
+
+			css_js_text used = { NULL, 0, 0 };
+			text_append(&used, "", 0);
+			ok = prune_media(&used, sheet, &namespaces,
+					((const css_rule_media*) rule)->first_child,
+					block + 1, block_end, matches, &position);
+			if (used.len > 0) {
+				text_append(&pruned, p, block + 1 - p);
+				text_append_string(&pruned, "\n");
+				text_append(&pruned, used.data, used.len);
+				text_append_string(&pruned, "}\n");
+			}
+			free(used.data);
+		}
+		else {
+			text_append(&pruned, p, stmt_end - p);
+			text_append_string(&pruned, "\n");
+		}
 
-	if (*js_results == '\0')
-	{
-		*ret = NULL;
-	  // printf("Null string\n");
+		rule = rule->next;
+		p = stmt_end;
 	}
-	else
-	{
-		lwc_string *results;
-		lwc_intern_string(js_results, strlen(js_results), &results);
-		*ret = lwc_string_ref(results);
+
+	free(namespaces.data);
+	if (!ok || rule != NULL) {
+		free(pruned.data);
+		return CSS_JS_SOURCE;
 	}
 
-	free(js_results);
-	return CSS_OK;
+	*text = pruned.data;
+	return CSS_JS_OK;
 }
 
+/******************************************************************************
+ * Stylesheet statistics						      *
+ ******************************************************************************/
+
 /*
- * Generic search function to be used by callbacks. Must yield boolean.
+ * Keys of one table of the selector hash, in an open-addressing table of
+ * lowercased names.
  */
-css_error match_bool (
-		void *node,
-		lwc_string* search_parameter,
-		lwc_string* match_parameter,
-		bool (*js_fun)(const char*, const char*, const char*),
-		bool* ret
-		)
-{
-	lwc_string* n = (lwc_string*) node;
-	const char* node_string = lwc_string_data(n);
+struct key_table {
+	css_js_key_count* entries;
+	uint32_t size;
+	uint32_t keys;
+	uint32_t largest;
+};
 
-	const char null_str[1] = "";
+static void count_key (struct key_table* table, lwc_string* name)
+{
+	lwc_string* key;
+	intern_lowercase(lwc_string_data(name), lwc_string_length(name), &key);
 
-	lwc_string* s = search_parameter;
-	const char* search_string = s == NULL
-		? null_str : lwc_string_data(s);
+	uint32_t i = lwc_string_hash_value(key) & (table->size - 1);
+	while (table->entries[i].key != NULL && table->entries[i].key != key)
+		i = (i + 1) & (table->size - 1);
 
-	lwc_string* m = match_parameter;
-	const char* match_str = m == NULL
-		? null_str : lwc_string_data(m);
+	if (table->entries[i].key == NULL) {
+		table->entries[i].key = key;
+		table->keys++;
+	}
+	else {
+		lwc_string_unref(key);
+	}
 
-	*ret = (*js_fun)(node_string, search_string, match_str);
+	if (++table->entries[i].count > table->largest)
+		table->largest = table->entries[i].count;
+}
 
-	// printf("match_bool got: %s\n", *ret ? "true" : "false");
-	return CSS_OK;
+static void free_key_table (struct key_table* table)
+{
+	for (uint32_t i = 0; i < table->size; i++) {
+		if (table->entries[i].key != NULL)
+			lwc_string_unref(table->entries[i].key);
+	}
+	free(table->entries);
 }
 
 /*
- * Generic search function to be used by callbacks. Must yield string.
+ * Counts the selectors of a sheet, for the size of the key tables.
  */
-css_error match_string (
-		void *node,
-		lwc_string* search_parameter,
-		char* (*js_fun)(const char*, const char*),
-		void** ret
-		)
+static uint32_t count_selectors (const css_rule* rule)
 {
-	lwc_string* n = node;
-	const char* node_string = lwc_string_data(n);
-	lwc_string* s = search_parameter;
-	const char* match_str = lwc_string_data(s);
-
-	char* js_results =
-		(*js_fun)(node_string, match_str);
+	uint32_t count = 0;
+
+	for (; rule != NULL; rule = rule->next) {
+		if (rule->type == CSS_RULE_SELECTOR)
+			count += rule->items;
+		else if (rule->type == CSS_RULE_MEDIA)
+			count += count_selectors(
+					((const css_rule_media*) rule)->first_child);
+	}
 
-	// printf("match_string got: %s\n", js_results);
+	return count;
+}
 
-	if (*js_results == '\0')
-	{
-	  // printf("Null string\n");
-		*ret = NULL;
+static void selector_stats (const css_selector* selector, uint32_t* stats,
+		struct key_table* tables)
+{
+	uint32_t depth = 0;
+
+	/* The selector hash files the subject (see is_candidate) */
+	const css_selector_detail* detail = &selector->data;
+	const css_selector_detail* key = NULL;
+	for (;;) {
+		if (detail->type == CSS_SELECTOR_ID && !detail->negate) {
+			key = detail;
+			break;
+		}
+		if (detail->type == CSS_SELECTOR_CLASS && !detail->negate &&
+				key == NULL)
+			key = detail;
+		if (detail->next == 0)
+			break;
+		detail++;
 	}
+	if (key != NULL)
+		count_key(&tables[key->type == CSS_SELECTOR_ID ? 0 : 1],
+				key->qname.name);
+	else if (!is_universal(selector->data.qname.name))
+		count_key(&tables[2], selector->data.qname.name);
 	else
-	{
-		lwc_string *results;
-		lwc_intern_string(js_results, strlen(js_results), &results);
-		*ret = lwc_string_ref(results);
+		stats[CSS_JS_SHEET_UNIVERSAL_CHAIN]++;
+
+	for (; selector != NULL; selector = selector->combinator) {
+		for (detail = &selector->data; ; detail++) {
+			switch (detail->type) {
+			case CSS_SELECTOR_ELEMENT:
+				stats[is_universal(detail->qname.name)
+					? CSS_JS_SHEET_UNIVERSALS
+					: CSS_JS_SHEET_TAGS]++;
+				break;
+			case CSS_SELECTOR_CLASS:
+				stats[CSS_JS_SHEET_CLASSES]++;
+				break;
+			case CSS_SELECTOR_ID:
+				stats[CSS_JS_SHEET_IDS]++;
+				break;
+			case CSS_SELECTOR_PSEUDO_CLASS:
+				stats[CSS_JS_SHEET_PSEUDO_CLASSES]++;
+				break;
+			case CSS_SELECTOR_PSEUDO_ELEMENT:
+				stats[CSS_JS_SHEET_PSEUDO_ELEMENTS]++;
+				break;
+			default:
+				stats[CSS_JS_SHEET_ATTRIBUTES]++;
+				break;
+			}
+			if (detail->next == 0)
+				break;
+		}
+
+		switch (selector->data.comb) {
+		case CSS_COMBINATOR_ANCESTOR:
+			stats[CSS_JS_SHEET_DESCENDANT]++;
+			break;
+		case CSS_COMBINATOR_PARENT:
+			stats[CSS_JS_SHEET_CHILD]++;
+			break;
+		case CSS_COMBINATOR_SIBLING:
+			stats[CSS_JS_SHEET_ADJACENT]++;
+			break;
+		case CSS_COMBINATOR_GENERIC_SIBLING:
+			stats[CSS_JS_SHEET_SIBLING]++;
+			break;
+		default:
+			break;
+		}
+		if (selector->combinator != NULL)
+			depth++;
 	}
 
-	free(js_results);
-	return CSS_OK;
+	stats[CSS_JS_SHEET_DEPTH + (depth < CSS_JS_DEPTH_COUNT
+			? depth : CSS_JS_DEPTH_COUNT - 1)]++;
 }
 
-/*
- * Not sure this is needed for node_name
- void set_namespace (css_qname* qname, const char* ns)
- {
- lwc_string *namespace_ptr;
- lwc_intern_string(ns, strlen(ns), &namespace_ptr);
- qname->ns = namespace_ptr;
- }
- */
+static void rule_stats (const css_rule* rule, uint32_t* stats,
+		struct key_table* tables)
+{
+	for (; rule != NULL; rule = rule->next) {
+		stats[CSS_JS_SHEET_RULES]++;
+
+		if (rule->type == CSS_RULE_MEDIA) {
+			stats[CSS_JS_SHEET_MEDIA_RULES]++;
+			rule_stats(((const css_rule_media*) rule)->first_child,
+					stats, tables);
+			continue;
+		}
+		if (rule->type != CSS_RULE_SELECTOR)
+			continue;
+
+		const css_rule_selector* rs = (const css_rule_selector*) rule;
+		stats[CSS_JS_SHEET_STYLE_RULES]++;
+		stats[CSS_JS_SHEET_SELECTORS] += rule->items;
+		if (rs->style != NULL)
+			stats[CSS_JS_SHEET_BYTECODE] +=
+				rs->style->used * sizeof(*rs->style->bytecode);
+		for (uint32_t i = 0; i < rule->items; i++)
+			selector_stats(rs->selectors[i], stats, tables);
+	}
+}
+
+css_js_error get_sheet_stats (uint32_t handle, uint32_t index,
+		uint32_t* stats)
+{
+	const css_js_sheet* sheet = (const css_js_sheet*) (uintptr_t) handle;
+
+	if (sheet == NULL) {
+		stylesheet_list* entry = first_sheet;
+		for (uint32_t i = 0; entry != NULL && i < index; i++)
+			entry = entry->next;
+		if (entry == NULL)
+			return CSS_JS_SHEET;
+		sheet = entry->sheet;
+	}
+
+	const css_rule* rules = sheet->sheet->rule_list;
+	uint32_t size = 16;
+	while (size < count_selectors(rules) * 2)
+		size *= 2;
+
+	/* Ids, classes and element names */
+	struct key_table tables[3];
+	for (uint32_t i = 0; i < 3; i++) {
+		tables[i].entries = calloc(size, sizeof(css_js_key_count));
+		tables[i].size = size;
+		tables[i].keys = 0;
+		tables[i].largest = 0;
+	}
 
+	memset(stats, 0, CSS_JS_SHEET_STAT_COUNT * sizeof(uint32_t));
+	rule_stats(rules, stats, tables);
+	stats[CSS_JS_SHEET_SIZE] = sheet->sheet->size;
+	stats[CSS_JS_SHEET_ID_KEYS] = tables[0].keys;
+	stats[CSS_JS_SHEET_ID_LARGEST] = tables[0].largest;
+	stats[CSS_JS_SHEET_CLASS_KEYS] = tables[1].keys;
+	stats[CSS_JS_SHEET_CLASS_LARGEST] = tables[1].largest;
+	stats[CSS_JS_SHEET_ELEMENT_KEYS] = tables[2].keys;
+	stats[CSS_JS_SHEET_ELEMENT_LARGEST] = tables[2].largest;
+
+	for (uint32_t i = 0; i < 3; i++)
+		free_key_table(&tables[i]);
+
+	return CSS_JS_OK;
+}
 
 /******************************************************************************
  * Style selection callbacks						  *
@@ -1075,6 +6054,11 @@ css_error match_string (
 css_error node_name(void *pw, void *node, css_qname *qname)
 {
 	UNUSED(pw);
+	if (document_loaded) {
+		css_js_doc_node* n = get_doc_node((lwc_string*) node);
+		qname->name = n == NULL ? NULL : lwc_string_ref(n->name);
+		return CSS_OK;
+	}
 	/*  set_namespace(qname, "names"); *Is this needed? */
 
 	return get_string(node, js_node_name, &(qname->name));
@@ -1090,14 +6074,16 @@ css_error node_name(void *pw, void *node, css_qname *qname)
  * \return CSS_OK on success,
  *	 CSS_NOMEM on memory exhaustion.
  *
- * \note The returned array will be destroyed by libcss. Therefore, it must
- *       be allocated using the same allocator as used by libcss during style
- *       selection.
+ * \note libcss unreferences the classes but doesn't free the returned
+ *       array; the caller does (see select_node_classes).
  */
 css_error node_classes(void *pw, void *node,
 		lwc_string ***classes, uint32_t *n_classes)
 {
 	UNUSED(pw);
+	if (document_loaded)
+		return doc_node_classes(node, classes, n_classes);
+
 	lwc_string* n = (lwc_string*) node;
 	const char* node_string = lwc_string_data(n);
 
@@ -1182,6 +6168,12 @@ css_error node_classes(void *pw, void *node,
 css_error node_id(void *pw, void *node, lwc_string **id)
 {
 	UNUSED(pw);
+	if (document_loaded) {
+		css_js_doc_node* n = get_doc_node((lwc_string*) node);
+		*id = n == NULL || n->id_attr == NULL
+			? NULL : lwc_string_ref(n->id_attr);
+		return CSS_OK;
+	}
 	return get_string(node, js_node_id, id);
 }
 
@@ -1200,6 +6192,8 @@ css_error named_ancestor_node(void *pw, void *node,
 		const css_qname *qname, void **ancestor)
 {
 	UNUSED(pw);
+	if (document_loaded)
+		return doc_relative(node, qname, CSS_COMBINATOR_ANCESTOR, ancestor);
 	return match_string(
 			node, qname->name, js_named_ancestor_node, ancestor);
 }
@@ -1219,6 +6213,8 @@ css_error named_parent_node(void *pw, void *node,
 		const css_qname *qname, void **parent)
 {
 	UNUSED(pw);
+	if (document_loaded)
+		return doc_relative(node, qname, CSS_COMBINATOR_PARENT, parent);
 	return match_string(node, qname->name, js_named_parent_node, parent);
 }
 
@@ -1240,6 +6236,9 @@ css_error named_sibling_node(void *pw, void *node,
 		const css_qname *qname, void **sibling)
 {
 	UNUSED(pw);
+	selection_sensitive = true;
+	if (document_loaded)
+		return doc_relative(node, qname, CSS_COMBINATOR_SIBLING, sibling);
 	return match_string(node, qname->name, js_named_sibling_node, sibling);
 }
 
@@ -1261,6 +6260,9 @@ css_error named_generic_sibling_node(void *pw, void *node,
 		const css_qname *qname, void **sibling)
 {
 	UNUSED(pw);
+	selection_sensitive = true;
+	if (document_loaded)
+		return doc_relative(node, qname, CSS_COMBINATOR_GENERIC_SIBLING, sibling);
 	return match_string(node, qname->name,
 				js_named_generic_sibling_node, sibling);
 }
@@ -1278,7 +6280,15 @@ css_error named_generic_sibling_node(void *pw, void *node,
 css_error parent_node(void *pw, void *node, void **parent)
 {
 	UNUSED(pw);
-	return get_string(node, js_parent_node, (lwc_string**) parent);
+	if (document_loaded) {
+		css_js_doc_node* n = get_doc_node((lwc_string*) node);
+		*parent = n == NULL || n->parent == NULL ? NULL : n->parent->id;
+		return CSS_OK;
+	}
+	get_string(node, js_parent_node, (lwc_string**) parent);
+	if (*parent != NULL)
+		hold_node(*parent);
+	return CSS_OK;
 }
 
 /**
@@ -1294,7 +6304,16 @@ css_error parent_node(void *pw, void *node, void **parent)
 css_error sibling_node(void *pw, void *node, void **sibling)
 {
 	UNUSED(pw);
-	return get_string(node, js_sibling_node, (lwc_string**) sibling);
+	selection_sensitive = true;
+	if (document_loaded) {
+		css_js_doc_node* n = get_doc_node((lwc_string*) node);
+		*sibling = n == NULL || n->prev_sibling == NULL ? NULL : n->prev_sibling->id;
+		return CSS_OK;
+	}
+	get_string(node, js_sibling_node, (lwc_string**) sibling);
+	if (*sibling != NULL)
+		hold_node(*sibling);
+	return CSS_OK;
 }
 
 /**
@@ -1314,6 +6333,11 @@ css_error node_has_name(void *pw, void *node,
 		const css_qname *qname, bool *match)
 {
 	UNUSED(pw);
+	if (document_loaded) {
+		css_js_doc_node* n = get_doc_node((lwc_string*) node);
+		*match = n != NULL && doc_has_name(n, qname->name);
+		return CSS_OK;
+	}
 	return match_bool(node, qname->name, NULL, js_node_has_name, match);
 }
 
@@ -1332,6 +6356,11 @@ css_error node_has_class(void *pw, void *node,
 		lwc_string *name, bool *match)
 {
 	UNUSED(pw);
+	if (document_loaded) {
+		css_js_doc_node* n = get_doc_node((lwc_string*) node);
+		*match = n != NULL && doc_has_class(n, name);
+		return CSS_OK;
+	}
 	return match_bool(node, name, NULL, js_node_has_class, match);
 }
 
@@ -1350,6 +6379,11 @@ css_error node_has_id(void *pw, void *node,
 		lwc_string *name, bool *match)
 {
 	UNUSED(pw);
+	if (document_loaded) {
+		css_js_doc_node* n = get_doc_node((lwc_string*) node);
+		*match = n != NULL && n->id_attr == name;
+		return CSS_OK;
+	}
 	return match_bool(node, name, NULL, js_node_has_id, match);
 }
 
@@ -1369,8 +6403,13 @@ css_error node_has_attribute(void *pw, void *node,
 		const css_qname *qname, bool *match)
 {
 	UNUSED(pw);
-	return match_bool(node, qname->name, NULL,
-			js_node_has_attribute, match);
+	selection_sensitive = true;
+
+	css_js_attr* attrs;
+	uint32_t n_attrs;
+	get_attributes((lwc_string*) node, &attrs, &n_attrs);
+	*match = find_attribute(attrs, n_attrs, qname->name) != NULL;
+	return CSS_OK;
 }
 
 /**
@@ -1391,8 +6430,9 @@ css_error node_has_attribute_equal(void *pw, void *node,
 		bool *match)
 {
 	UNUSED(pw);
-	return match_bool(node, qname->name,
-			value, js_node_has_attribute_equal, match);
+	selection_sensitive = true;
+	return has_attribute_value(node, qname, value,
+			CSS_SELECTOR_ATTRIBUTE_EQUAL, match);
 }
 
 /**
@@ -1417,8 +6457,9 @@ css_error node_has_attribute_dashmatch(void *pw, void *node,
 		bool *match)
 {
 	UNUSED(pw);
-	return match_bool(node, qname->name, value,
-			js_node_has_attribute_dashmatch, match);
+	selection_sensitive = true;
+	return has_attribute_value(node, qname, value,
+			CSS_SELECTOR_ATTRIBUTE_DASHMATCH, match);
 }
 
 /**
@@ -1440,8 +6481,9 @@ css_error node_has_attribute_includes(void *pw, void *node,
 		bool *match)
 {
 	UNUSED(pw);
-	return match_bool(node, qname->name, value,
-			js_node_has_attribute_includes, match);
+	selection_sensitive = true;
+	return has_attribute_value(node, qname, value,
+			CSS_SELECTOR_ATTRIBUTE_INCLUDES, match);
 }
 
 /**
@@ -1463,8 +6505,9 @@ css_error node_has_attribute_prefix(void *pw, void *node,
 		bool *match)
 {
 	UNUSED(pw);
-	return match_bool(node, qname->name, value,
-			js_node_has_attribute_prefix, match);
+	selection_sensitive = true;
+	return has_attribute_value(node, qname, value,
+			CSS_SELECTOR_ATTRIBUTE_PREFIX, match);
 }
 
 /**
@@ -1486,8 +6529,9 @@ css_error node_has_attribute_suffix(void *pw, void *node,
 		bool *match)
 {
 	UNUSED(pw);
-	return match_bool(node, qname->name, value,
-			js_node_has_attribute_suffix, match);
+	selection_sensitive = true;
+	return has_attribute_value(node, qname, value,
+			CSS_SELECTOR_ATTRIBUTE_SUFFIX, match);
 }
 
 /**
@@ -1509,8 +6553,9 @@ css_error node_has_attribute_substring(void *pw, void *node,
 		bool *match)
 {
 	UNUSED(pw);
-	return match_bool(node, qname->name, value,
-			js_node_has_attribute_substring, match);
+	selection_sensitive = true;
+	return has_attribute_value(node, qname, value,
+			CSS_SELECTOR_ATTRIBUTE_SUBSTRING, match);
 }
 
 /**
@@ -1526,6 +6571,11 @@ css_error node_has_attribute_substring(void *pw, void *node,
 css_error node_is_root(void *pw, void *node, bool *match)
 {
 	UNUSED(pw);
+	if (document_loaded) {
+		css_js_doc_node* n = get_doc_node((lwc_string*) node);
+		*match = n != NULL && n->parent == NULL;
+		return CSS_OK;
+	}
 	return match_bool(node, NULL, NULL, js_node_is_root, match);
 }
 
@@ -1545,6 +6595,13 @@ css_error node_count_siblings(void *pw, void *n, bool same_name,
 		bool after, int32_t *count)
 {
 	UNUSED(pw);
+	selection_sensitive = true;
+	if (document_loaded) {
+		css_js_doc_node* doc_node = get_doc_node((lwc_string*) n);
+		*count = doc_node == NULL
+			? 0 : doc_count_siblings(doc_node, same_name, after);
+		return CSS_OK;
+	}
 	lwc_string* node = n;
 	const char* node_string = lwc_string_data(node);
 
@@ -1566,6 +6623,12 @@ css_error node_count_siblings(void *pw, void *n, bool same_name,
 css_error node_is_empty(void *pw, void *node, bool *match)
 {
 	UNUSED(pw);
+	selection_sensitive = true;
+	if (document_loaded) {
+		css_js_doc_node* n = get_doc_node((lwc_string*) node);
+		*match = n != NULL && n->first_child == NULL && !n->has_text;
+		return CSS_OK;
+	}
 	return match_bool(node, NULL, NULL, js_node_is_empty, match);
 }
 
@@ -1584,6 +6647,12 @@ css_error node_is_empty(void *pw, void *node, bool *match)
 css_error node_is_link(void *pw, void *node, bool *match)
 {
 	UNUSED(pw);
+	selection_sensitive = true;
+	if (document_loaded) {
+		css_js_doc_node* n = get_doc_node((lwc_string*) node);
+		*match = n != NULL && doc_is_link(n);
+		return CSS_OK;
+	}
 	return match_bool(node, NULL, NULL, js_node_is_link, match);
 }
 
@@ -1601,6 +6670,12 @@ css_error node_is_link(void *pw, void *node, bool *match)
 css_error node_is_visited(void *pw, void *node, bool *match)
 {
 	UNUSED(pw);
+	selection_sensitive = true;
+	if (document_loaded) {
+		/* Documents have no dynamic state */
+		*match = false;
+		return CSS_OK;
+	}
 	return match_bool(node, NULL, NULL, js_node_is_visited, match);
 }
 
@@ -1617,6 +6692,12 @@ css_error node_is_visited(void *pw, void *node, bool *match)
 css_error node_is_hover(void *pw, void *node, bool *match)
 {
 	UNUSED(pw);
+	selection_sensitive = true;
+	if (document_loaded) {
+		/* Documents have no dynamic state */
+		*match = false;
+		return CSS_OK;
+	}
 	return match_bool(node, NULL, NULL, js_node_is_hover, match);
 }
 
@@ -1633,6 +6714,12 @@ css_error node_is_hover(void *pw, void *node, bool *match)
 css_error node_is_active(void *pw, void *node, bool *match)
 {
 	UNUSED(pw);
+	selection_sensitive = true;
+	if (document_loaded) {
+		/* Documents have no dynamic state */
+		*match = false;
+		return CSS_OK;
+	}
 	return match_bool(node, NULL, NULL, js_node_is_active, match);
 }
 
@@ -1649,6 +6736,12 @@ css_error node_is_active(void *pw, void *node, bool *match)
 css_error node_is_focus(void *pw, void *node, bool *match)
 {
 	UNUSED(pw);
+	selection_sensitive = true;
+	if (document_loaded) {
+		/* Documents have no dynamic state */
+		*match = false;
+		return CSS_OK;
+	}
 	return match_bool(node, NULL, NULL, js_node_is_focus, match);
 }
 
@@ -1665,6 +6758,13 @@ css_error node_is_focus(void *pw, void *node, bool *match)
 css_error node_is_enabled(void *pw, void *node, bool *match)
 {
 	UNUSED(pw);
+	selection_sensitive = true;
+	if (document_loaded) {
+		css_js_doc_node* n = get_doc_node((lwc_string*) node);
+		*match = n != NULL && doc_is_form_control(n) &&
+			doc_get_attr(n, "disabled") == NULL;
+		return CSS_OK;
+	}
 	return match_bool(node, NULL, NULL, js_node_is_enabled, match);
 }
 
@@ -1681,6 +6781,13 @@ css_error node_is_enabled(void *pw, void *node, bool *match)
 css_error node_is_disabled(void *pw, void *node, bool *match)
 {
 	UNUSED(pw);
+	selection_sensitive = true;
+	if (document_loaded) {
+		css_js_doc_node* n = get_doc_node((lwc_string*) node);
+		*match = n != NULL && doc_is_form_control(n) &&
+			doc_get_attr(n, "disabled") != NULL;
+		return CSS_OK;
+	}
 	return match_bool(node, NULL, NULL, js_node_is_disabled, match);
 }
 
@@ -1697,6 +6804,12 @@ css_error node_is_disabled(void *pw, void *node, bool *match)
 css_error node_is_checked(void *pw, void *node, bool *match)
 {
 	UNUSED(pw);
+	selection_sensitive = true;
+	if (document_loaded) {
+		css_js_doc_node* n = get_doc_node((lwc_string*) node);
+		*match = n != NULL && doc_is_checked(n);
+		return CSS_OK;
+	}
 	return match_bool(node, NULL, NULL, js_node_is_checked, match);
 }
 
@@ -1713,6 +6826,12 @@ css_error node_is_checked(void *pw, void *node, bool *match)
 css_error node_is_target(void *pw, void *node, bool *match)
 {
 	UNUSED(pw);
+	selection_sensitive = true;
+	if (document_loaded) {
+		/* Documents have no dynamic state */
+		*match = false;
+		return CSS_OK;
+	}
 	return match_bool(node, NULL, NULL, js_node_is_target, match);
 }
 
@@ -1731,23 +6850,32 @@ css_error node_is_lang(void *pw, void *node,
 		lwc_string *lang, bool *match)
 {
 	UNUSED(pw);
+	selection_sensitive = true;
+	if (document_loaded) {
+		css_js_doc_node* n = get_doc_node((lwc_string*) node);
+		*match = n != NULL && doc_is_lang(n, lang);
+		return CSS_OK;
+	}
 	return match_bool(node, lang, NULL, js_node_is_lang, match);
 }
 
 /*
- * NOTE: Somehow apparently NetSurf doesn't bother implementing this.
+ * Serves the hints given by set_hints. libcss only reads them, so they are
+ * returned as stored.
  */
 css_error node_presentational_hint(void *pw, void *node,
 		uint32_t *nhints, css_hint **hints)
 {
 	UNUSED(pw);
-	UNUSED(node);
-	/*
-	 * TODO: Maybe implement presentational hints,
-	 * when we find out what it means?
-	 */
-	*nhints = 0;
-	*hints = NULL;
+	css_js_hints* entry = get_hints((lwc_string*) node);
+	if (entry == NULL) {
+		*nhints = 0;
+		*hints = NULL;
+		return CSS_OK;
+	}
+
+	*nhints = entry->n_hints;
+	*hints = entry->hints;
 	return CSS_OK;
 }
 
@@ -1764,13 +6892,12 @@ css_error ua_default_for_property(void *pw, uint32_t property, css_hint *hint)
 {
 	UNUSED(pw);
 	if (property == CSS_PROP_COLOR) {
-		hint->data.color = 0xff000000;
+		hint->data.color = environment.color;
 		hint->status = CSS_COLOR_COLOR;
 
 	} else if (property == CSS_PROP_FONT_FAMILY) {
-		/* TODO: Implement default font option */
 		hint->data.strings = NULL;
-		hint->status = CSS_FONT_FAMILY_SANS_SERIF;
+		hint->status = environment.font_family;
 
 	} else if (property == CSS_PROP_QUOTES) {
 		/** \todo Not exactly useful :) */
@@ -1791,7 +6918,11 @@ css_error set_libcss_node_data(void *pw, void *node, void *libcss_node_data)
 {
 	UNUSED(pw);
 	lwc_string* node_str = node;
-	update_node(node_str, NULL, libcss_node_data);
+	css_js_node* nd = get_node_by_id(node_str);
+	if (nd == NULL) {
+		nd = append_node(node_str);
+	}
+	nd->data = libcss_node_data;
 	return CSS_OK;
 }
 
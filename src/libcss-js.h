@@ -15,8 +15,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <malloc.h>
+#include <time.h>
+#include <ctype.h>
 
 #include <libcss/libcss.h>
+#include "libcss/src/stylesheet.h"
+#include "libcss/src/select/hash.h"
 #include "libcss/test/dump_computed.h"
 
 #define UNUSED(x) ((x) = (x))
@@ -39,31 +44,400 @@ typedef enum css_js_error {
 	CSS_JS_APPEND_DATA       = 14,
 	CSS_JS_DATA_DONE	 = 15,
 	CSS_JS_APPEND_SHEET      = 16,
-	CSS_JS_HANDLER_LENGTH    = 17
+	CSS_JS_HANDLER_LENGTH    = 17,
+	CSS_JS_RESULTS_LENGTH    = 18,
+	CSS_JS_PROPERTY          = 19,
+	CSS_JS_DOCUMENT          = 20,
+	CSS_JS_ENVIRONMENT       = 21,
+	CSS_JS_HINT              = 22,
+	CSS_JS_SHEET             = 23,
+	CSS_JS_SOURCE            = 24
 } css_js_error;
 
 /*
- * Linked list of pointers to libcss_node_data.
- * The ID is the handler for the node.
+ * Pseudo-element code standing for every pseudo-element at once.
+ */
+#define CSS_JS_PSEUDO_ELEMENT_ALL CSS_PSEUDO_ELEMENT_COUNT
+
+/*
+ * Maximum number of media in a single query.
+ */
+#define CSS_JS_MEDIA_MAX 16
+
+/*
+ * Kinds of names recorded in the selector dependency index.
+ */
+typedef enum css_js_dep_kind {
+	CSS_JS_DEP_CLASS	=  0,
+	CSS_JS_DEP_ID		=  1,
+	CSS_JS_DEP_ATTRIBUTE	=  2,
+	CSS_JS_DEP_PSEUDO_CLASS	=  3,
+	CSS_JS_DEP_VALUE	=  4,
+	CSS_JS_DEP_KIND_COUNT	=  5
+} css_js_dep_kind;
+
+/*
+ * Elements whose selection may depend on a name, relative to the element
+ * on which the name appears or changes.
+ */
+#define CSS_JS_DEP_SELF			0x1 /* e.g. .a */
+#define CSS_JS_DEP_DESCENDANTS		0x2 /* e.g. .a p, .a > p */
+#define CSS_JS_DEP_SIBLINGS		0x4 /* e.g. .a + p, .a ~ p */
+#define CSS_JS_DEP_SIBLING_DESCENDANTS	0x8 /* e.g. .a + div p */
+#define CSS_JS_DEP_ALL			0xf
+
+/*
+ * Entry of the selector dependency index.
+ * Attribute and pseudo-class names are stored lowercased. The values of
+ * attribute selectors are stored as written, with their lowercased form in
+ * <lower>, so that matching does not fold them again.
+ */
+struct css_js_dep {
+	lwc_string* name;
+	lwc_string* lower;
+	css_js_dep_kind kind;
+	uint8_t scope;
+	struct css_js_dep* next;
+};
+typedef struct css_js_dep css_js_dep;
+
+/*
+ * Selection results shared between structurally identical nodes.
+ * Reference counted: the sharing cache holds one reference and every node
+ * using the results holds another one.
+ */
+struct css_js_style {
+	css_select_results* sr;
+	uint32_t refcnt;
+};
+typedef struct css_js_style css_js_style;
+
+/*
+ * Entry of the computed style intern table.
+ * Identical styles, which libcss interns as a single object, are stored once
+ * and shared by every node and pseudo-element that has them. The style is
+ * owned by the entry, unless <owner> is set, in which case it belongs to the
+ * selection results <owner>, of which the entry holds a reference.
+ * <dump> is the text of the style, formatted when first asked for, or NULL.
+ * Ids are never reused, so a style keeps its id for as long as any node
+ * has it.
+ */
+struct css_js_interned {
+	css_computed_style* style;
+	css_js_style* owner;
+	char* dump;
+	size_t dump_len;
+	uint32_t hash;
+	uint32_t id;
+	uint32_t refcnt;
+	struct css_js_interned* next;
+};
+typedef struct css_js_interned css_js_interned;
+
+/*
+ * Entry of the style sharing cache.
+ * Nodes are keyed by their name, id and classes, by the entry of their
+ * parent (so the key describes the whole chain of ancestors) and by the
+ * media. The style is NULL if the selection for the key depended on
+ * anything else (siblings, attributes or dynamic state), in which case
+ * nodes must be selected individually; the entry still serves as the key of
+ * their children.
+ * Reference counted: every node selected with the entry and every entry
+ * keyed by it holds a reference, so the entry goes away with the last node
+ * under it.
+ */
+struct css_js_share {
+	struct css_js_share* parent;
+	uint32_t refcnt;
+	lwc_string* name;
+	lwc_string* id;
+	lwc_string** classes;
+	uint32_t n_classes;
+	css_media_type media;
+	uint32_t hash;
+	css_js_style* style;
+	struct css_js_share* next;
+};
+typedef struct css_js_share css_js_share;
+
+/*
+ * Presentational hints of a node, keyed by its interned id, as returned to
+ * libcss by node_presentational_hint.
+ */
+struct css_js_hints {
+	lwc_string* node;
+	css_hint* hints;
+	uint32_t n_hints;
+	struct css_js_hints* next;
+};
+typedef struct css_js_hints css_js_hints;
+
+/*
+ * Attribute of a node. The name is lowercased, and <lower_value> is the
+ * lowercased value, for the case-insensitive matching of attribute
+ * selectors.
+ */
+struct css_js_attr {
+	lwc_string* name;
+	lwc_string* value;
+	lwc_string* lower_value;
+};
+typedef struct css_js_attr css_js_attr;
+
+/*
+ * Node store entry. The ID is the handler for the node.
+ *
+ * <selected> holds the results of the node's selection (possibly shared
+ * with other nodes) and <styles> the final styles, composed with the
+ * parent's and interned.
+ *
+ * Restyling is lazy and driven by counters:
+ * 	selected_at: value of restyle_epoch when the node was selected.
+ * 	self_epoch: the node must be selected again if selected_at is older.
+ * 	subtree_epoch: same, for all the node's descendants.
+ * 	children_epoch: same, for the node's children only.
+ * 	chain_epoch: the newest subtree_epoch among the node's ancestors.
+ * 	composed_with: the id of the parent's style when the node was
+ * 		composed.
+ *
+ * <attrs> is the node's attribute table, fetched from the handlers on the
+ * first attribute selector that is matched against the node, and dropped
+ * when any of its attributes changes.
+ *
+ * <parent> is the stored node that the node was selected under, and
+ * <children>, linked through <next_sibling> and <prev_sibling>, are the
+ * stored nodes selected under it, so that removing a node only walks its
+ * subtree.
  */
 struct css_js_node {
 	lwc_string* id;
 	void* data;
-	css_select_results* sr;
+	css_js_style* selected;
+	css_js_interned* styles[CSS_PSEUDO_ELEMENT_COUNT];
+	css_js_share* share;
+	lwc_string* parent_id;
+	lwc_string* inline_style;
+	css_media_type media;
+	uint32_t selected_at;
+	uint32_t self_epoch;
+	uint32_t subtree_epoch;
+	uint32_t children_epoch;
+	uint32_t chain_epoch;
+	uint32_t composed_with;
+	struct css_js_node* parent;
+	struct css_js_node* children;
+	struct css_js_node* next_sibling;
+	struct css_js_node* prev_sibling;
+	css_js_attr* attrs;
+	uint32_t n_attrs;
+	bool attrs_loaded;
 	struct css_js_node* next;
 };
 typedef struct css_js_node css_js_node;
 
 /*
- * Linked list of pointers to css_stylesheet.
- * Its purpose is to track all stylesheets so they can be freed.
+ * Node of a document loaded with load_document. <lower_name> is the
+ * lowercased tag name; <id_attr> and <classes> are split from the
+ * attributes. Sibling positions are counted when the document is loaded:
+ * 	index, after: count of preceding and following siblings.
+ * 	same_name_before, same_name_after: same, with the node's name only.
  */
-struct stylesheet_list {
+struct css_js_doc_node {
+	lwc_string* id;
+	lwc_string* name;
+	lwc_string* lower_name;
+	lwc_string* id_attr;
+	lwc_string** classes;
+	uint32_t n_classes;
+	css_js_attr* attrs;
+	uint32_t n_attrs;
+	bool has_text;
+	struct css_js_doc_node* parent;
+	struct css_js_doc_node* prev_sibling;
+	struct css_js_doc_node* next_sibling;
+	struct css_js_doc_node* first_child;
+	struct css_js_doc_node* last_child;
+	int32_t index;
+	int32_t after;
+	int32_t same_name_before;
+	int32_t same_name_after;
+	struct css_js_doc_node* next;
+};
+typedef struct css_js_doc_node css_js_doc_node;
+
+/*
+ * Position of a style rule among the style rules of its stylesheet, in
+ * source order.
+ */
+struct css_js_rule_position {
+	const css_rule* rule;
+	uint32_t position;
+};
+typedef struct css_js_rule_position css_js_rule_position;
+
+/*
+ * Parsed stylesheet, referenced by the sheet lists of the selection contexts
+ * it is attached to and by its Javascript handle, if any.
+ *
+ * <source> is the text of the stylesheet, kept if it was parsed while rule
+ * coverage was enabled. <rule_matches> counts, for each style rule in
+ * source order, the selections it matched during coverage <coverage_epoch>.
+ * <rule_positions> holds the positions of the <n_style_rules> style rules,
+ * sorted by rule, once a selection has been replayed against the sheet.
+ */
+struct css_js_sheet {
 	css_stylesheet* sheet;
+	uint32_t refcnt;
+	char* source;
+	uint32_t* rule_matches;
+	css_js_rule_position* rule_positions;
+	uint32_t n_style_rules;
+	uint32_t coverage_epoch;
+};
+typedef struct css_js_sheet css_js_sheet;
+
+/*
+ * Linked list of pointers to css_js_sheet.
+ * Its purpose is to track all stylesheets so they can be released.
+ */
+struct stylesheet_list {
+	css_js_sheet* sheet;
+	css_origin origin;
+	css_media_type media;
 	struct stylesheet_list* next;
 };
 typedef struct stylesheet_list stylesheet_list;
 
+/*
+ * Rendering environment: the values that computed styles take where neither
+ * the stylesheets nor the parent element set them.
+ * 	font_size: medium font size, in tenths of a point.
+ * 	font_family: generic font family, as a CSS_FONT_FAMILY_* value.
+ * 	color: text color, as 0xAARRGGBB.
+ * 	ex_ratio: size of 1ex, in ems.
+ */
+struct css_js_env {
+	int32_t font_size;
+	uint8_t font_family;
+	css_color color;
+	css_fixed ex_ratio;
+};
+typedef struct css_js_env css_js_env;
+
+/*
+ * Growable null-terminated text.
+ */
+struct css_js_text {
+	char* data;
+	size_t len;
+	size_t size;
+};
+typedef struct css_js_text css_js_text;
+
+/*
+ * Profile of a selector, recorded while profiling is enabled.
+ * 	selector: the selector, or NULL once its stylesheet is freed.
+ * 	sheet: the stylesheet of the selector.
+ * 	text: the selector, as CSS.
+ * 	url: the URL of the stylesheet.
+ * 	origin: the origin the stylesheet was added with.
+ * 	sheet_index: the position of the stylesheet in its context.
+ * 	rule: the position of the rule among the style rules of the
+ * 		stylesheet, in source order.
+ * 	tests: times the selector was tested against an element.
+ * 	matches: times it matched.
+ * 	calls: selection callbacks made while testing it.
+ * 	time: time spent testing it, in nanoseconds.
+ * 	inexact: whether it has a pseudo-class the replay can't test.
+ */
+struct css_js_profile {
+	const css_selector* selector;
+	const css_stylesheet* sheet;
+	char* text;
+	char* url;
+	css_origin origin;
+	uint32_t sheet_index;
+	uint32_t rule;
+	uint32_t tests;
+	uint32_t matches;
+	uint32_t calls;
+	double time;
+	bool inexact;
+	struct css_js_profile* next;
+};
+typedef struct css_js_profile css_js_profile;
+
+/*
+ * Id, classes and name of the element being profiled, which decide the
+ * selectors that libcss tests against it.
+ */
+struct css_js_element_keys {
+	lwc_string* name;
+	lwc_string* id;
+	lwc_string** classes;
+	uint32_t n_classes;
+};
+typedef struct css_js_element_keys css_js_element_keys;
+
+/*
+ * Selector that libcss tests against the element being profiled, and the
+ * position of its rule.
+ */
+struct css_js_candidate {
+	const css_selector* selector;
+	uint32_t rule;
+};
+typedef struct css_js_candidate css_js_candidate;
+
+/*
+ * Count of the selectors filed under a key of the selector hash, for the
+ * stylesheet statistics.
+ */
+struct css_js_key_count {
+	lwc_string* key;
+	uint32_t count;
+};
+typedef struct css_js_key_count css_js_key_count;
+
+/*
+ * Selection context: the stylesheets, node store, selector index and loaded
+ * document of one context. The current context lives in the globals of
+ * libcss-js.c; use_context saves them here and loads those of another.
+ * Computed styles are interned across all contexts. Every context is linked
+ * from the default one by <next>.
+ */
+struct css_js_context {
+	css_select_ctx* select_ctx;
+	stylesheet_list* first_sheet;
+	uint32_t sheet_count;
+	css_js_node** node_table;
+	uint32_t node_table_size;
+	uint32_t node_table_count;
+	css_js_share** share_table;
+	uint32_t share_table_size;
+	uint32_t share_table_count;
+	css_js_dep** dep_table;
+	uint32_t dep_table_size;
+	uint32_t dep_table_count;
+	uint8_t dep_any_scope[CSS_JS_DEP_KIND_COUNT];
+	uint8_t dep_position_scope;
+	css_media_type* media_masks;
+	uint32_t media_mask_count;
+	uint32_t* dep_index_refs;
+	css_js_doc_node** doc_table;
+	uint32_t doc_table_size;
+	uint32_t doc_table_count;
+	css_js_doc_node* doc_first_root;
+	css_js_doc_node* doc_last_root;
+	bool document_loaded;
+	css_js_hints** hint_table;
+	uint32_t hint_table_size;
+	uint32_t hint_table_count;
+	css_js_env environment;
+	struct css_js_context* next;
+};
+typedef struct css_js_context css_js_context;
+
 /*
  * Resets the selection context (i.e. removes all added CSS stylesheets).
  */
@@ -91,6 +465,25 @@ css_js_error add_stylesheet (const char* css_string, const char* level,
 		const char* origin, const char* media, const char* url,
                 bool allow_quirks);
 
+/*
+ * Shared stylesheets: parsed once, then attached to any number of selection
+ * contexts, and destroyed when released by the Javascript end and by every
+ * context.
+ * Parameters are as for add_stylesheet. <handle> receives the stylesheet.
+ */
+css_js_error parse_stylesheet (const char* css_string, const char* level,
+		const char* url, bool allow_quirks, uint32_t* handle);
+css_js_error attach_stylesheet (uint32_t handle, const char* origin,
+		const char* media);
+css_js_error release_stylesheet (uint32_t handle);
+
+/*
+ * Attaches the built-in HTML user-agent stylesheet (src/html.css) to the
+ * current selection context. It is parsed on first use only, and shared by
+ * every context afterwards.
+ */
+css_js_error attach_html_stylesheet (void);
+
 /*
  * Gets the computed style for an element as a string identical to libcss's
  * selection test output.
@@ -98,7 +491,9 @@ css_js_error add_stylesheet (const char* css_string, const char* level,
  * 	element: a string that uniquely identifies the element being queried.
  * 	pseudo: a string that specifies the pseudo-element being queried.
  * 		Accepted values are "none", "first-line", "first-letter",
- * 		"before" and "after".
+ * 		"before", "after" and "all". With "all", the style of every
+ * 		pseudo-element that has one is output, each preceded by a
+ * 		line with its name, such as "::before".
  * 	origin: a string that specifies the origin of the stylesheet.
  * 		Accepted values are "ua", "UA", "user agent", "user-agent",
  * 		"user" and "author".
@@ -111,19 +506,367 @@ css_js_error add_stylesheet (const char* css_string, const char* level,
  * 	results: a pointer to a buffer in the heap of size <len>.
  * 	len: the size of the aforementioned buffer. Must be large enough
  * 		to fit the results. In libcss's original code, the value
- * 		of 8192 is used.
+ * 		of 8192 is used, per pseudo-element.
  */
 css_js_error get_style (const char* element, const char* pseudo,
 			const char* media, const char* inline_style,
 			char* results, size_t len);
 
+/*
+ * Gets the id of the computed style of an element, shared by all the
+ * elements and pseudo-elements that have an identical style.
+ * Parameters:
+ * 	element, pseudo, media and inline_style: same as in get_style,
+ * 		except that pseudo can't be "all".
+ * 	id: location to receive the id, or 0 if the pseudo-element has no
+ * 		style.
+ */
+css_js_error get_style_id (const char* element, const char* pseudo,
+			const char* media, const char* inline_style,
+			uint32_t* id);
+
+/*
+ * Style handles: references to the computed style of an element, whose
+ * properties are read one at a time.
+ * A handle keeps its style alive, even after the element is restyled or
+ * removed, until it is released.
+ * Parameters:
+ * 	element, pseudo, media and inline_style: same as in get_style,
+ * 		except that pseudo can't be "all".
+ * 	handle: location to receive the handle, or 0 if the pseudo-element
+ * 		has no style.
+ * 	property: the name of the property, as in get_style's results.
+ * 	results: a buffer of size <len> to receive the value of the
+ * 		property, or "" (empty string) if there is no such property.
+ */
+css_js_error get_style_handle (const char* element, const char* pseudo,
+			const char* media, const char* inline_style,
+			uint32_t* handle);
+css_js_error get_handle_property (uint32_t handle, const char* property,
+		char* results, size_t len);
+css_js_error release_style_handle (uint32_t handle);
+
+/*
+ * Same as get_style, for several media at once.
+ * The media that select from the same rules, given the media of the
+ * stylesheets and of their @media rules, are styled only once.
+ * The results for each group of such media are preceded by a line with
+ * the list of their names, such as "@media screen,tv".
+ * Parameters:
+ * 	media: a comma-separated list of the media being queried, with the
+ * 		values accepted by get_style and no spaces.
+ * 	len: must fit the results for every medium.
+ */
+css_js_error get_style_media (const char* element, const char* pseudo,
+			const char* media, const char* inline_style,
+			char* results, size_t len);
+
+/*
+ * Kinds of columns written by export_columns.
+ * Every property has a type column (the value returned by libcss's
+ * accessor, such as CSS_WIDTH_AUTO); the others have, in addition:
+ * 	LENGTH: a float value column and a unit column (css_unit).
+ * 	NUMBER: a float value column.
+ * 	COLOR: a uint32 value column, as 0xAARRGGBB.
+ * 	INTEGER: an int32 value column.
+ */
+typedef enum css_js_column_kind {
+	CSS_JS_COLUMN_KEYWORD	=  0,
+	CSS_JS_COLUMN_LENGTH	=  1,
+	CSS_JS_COLUMN_NUMBER	=  2,
+	CSS_JS_COLUMN_COLOR	=  3,
+	CSS_JS_COLUMN_INTEGER	=  4
+} css_js_column_kind;
+
+/*
+ * Writes the computed style of a list of elements into columns, one per
+ * property, indexed by the position of the element in the list.
+ * Parameters:
+ * 	elements: the identifiers of the elements, each terminated by a
+ * 		null character.
+ * 	inline_styles: the elements' inline styles, in the same order and
+ * 		format, "" (empty string) for none.
+ * 	count: the number of elements.
+ * 	media: the media being queried, same as in get_style.
+ * 	properties: a comma-separated list of the properties to export,
+ * 		named as in get_style's results.
+ * 	columns: for each property, three pointers (64-bit, as in
+ * 		set_handlers) to buffers of <count> elements: the type
+ * 		column (uint8_t), the value column (4 bytes each) and the
+ * 		unit column (uint8_t).
+ * 	kinds: location of an array to receive the css_js_column_kind of
+ * 		each property.
+ */
+css_js_error export_columns (const char* elements, const char* inline_styles,
+		uint32_t count, const char* media, const char* properties,
+		uint64_t* columns, uint8_t* kinds);
+
+/*
+ * Numeric styles: the properties that export_columns supports, read from
+ * the computed style of a single element.
+ * get_numeric_properties gives the comma-separated names of the
+ * properties, in <names>, a buffer of size <len>, their
+ * css_js_column_kind, in <kinds>, and their <count>, which is the size of
+ * the arrays that get_style_numeric fills.
+ * get_style_numeric takes the same parameters as get_style, except that
+ * pseudo can't be "all", and receives in <types>, <values> and <units>
+ * the value of each property, as export_columns does for one element.
+ * <has_style> is set to false if the pseudo-element has no style.
+ */
+css_js_error get_numeric_properties (char* names, size_t len, uint8_t* kinds,
+		uint32_t* count);
+css_js_error get_style_numeric (const char* element, const char* pseudo,
+			const char* media, const char* inline_style,
+			uint8_t* types, uint32_t* values, uint8_t* units,
+			bool* has_style);
+
+/*
+ * Mutation notifications.
+ * The styles of the nodes that may be affected, according to the selectors
+ * of the stylesheets, are marked for restyling; they are selected again
+ * when next queried.
+ * Parameters:
+ * 	element: a string that uniquely identifies the element that changed.
+ * 	parent: the element's parent, or "" (empty string) if it is root.
+ * 	name: the name of the attribute that changed.
+ * 	old_value, new_value: the attribute's values before and after the
+ * 		change, "" (empty string) if none. Only used for the class
+ * 		and id attributes, and only if has_old_value is true.
+ * 	state: the dynamic state that changed (e.g. "hover" or "focus").
+ */
+css_js_error attribute_changed (const char* element, const char* parent,
+		const char* name, const char* old_value,
+		const char* new_value, bool has_old_value);
+css_js_error state_changed (const char* element, const char* parent,
+		const char* state);
+css_js_error children_changed (const char* element, const char* parent);
+
+/*
+ * Removes an element and its descendants from the node store.
+ */
+css_js_error node_removed (const char* element);
+
+/*
+ * Removes all elements from the node store.
+ */
+css_js_error drop_nodes (void);
+
+/*
+ * Finds the parent an element was last selected with, without calling the
+ * handlers. Parameters:
+ * 	element: a string that uniquely identifies the element.
+ * 	parent: location to receive the parent, "" (empty string) if the
+ * 		element is root, or NULL if the element is not stored. It is
+ * 		valid until the node store changes.
+ */
+css_js_error get_node_parent (const char* element, const char** parent);
+
+/*
+ * Sets the presentational hints of a batch of elements, replacing those
+ * they had. Hints apply as author rules of no specificity, with no
+ * stylesheet to parse.
+ * Parameters:
+ * 	strings: for each element, its id followed by two strings per hint:
+ * 		the property (e.g. "width" or "text-align") and either the
+ * 		keyword (e.g. "center" or "auto") or the unit of a length
+ * 		(e.g. "px" or "%"), or "" (empty string) for a color. All are
+ * 		NUL-terminated.
+ * 	values: for each element, its number of hints (0 to remove them),
+ * 		then one value per hint: the length, the color as 0xAARRGGBB,
+ * 		or 0 for a keyword.
+ * 	count: the number of elements.
+ * Either every element gets its new hints or, if any hint is invalid, none
+ * does.
+ */
+css_js_error set_hints (const char* strings, const double* values,
+		uint32_t count);
+
+/*
+ * Independent selection contexts. Every other function works on the current
+ * context, which is the default one (handle 0) until use_context is called.
+ * Destroying the current context makes the default one current.
+ */
+css_js_error create_context (uint32_t* handle);
+css_js_error use_context (uint32_t handle);
+css_js_error destroy_context (uint32_t handle);
+
+/*
+ * Creates a context with the stylesheets of the context <base>, which are
+ * shared rather than parsed again, and a copy of its selector dependency
+ * index. Later changes to either context don't affect the other.
+ */
+css_js_error derive_context (uint32_t base, uint32_t* handle);
+
+/*
+ * Sets the rendering environment of the current context (see css_js_env).
+ * New contexts start with a font size of 160 (16pt), sans-serif, black and
+ * an ex ratio of 0.6; derived contexts start with that of their base.
+ * Parameters:
+ * 	font_size: in tenths of a point. Must be positive.
+ * 	font_family: "serif", "sans-serif", "cursive", "fantasy" or
+ * 		"monospace".
+ * 	color: 0xAARRGGBB.
+ * 	ex_ratio: size of 1ex, in ems. Must be positive.
+ */
+css_js_error set_environment (int32_t font_size, const char* font_family,
+		uint32_t color, double ex_ratio);
+
+/*
+ * Starts or stops profiling selectors. Starting discards the previous
+ * profile. While profiling, each selection is replayed selector by selector
+ * with the same callbacks, to attribute its cost to the selectors tested.
+ */
+css_js_error set_profiling (bool enabled);
+
+/*
+ * Gets the profile of the <top> selectors that took the longest to test,
+ * or of all of them if <top> is 0.
+ * Parameters:
+ * 	totals: receives the count of selections profiled and the time they
+ * 		took, in nanoseconds, without the replays.
+ * 	count: receives the count of selectors reported.
+ * 	report: receives a buffer to be freed by the caller, with, for each
+ * 		selector, null-terminated fields: the selector, the URL,
+ * 		origin and position of its stylesheet, the position of its
+ * 		rule, and its tests, matches, callbacks and time (see
+ * 		css_js_profile).
+ */
+css_js_error get_profile (uint32_t top, double* totals, uint32_t* count,
+		char** report);
+
+/*
+ * Starts or stops counting the selections that each style rule matches.
+ * Starting discards the previous counts. Stylesheets parsed while coverage
+ * is enabled keep their text, so they can be pruned.
+ */
+css_js_error set_coverage (bool enabled);
+
+/*
+ * Gets the rule coverage of the stylesheets of the current context.
+ * Parameters:
+ * 	count: receives the count of stylesheets.
+ * 	report: receives a buffer to be freed by the caller, with
+ * 		null-terminated fields: for each stylesheet, its URL and
+ * 		origin, "1" if it can be pruned or "0" otherwise, and the
+ * 		count of its style rules, then, for each rule in source
+ * 		order, its selectors and the count of selections it matched.
+ */
+css_js_error get_coverage (uint32_t* count, char** report);
+
+/*
+ * Writes to <text> a buffer, to be freed by the caller, with the text of
+ * the stylesheet at <index> in the current context, without the style
+ * rules that matched no selection since coverage was started.
+ */
+css_js_error get_pruned_sheet (uint32_t index, char** text);
+
+/*
+ * Memory statistics, in the order written by get_memory_stats.
+ * 	HEAP: bytes allocated on the heap.
+ * 	STRINGS: interned strings (libwapcaplet).
+ * 	NODES: entries of the node store.
+ * 	STYLES: entries of the computed style intern table.
+ * 	SHEETS: stylesheets added to the selection context.
+ * 	TEXT: bytes of the style text formatted for get_style.
+ * 	SHARES: entries of the style sharing cache.
+ */
+typedef enum css_js_stat {
+	CSS_JS_STAT_HEAP    = 0,
+	CSS_JS_STAT_STRINGS = 1,
+	CSS_JS_STAT_NODES   = 2,
+	CSS_JS_STAT_STYLES  = 3,
+	CSS_JS_STAT_SHEETS  = 4,
+	CSS_JS_STAT_TEXT    = 5,
+	CSS_JS_STAT_SHARES  = 6,
+	CSS_JS_STAT_COUNT   = 7
+} css_js_stat;
+
+/*
+ * Writes CSS_JS_STAT_COUNT statistics to <stats>, to check that memory use
+ * stays flat in long-running processes.
+ */
+css_js_error get_memory_stats (uint32_t* stats);
+
+/*
+ * Stylesheet statistics, in the order written by get_sheet_stats.
+ * 	RULES, STYLE_RULES, MEDIA_RULES: rules of the sheet, including
+ * 		those in @media blocks, style rules and @media rules.
+ * 	SELECTORS: selectors of the style rules.
+ * 	IDS to PSEUDO_ELEMENTS: simple selectors of each type. UNIVERSALS
+ * 		counts compound selectors without an element name.
+ * 	DESCENDANT to SIBLING: combinators of each type.
+ * 	BYTECODE: bytes of bytecode of the declarations.
+ * 	SIZE: bytes used by the sheet, as reported by libcss.
+ * 	ID_KEYS to ELEMENT_LARGEST: distinct keys of each table of the
+ * 		selector hash, and the most selectors filed under one key.
+ * 	UNIVERSAL_CHAIN: selectors filed as universal, which are tested
+ * 		against every element.
+ * 	DEPTH: CSS_JS_DEPTH_COUNT counts of selectors by number of
+ * 		combinators, the last for that many or more.
+ */
+#define CSS_JS_DEPTH_COUNT 8
+typedef enum css_js_sheet_stat {
+	CSS_JS_SHEET_RULES            =  0,
+	CSS_JS_SHEET_STYLE_RULES      =  1,
+	CSS_JS_SHEET_MEDIA_RULES      =  2,
+	CSS_JS_SHEET_SELECTORS        =  3,
+	CSS_JS_SHEET_IDS              =  4,
+	CSS_JS_SHEET_CLASSES          =  5,
+	CSS_JS_SHEET_TAGS             =  6,
+	CSS_JS_SHEET_UNIVERSALS       =  7,
+	CSS_JS_SHEET_ATTRIBUTES       =  8,
+	CSS_JS_SHEET_PSEUDO_CLASSES   =  9,
+	CSS_JS_SHEET_PSEUDO_ELEMENTS  = 10,
+	CSS_JS_SHEET_DESCENDANT       = 11,
+	CSS_JS_SHEET_CHILD            = 12,
+	CSS_JS_SHEET_ADJACENT         = 13,
+	CSS_JS_SHEET_SIBLING          = 14,
+	CSS_JS_SHEET_BYTECODE         = 15,
+	CSS_JS_SHEET_SIZE             = 16,
+	CSS_JS_SHEET_ID_KEYS          = 17,
+	CSS_JS_SHEET_ID_LARGEST       = 18,
+	CSS_JS_SHEET_CLASS_KEYS       = 19,
+	CSS_JS_SHEET_CLASS_LARGEST    = 20,
+	CSS_JS_SHEET_ELEMENT_KEYS     = 21,
+	CSS_JS_SHEET_ELEMENT_LARGEST  = 22,
+	CSS_JS_SHEET_UNIVERSAL_CHAIN  = 23,
+	CSS_JS_SHEET_DEPTH            = 24,
+	CSS_JS_SHEET_STAT_COUNT       = CSS_JS_SHEET_DEPTH + CSS_JS_DEPTH_COUNT
+} css_js_sheet_stat;
+
+/*
+ * Writes CSS_JS_SHEET_STAT_COUNT statistics of a stylesheet to <stats>.
+ * The stylesheet is <handle>, as given by parse_stylesheet, or, if 0, the
+ * one at <index> in the current context.
+ */
+css_js_error get_sheet_stats (uint32_t handle, uint32_t index,
+		uint32_t* stats);
+
+/*
+ * Loads a whole document tree, which then answers the selection callbacks
+ * natively instead of the Javascript handlers.
+ * Parameters:
+ * 	data: <count> node records, parents before their children, each
+ * 		made of null-terminated fields: the node's identifier, its
+ * 		tag name, its parent's identifier ("" if top-level), the
+ * 		count of attributes, as many name and value pairs, and "1"
+ * 		if the node has text content or "0" otherwise.
+ * 	count: the count of node records.
+ */
+css_js_error load_document (const char* data, uint32_t count);
+
+/*
+ * Unloads the document, if any, and goes back to the Javascript handlers.
+ */
+css_js_error unload_document (void);
+
 /*
  * Sets the Javascript handler functions.
  * Parameters:
  * 	arr: an array of function pointers cast to uint64_t*.
- * 	len: the count of function pointers. Currently, must be 33.
+ * 	len: the count of function pointers, as given by get_handler_count.
  *
- * The array of functions must contain the following pointers, in order:
+ * The array of functions must contain the following pointers, in order.
  * char* (*js_node_name)(const char* node);
  * char* (*js_node_classes)(const char* node);
  * char* (*js_node_id)(const char* node);
@@ -140,20 +883,6 @@ css_js_error get_style (const char* element, const char* pseudo,
  * 		const char* node, const char* search, const char* empty_match);
  * bool (*js_node_has_id)(
  * 		const char* node, const char* search, const char* empty_match);
- * bool (*js_node_has_attribute)(
- * 		const char* node, const char* search, const char* empty_match);
- * bool (*js_node_has_attribute_equal)(
- * 		const char* node, const char* search, const char* match);
- * bool (*js_node_has_attribute_dashmatch)(
- * 		const char* node, const char* search, const char* match);
- * bool (*js_node_has_attribute_includes)(
- * 		const char* node, const char* search, const char* match);
- * bool (*js_node_has_attribute_prefix)(
- * 		const char* node, const char* search, const char* match);
- * bool (*js_node_has_attribute_suffix)(
- * 		const char* node, const char* search, const char* match);
- * bool (*js_node_has_attribute_substring)(
- * 		const char* node, const char* search, const char* match);
  * bool (*js_node_is_root)(
  * 		const char* node, const char* empty_search,
  * 		const char* empty_match);
@@ -191,8 +920,17 @@ css_js_error get_style (const char* element, const char* pseudo,
  * 		const char* empty_match);
  * bool (*js_node_is_lang)(
  * 		const char* node, const char* search, const char* empty_match);
- * int32_t (*js_ua_font_size)(void);
+ * char* (*js_node_attributes)(const char* node);
+ *
+ * js_node_attributes returns the count of attributes of the node followed
+ * by their names and values, all null-terminated, in a buffer that is
+ * freed by the caller.
  */ 
 css_js_error set_handlers(uint64_t* arr, size_t len);
 
+/*
+ * Writes to <count> the count of handlers taken by set_handlers.
+ */
+css_js_error get_handler_count (uint32_t* count);
+
 #endif
@@ -2,8 +2,42 @@ module.exports = {
   Module: Module,
   Runtime: Runtime,
   setHandlers: _set_handlers,
+  getHandlerCount: _get_handler_count,
   resetCtx: _reset_ctx,
   addSheet: _add_stylesheet,
-  getStyle: _get_style
+  parseStylesheet: _parse_stylesheet,
+  attachStylesheet: _attach_stylesheet,
+  releaseStylesheet: _release_stylesheet,
+  attachHtmlStylesheet: _attach_html_stylesheet,
+  getStyle: _get_style,
+  getStyleMedia: _get_style_media,
+  getStyleId: _get_style_id,
+  getStyleHandle: _get_style_handle,
+  getHandleProperty: _get_handle_property,
+  releaseStyleHandle: _release_style_handle,
+  exportColumns: _export_columns,
+  getNumericProperties: _get_numeric_properties,
+  getStyleNumeric: _get_style_numeric,
+  attributeChanged: _attribute_changed,
+  stateChanged: _state_changed,
+  childrenChanged: _children_changed,
+  nodeRemoved: _node_removed,
+  dropNodes: _drop_nodes,
+  getNodeParent: _get_node_parent,
+  setHints: _set_hints,
+  loadDocument: _load_document,
+  unloadDocument: _unload_document,
+  getMemoryStats: _get_memory_stats,
+  createContext: _create_context,
+  useContext: _use_context,
+  destroyContext: _destroy_context,
+  deriveContext: _derive_context,
+  setEnvironment: _set_environment,
+  setProfiling: _set_profiling,
+  getProfile: _get_profile,
+  setCoverage: _set_coverage,
+  getCoverage: _get_coverage,
+  getPrunedSheet: _get_pruned_sheet,
+  getSheetStats: _get_sheet_stats
 };
 
@@ -0,0 +1,134 @@
+/*
+ * soak.js
+ * Copyright 2017 Lucas Neves <lcneves@gmail.com>
+ *
+ * Soak test: runs many addSheet / getStyle / dropSheets cycles, with inline
+ * styles that change every cycle, and checks that the native memory use
+ * stays flat.
+ * Part of the libcss.js project.
+ *
+ * Usage: node test/soak.js [cycles] [samples]
+ */
+
+'use strict';
+
+const libcss = require('../index.js');
+
+const cycles = parseInt(process.argv[2], 10) || 1000000;
+const samples = parseInt(process.argv[3], 10) || 20;
+// Cycles run before the first sample, for caches to reach their size.
+const warmup = Math.min(1000, Math.floor(cycles / 10));
+// Heap growth tolerated between the first and last samples, in bytes.
+const heapSlack = 64 * 1024;
+
+const textRed = "\x1b[31m";
+const textGreen = "\x1b[32m";
+const textReset = "\x1b[0m";
+
+// html > body > (div.a#first > p, div.b > span, p)
+var elements = {};
+var cycle = 0;
+
+function makeElement (id, tagName, parent, attributes) {
+  var element = {
+    id: id,
+    tagName: tagName,
+    parent: parent,
+    children: [],
+    attributes: attributes || []
+  };
+  if (parent !== null)
+    parent.children.push(element);
+  elements[id] = element;
+  return element;
+}
+
+var html = makeElement('html', 'html', null);
+var body = makeElement('body', 'body', html);
+var first = makeElement('first', 'div', body, [
+  { attribute: 'class', value: 'a' },
+  { attribute: 'id', value: 'first' }
+]);
+makeElement('first-p', 'p', first);
+var second = makeElement('second', 'div', body,
+  [ { attribute: 'class', value: 'b' } ]);
+makeElement('second-span', 'span', second);
+makeElement('last', 'p', body);
+
+libcss.init({
+  getTagName: function (identifier) {
+    return elements[identifier].tagName;
+  },
+  getAttributes: function (identifier) {
+    // A different inline style every cycle
+    return elements[identifier].attributes.concat([ {
+      attribute: 'style',
+      value: 'width: ' + (cycle % 997) + 'px; color: #' +
+        ((cycle * 7919) % 0xffffff).toString(16).padStart(6, '0')
+    } ]);
+  },
+  getSiblings: function (identifier) {
+    var parent = elements[identifier].parent;
+    var siblings = parent === null ? [ elements[identifier] ] : parent.children;
+    return siblings.map((s) => ({ tagName: s.tagName, identifier: s.id }));
+  },
+  getAncestors: function (identifier) {
+    var ancestors = [];
+    for (let e = elements[identifier].parent; e !== null; e = e.parent) {
+      ancestors.push({ tagName: e.tagName, identifier: e.id });
+    }
+    return ancestors;
+  },
+  isEmpty: function (identifier) {
+    return elements[identifier].children.length === 0;
+  }
+});
+
+function runCycle () {
+  libcss.addSheet('body > div.a { margin: ' + (cycle % 13) + 'px } ' +
+    'div + div span { display: none } p:first-child { color: red } ' +
+    '#first { padding: 1em }');
+  libcss.addSheet('* { font-size: ' + (10 + cycle % 7) + 'px }',
+    { origin: 'user' });
+  for (let id in elements) {
+    libcss.getStyle(id);
+  }
+  libcss.dropSheets();
+  libcss.childrenChanged();
+}
+
+var history = [];
+var interval = Math.max(1, Math.floor((cycles - warmup) / samples));
+var start = Date.now();
+
+for (cycle = 0; cycle < cycles; cycle++) {
+  runCycle();
+  if (cycle >= warmup && (cycle - warmup) % interval === 0) {
+    let stats = libcss.getMemoryStats();
+    history.push(stats);
+    console.info('Cycle ' + cycle + ': ' + JSON.stringify(stats));
+  }
+}
+
+var firstStats = history[0];
+var lastStats = history[history.length - 1];
+var err = '';
+
+if (lastStats.heap - firstStats.heap > heapSlack) {
+  err += 'Heap grew from ' + firstStats.heap + ' to ' + lastStats.heap +
+    ' bytes\n';
+}
+for (let stat of [ 'strings', 'nodes', 'styles', 'sheets', 'shares' ]) {
+  if (lastStats[stat] > firstStats[stat]) {
+    err += 'Count of ' + stat + ' grew from ' + firstStats[stat] + ' to ' +
+      lastStats[stat] + '\n';
+  }
+}
+
+console.info(cycles + ' cycles in ' + (Date.now() - start) + ' ms');
+if (err) {
+  console.error('Soak test' + textRed + ' FAIL!' + textReset);
+  console.error(err);
+  throw new Error('Soak test failed!');
+}
+console.info('Soak test' + textGreen + ' succeeded!' + textReset);
@@ -2,18 +2,36 @@
  * test.js
  * Copyright 2017 Lucas Neves <lcneves@gmail.com>
  *
- * This test uses the data file for NetSurf libcss's selection test.
+ * This test uses the data files for NetSurf libcss's selection test.
  * Part of the libcss.js project.
+ *
+ * Every case is timed (stylesheet parsing and style resolution). On request,
+ * the timings are compared with test/baseline.json, where the cases that got
+ * much slower are flagged. Machines differ in speed, so a case is compared
+ * by its share of the time of all the cases, not by its absolute time.
+ * Options:
+ *   --check-timings        list the cases that got slower than the tolerance.
+ *   --update-baseline      write the timings of this run as the baseline.
+ *   --fail-on-regression   same as --check-timings, and fail if any did.
+ *   --tolerance <factor>   growth of a case's share of the total time
+ *                          flagged as a regression (default 3).
  */
 
 'use strict';
 
 const path = require('path');
 const fs = require('fs');
+const os = require('os');
+const childProcess = require('child_process');
 const libcss = require('../index.js');
 
 const DEFAULT_FONT_SIZE = 12;
 
+const BASELINE_PATH = path.join(__dirname, 'baseline.json');
+// Slowdowns under this many milliseconds are noise, such as a garbage
+// collection during the case, whatever the factor.
+const MIN_REGRESSION_MS = 20;
+
 const textRed = "\x1b[31m";
 const textGreen = "\x1b[32m";
 const textReset = "\x1b[0m";
@@ -26,6 +44,22 @@ var media = '';
 var targetMedia = '';
 var succeeded = true;
 
+var args = process.argv.slice(2);
+var updateBaseline = args.indexOf('--update-baseline') !== -1;
+var failOnRegression = args.indexOf('--fail-on-regression') !== -1;
+var checkTimings = failOnRegression ||
+  args.indexOf('--check-timings') !== -1;
+var tolerance = args.indexOf('--tolerance') !== -1
+  ? parseFloat(args[args.indexOf('--tolerance') + 1]) : 3;
+
+var baseline = {};
+try {
+  baseline = JSON.parse(fs.readFileSync(BASELINE_PATH, 'utf8'));
+} catch (e) {
+  // No baseline yet
+}
+var timings = {};
+
 function getElementById (identifier) {
   if (typeof elements[identifier] === 'undefined')
     throw new Error('Unable to find element with identifier "' + identifier
@@ -62,16 +96,28 @@ var handlers = {
     }
     return ancestors;
   },
+  getChildren: function (identifier) {
+    var element = getElementById(identifier);
+    return element.children.map(child =>
+      ({ tagName: child.tagName, identifier: child.id }));
+  },
   isEmpty: function (identifier) {
     var element = getElementById(identifier);
     return (element.children[0] === undefined);
   },
+  isHover: function (identifier) {
+    var element = getElementById(identifier);
+    return element.hover === true;
+  },
   uaFontSize: function () {
     return DEFAULT_FONT_SIZE * 10;
   }
 };
 
-libcss.init(handlers);
+// A loaded document needs no handlers, so this runs before init().
+testDocumentStates();
+
+libcss.init(handlers, { incremental: true });
 
 function makeElement (tagName, parentElement, num) {
   var element = {
@@ -119,31 +165,126 @@ function findParent(currentElement, currentDepth, newDepth) {
   return parentElement;
 }
 
-var testFiles = [ 'tests1.dat' ];
+function elapsedMs (start) {
+  return Number(process.hrtime.bigint() - start) / 1e6;
+}
+
 var paths = [];
-// Attempt to find .dat files in LibCSS's select test dir; fallback to current
-// directory if not found.
-for (let f of testFiles) {
-  var dat_path = path.join(__dirname, '..', 'src', 'libcss', 'test', 'data',
-    'select', f);
+// Run every .dat file in LibCSS's select test dir; fallback to the ones in
+// the current directory if not found.
+var selectDir = path.join(__dirname, '..', 'src', 'libcss', 'test', 'data',
+  'select');
+for (let dir of [ selectDir, __dirname ]) {
+  let files = [];
   try {
-    fs.statSync(dat_path, fs.constants.R_OK);
+    files = fs.readdirSync(dir).filter((f) => path.extname(f) === '.dat');
   } catch (e) {
-    dat_path = path.join(__dirname, f);
+    // No such directory
+  }
+  if (files.length > 0) {
+    paths = files.sort().map((f) => path.join(dir, f));
+    break;
   }
-  paths.push(dat_path);
 }
 
 for (let dat_path of paths) {
   runTest(dat_path);
 }
 
+testSiblings();
+testSharing();
+testInvalidation();
+testUnnotified();
+testPseudo();
+testMedia();
+testStyleIds();
+testColumns();
+testHandles();
+testNumeric();
+testDocument();
+testStream();
+testCommandLine();
+testContexts();
+testSharedSheets();
+testDerive();
+testDefaultSheet();
+testEnvironment();
+testHints();
+testAttributes();
+testProfile();
+testProfilePasses();
+testCoverage();
+testPruning();
+testSheetStats();
+
+if (!succeeded)
+  throw new Error('Selection test failed!');
+
+if (updateBaseline) {
+  fs.writeFileSync(BASELINE_PATH, JSON.stringify(timings, null, 2) + '\n');
+  console.info('Baseline written to ' + BASELINE_PATH);
+}
+
+var regressions = checkTimings ? findRegressions() : [];
+if (regressions.length > 0) {
+  console.error(textRed + regressions.length + ' case(s) slower than ' +
+    tolerance + 'x the baseline:' + textReset);
+  for (let regression of regressions) {
+    console.error('  ' + regression);
+  }
+  if (failOnRegression)
+    throw new Error('Performance regression!');
+}
+
+/*
+ * Compares the timings of the cases that are also in the baseline. Each
+ * case's baseline time is scaled by how much faster or slower this run was
+ * overall, so that only the cases whose share of the total time grew are
+ * flagged.
+ */
+function findRegressions () {
+  var found = [];
+  for (let phase of [ 'sheets', 'style' ]) {
+    let cases = [];
+    let total = 0;
+    let baselineTotal = 0;
+    for (let fileName in timings) {
+      let fileBaseline = baseline[fileName] || {};
+      for (let testNum in timings[fileName]) {
+        let expected = fileBaseline[testNum];
+        if (expected === undefined)
+          continue;
+        let ms = timings[fileName][testNum][phase];
+        cases.push({ name: fileName + ' test ' + testNum, ms: ms,
+          baselineMs: expected[phase] });
+        total += ms;
+        baselineTotal += expected[phase];
+      }
+    }
+    if (total === 0 || baselineTotal === 0)
+      continue;
+
+    for (let item of cases) {
+      let expectedMs = item.baselineMs * total / baselineTotal;
+      if (item.ms > expectedMs * tolerance &&
+        item.ms - expectedMs > MIN_REGRESSION_MS) {
+        found.push(item.name + ' ' + phase + ': ' + item.ms.toFixed(3) +
+          ' ms, ' + expectedMs.toFixed(3) + ' ms expected from the baseline');
+      }
+    }
+  }
+  return found;
+}
+
 function runTest (dat_path) {
   var data = fs.readFileSync(dat_path, 'utf8');
   console.info('Using data file ' + dat_path);
 
   var testDataArr = data.split('#reset').map((item) => item.trim());
   var testNum = 1;
+  var fileName = path.basename(dat_path);
+  var fileTimings = timings[fileName] = {};
+  var fileSucceeded = true;
 
   for (let testData of testDataArr) {
     if (!testData) continue;
@@ -159,6 +300,7 @@ function runTest (dat_path) {
     let queryElement = null;
 
     let parsedCSS = [];
+    let sheetsMs = 0;
 
     let lines = testParts[0].split('\n').map((item) => item.trim());
     for (let line of lines) {
@@ -211,13 +353,21 @@ function runTest (dat_path) {
       }
       else {
         parsedCSS.push({ css: line, origin: origin, media: media });
+        let start = process.hrtime.bigint();
         libcss.addSheet(line, { origin: origin, media: media });
+        sheetsMs += elapsedMs(start);
       }
     }
 
+    let start = process.hrtime.bigint();
     let results = libcss.getStyle(queryElement.id, { media: targetMedia });
+    let styleMs = elapsedMs(start);
     let err = '';
 
+    fileTimings[testNum] = {
+      sheets: Math.round(sheetsMs * 1000) / 1000,
+      style: Math.round(styleMs * 1000) / 1000
+    };
     for (let property in expectedResults) {
       if (expectedResults.hasOwnProperty(property)) {
         if (results[property] !== expectedResults[property]) {
@@ -229,6 +379,7 @@ function runTest (dat_path) {
     }
     if (err) {
       succeeded = false;
+      fileSucceeded = false;
       console.log('\n');
       console.error('Test ' + testNum + textRed + ' FAIL!' + textReset);
       console.error(err);
@@ -240,15 +391,1027 @@ function runTest (dat_path) {
       console.dir(parsedCSS);
       console.log('\n');
     } else {
-      console.info('Test ' + testNum + textGreen + ' PASS!' + textReset);
+      console.info('Test ' + testNum + textGreen + ' PASS!' + textReset +
+        ' (sheets ' + sheetsMs.toFixed(3) + ' ms, style ' +
+        styleMs.toFixed(3) + ' ms)');
     }
     testNum++;
     elements = {};
     libcss.dropSheets();
   }
-  if (succeeded)
+  if (fileSucceeded)
     console.info('Selection test succeeded!');
   else
-    throw new Error('Selection test failed!');
+    console.error(textRed + 'Selection test failed!' + textReset);
+  console.log('');
+}
+
+// Checks the properties of a computed style against the expected values.
+function expectStyle (name, style, expected) {
+  var err = '';
+  for (let property of Object.keys(expected)) {
+    if (style[property] !== expected[property]) {
+      err += 'Expected: ' + property + ': ' + expected[property] + '\n'
+        + 'Verified: ' + property + ': ' + style[property] + '\n';
+    }
+  }
+  if (err) {
+    succeeded = false;
+    console.error(name + textRed + ' FAIL!' + textReset);
+    console.error(err);
+  } else {
+    console.info(name + textGreen + ' PASS!' + textReset);
+  }
+}
+
+function expectError (name, fn) {
+  try {
+    fn();
+  } catch (e) {
+    console.info(name + textGreen + ' PASS!' + textReset);
+    return;
+  }
+  succeeded = false;
+  console.error(name + textRed + ' FAIL!' + textReset + ' (no error)');
+}
+
+function testSiblings () {
+  console.info('Sibling index test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var list = makeElement('div', body, count++);
+  var children = [];
+  for (let tagName of [ 'p', 'span', 'p', 'span', 'span' ]) {
+    children.push(makeElement(tagName, list, count++));
+  }
+
+  libcss.addSheet(':nth-child(2) { color: red } p + span { float: left } ' +
+    'p ~ p { clear: both } span:nth-of-type(3) { display: none }');
+  var styles = children.map((child) => libcss.getStyle(child.id));
+  expectStyle('Siblings :nth-child', styles[1], { color: '#ffff0000' });
+  expectStyle('Siblings +', styles[3], { float: 'left' });
+  expectStyle('Siblings ~', styles[2], { clear: 'both' });
+  expectStyle('Siblings :nth-of-type', styles[4], { display: 'none' });
+
+  // Reversed: the index of the parent must be rebuilt
+  list.children.reverse();
+  libcss.childrenChanged(list.id);
+  styles = children.map((child) => libcss.getStyle(child.id));
+  expectStyle('Siblings reordered :nth-child', styles[3],
+    { color: '#ffff0000' });
+  expectStyle('Siblings reordered +', styles[1], { float: 'left' });
+  expectStyle('Siblings reordered ~', styles[0], { clear: 'both' });
+  expectStyle('Siblings reordered :nth-of-type', styles[1],
+    { display: 'none' });
+
+  // Indexing the siblings doesn't look their parent up
+  var lastSiblings = null;
+  var parentLookups = 0;
+  var counted = Object.assign({}, handlers, {
+    getSiblings: function (identifier) {
+      lastSiblings = identifier;
+      return handlers.getSiblings(identifier);
+    },
+    getAncestors: function (identifier) {
+      if (identifier === lastSiblings)
+        parentLookups++;
+      lastSiblings = null;
+      return handlers.getAncestors(identifier);
+    }
+  });
+  var context = libcss.createContext({ handlers: counted });
+  context.addSheet('p + span, p ~ span { color: red }');
+  children.forEach((child) => context.getStyle(child.id));
+  context.destroy();
+  expectStyle('Siblings without ancestors', { calls: parentLookups },
+    { calls: 0 });
+
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testSharing () {
+  console.info('Style sharing test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var list = makeElement('ul', body, count++);
+  var items = [];
+  for (let i = 0; i < 5; i++) {
+    items.push(makeElement('li', list, count++));
+  }
+  items[2].attributes.push({ attribute: 'class', value: 'a' });
+  items[3].attributes.push({ attribute: 'title', value: 'x' });
+  var link = makeElement('a', items[1], count++);
+  var other = makeElement('a', items[4], count++);
+
+  libcss.addSheet('li { color: red } li.a { float: left } ' +
+    'li:first-child { clear: both } li[title] { display: none } ' +
+    'li + li > a { color: blue }');
+  var styles = items.map((item) => libcss.getStyle(item.id));
+  expectStyle('Sharing first child', styles[0], { clear: 'both' });
+  expectStyle('Sharing plain', styles[1],
+    { color: '#ffff0000', clear: 'none', float: 'none' });
+  expectStyle('Sharing class', styles[2], { float: 'left' });
+  expectStyle('Sharing attribute', styles[3], { display: 'none' });
+  expectStyle('Sharing same key', styles[4],
+    { color: '#ffff0000', display: 'inline', float: 'none' });
+  expectStyle('Sharing child', libcss.getStyle(link.id),
+    { color: '#ff0000ff' });
+  expectStyle('Sharing child of a shared parent', libcss.getStyle(other.id),
+    { color: '#ff0000ff' });
+
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testInvalidation () {
+  console.info('Invalidation test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var div = makeElement('div', body, count++);
+  var first = makeElement('p', div, count++);
+  first.attributes.push({ attribute: 'class', value: 'a' });
+  var second = makeElement('p', div, count++);
+  var span = makeElement('span', first, count++);
+  var all = [ div, first, second, span ];
+
+  // Counts the calls to the handlers, which selections make
+  var calls = 0;
+  var original = Object.assign({}, handlers);
+  for (let name of Object.keys(original)) {
+    handlers[name] = function () {
+      calls++;
+      return original[name].apply(this, arguments);
+    };
+  }
+  var styleAll = () => {
+    calls = 0;
+    return all.map((element) => libcss.getStyle(element.id));
+  };
+
+  libcss.addSheet('.a { color: red } .b { color: blue } ' +
+    '.a + p { float: left } .a span { clear: both } ' +
+    'p:first-child { display: none } em { float: right } ' +
+    'p:hover { color: green }');
+  var styles = styleAll();
+  expectStyle('Invalidation before', styles[2], { float: 'left' });
+
+  first.attributes[0].value = 'b';
+  libcss.attributeChanged(first.id, 'class');
+  styles = styleAll();
+  expectStyle('Invalidation attribute', styles[1], { color: '#ff0000ff' });
+  expectStyle('Invalidation sibling', styles[2], { float: 'none' });
+  expectStyle('Invalidation descendant', styles[3], { clear: 'none' });
+
+  // Changes that no selector depends on restyle nothing
+  styleAll();
+  var known = calls;
+  div.attributes.push({ attribute: 'lang', value: 'en' });
+  libcss.attributeChanged(div.id, 'lang');
+  styleAll();
+  expectStyle('Invalidation unused attribute', { calls: calls },
+    { calls: known });
+  first.attributes[0].value = 'b c';
+  libcss.attributeChanged(first.id, 'class', 'b');
+  styleAll();
+  expectStyle('Invalidation unused class', { calls: calls },
+    { calls: known });
+  libcss.stateChanged(second.id, 'focus');
+  styleAll();
+  expectStyle('Invalidation unused state', { calls: calls },
+    { calls: known });
+
+  second.hover = true;
+  libcss.stateChanged(second.id, 'hover');
+  expectStyle('Invalidation state', libcss.getStyle(second.id),
+    { color: '#ff008000' });
+
+  div.children.reverse();
+  libcss.childrenChanged(div.id);
+  styles = styleAll();
+  expectStyle('Invalidation children first', styles[2], { display: 'none' });
+  expectStyle('Invalidation children second', styles[1],
+    { display: 'inline' });
+
+  // The identifier of a removed node may be reused by a new one
+  var nodes = libcss.getMemoryStats().nodes;
+  libcss.nodeRemoved(span.id);
+  first.children = [];
+  expectStyle('Invalidation nodeRemoved forgets', libcss.getMemoryStats(),
+    { nodes: nodes - 1 });
+  var em = makeElement('em', first, Number(span.id));
+  expectStyle('Invalidation nodeRemoved', libcss.getStyle(em.id),
+    { float: 'right' });
+
+  Object.assign(handlers, original);
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+// Without the incremental option, nothing is kept between queries, so
+// changes need no notifications.
+function testUnnotified () {
+  console.info('Unnotified mutation test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var first = makeElement('p', body, count++);
+  var second = makeElement('p', body, count++);
+
+  var context = libcss.createContext({ handlers: handlers });
+  context.addSheet('.a { color: red } p:first-child { float: left }');
+  expectStyle('Unnotified before', context.getStyle(first.id),
+    { color: '#ff000000', float: 'left' });
+  expectStyle('Unnotified nothing kept', context.getMemoryStats(),
+    { nodes: 0 });
+
+  first.attributes.push({ attribute: 'class', value: 'a' });
+  body.children.reverse();
+  expectStyle('Unnotified attribute', context.getStyle(first.id),
+    { color: '#ffff0000', float: 'none' });
+  expectStyle('Unnotified siblings', context.getStyle(second.id),
+    { float: 'left' });
+  context.destroy();
+
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testPseudo () {
+  console.info('Pseudo-element test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var p = makeElement('p', body, count++);
+
+  libcss.addSheet('p { color: red } p::before { color: blue } ' +
+    'p::after { float: left }');
+  var styles = libcss.getStyle(p.id, { pseudo: 'all' });
+  expectStyle('Pseudo all', styles, { 'first-line': undefined });
+  expectStyle('Pseudo all element', styles.none || {},
+    { color: '#ffff0000' });
+  expectStyle('Pseudo all before', styles.before || {},
+    { color: '#ff0000ff' });
+  // Pseudo-elements inherit from their element
+  expectStyle('Pseudo all after', styles.after || {},
+    { color: '#ffff0000', float: 'left' });
+  expectStyle('Pseudo before', libcss.getStyle(p.id, { pseudo: 'before' }),
+    { color: '#ff0000ff' });
+  expectStyle('Pseudo unmatched',
+    { count: Object.keys(libcss.getStyle(p.id, { pseudo: 'first-line' }))
+      .length }, { count: 0 });
+
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testMedia () {
+  console.info('Media test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var p = makeElement('p', body, count++);
+
+  libcss.addSheet('p { color: red } @media print { p { color: blue } }');
+  libcss.addSheet('p { float: left }', { media: [ 'screen' ] });
+  var styles = libcss.getStyle(p.id,
+    { media: [ 'screen', 'print', 'tv', 'handheld' ] });
+  expectStyle('Media screen', styles.screen, { color: '#ffff0000',
+    float: 'left' });
+  expectStyle('Media print', styles.print, { color: '#ff0000ff',
+    float: 'none' });
+  expectStyle('Media tv', styles.tv, { color: '#ffff0000', float: 'none' });
+  // Selected from the same rules as tv
+  expectStyle('Media equivalent', styles, { handheld: styles.tv });
+  expectStyle('Media single', libcss.getStyle(p.id, { media: 'print' }),
+    { color: '#ff0000ff' });
+
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testStyleIds () {
+  console.info('Style id test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var first = makeElement('p', body, count++);
+  var second = makeElement('p', body, count++);
+  var third = makeElement('p', body, count++);
+  third.attributes.push({ attribute: 'class', value: 'a' });
+  var span = makeElement('span', body, count++);
+
+  libcss.addSheet('p { color: red } .a { color: blue } span { color: red }');
+  var id = libcss.getStyleId(first.id);
+  expectStyle('Style id', { nonzero: id > 0 }, { nonzero: true });
+  expectStyle('Style id shared', { id: libcss.getStyleId(second.id) },
+    { id: id });
+  expectStyle('Style id same style', { id: libcss.getStyleId(span.id) },
+    { id: id });
+  expectStyle('Style id differs', { same: libcss.getStyleId(third.id) === id },
+    { same: false });
+
+  third.attributes = [];
+  libcss.attributeChanged(third.id, 'class', 'a');
+  expectStyle('Style id restyled', { id: libcss.getStyleId(third.id) },
+    { id: id });
+  expectStyle('Style id no pseudo-element',
+    { id: libcss.getStyleId(first.id, { pseudo: 'before' }) }, { id: 0 });
+
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testColumns () {
+  console.info('Column export test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var p = makeElement('p', body, count++);
+  var div = makeElement('div', body, count++);
+
+  libcss.addSheet('p { width: 50px; color: red } ' +
+    'div { width: 2em; display: none }');
+  var text = libcss.getMemoryStats().text;
+  var columns = libcss.exportColumns([ p.id, div.id, p.id ],
+    [ 'width', 'color', 'display' ]);
+  // Columns are read from the styles, which are never formatted as text
+  expectStyle('Columns without text', libcss.getMemoryStats(), { text: text });
+  var width = columns.width;
+  expectStyle('Columns width', { value: Array.from(width.value).join(),
+    unit: Array.from(width.unit).join() },
+    { value: '50,2,50', unit: '0,2,0' });
+  expectStyle('Columns color', { type: width.value.constructor.name,
+    color: columns.color.value[0] }, { type: 'Float32Array',
+    color: 0xffff0000 });
+  expectStyle('Columns keyword', { value: columns.display.value,
+    differs: columns.display.type[0] !== columns.display.type[1],
+    same: columns.display.type[0] === columns.display.type[2] },
+    { value: undefined, differs: true, same: true });
+  expectError('Columns unknown property',
+    () => libcss.exportColumns([ p.id ], [ 'content' ]));
+
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testNumeric () {
+  console.info('Numeric style test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var p = makeElement('p', body, count++);
+
+  libcss.addSheet('p { color: red; width: 50%; display: block }');
+  var style = libcss.getStyle(p.id, { numeric: true });
+  // CSS_DISPLAY_BLOCK and CSS_FLOAT_NONE
+  expectStyle('Numeric keywords', style, { display: 2, float: 3 });
+  expectStyle('Numeric color', style, { color: 0xffff0000 });
+  // CSS_WIDTH_SET, in percent
+  expectStyle('Numeric length', style.width,
+    { type: 1, value: 50, unit: 21 });
+  expectError('Numeric for several media', function () {
+    libcss.getStyle(p.id, { numeric: true, media: ['screen', 'print'] });
+  });
+
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testDocument () {
+  console.info('Document test');
+  libcss.addSheet('p { color: red } div p { float: left } ' +
+    '.a { clear: both } #b { color: blue } p:hover { color: green }');
+  var ids = libcss.loadDocument({
+    identifier: 'html', tagName: 'html',
+    children: [
+      { identifier: 'p', tagName: 'p', children: [ 'text' ] },
+      { identifier: 'div', tagName: 'div', attributes: { 'class': 'a' },
+        children: [ { tagName: 'p', attributes: { id: 'b' } } ] }
+    ]
+  });
+  expectStyle('Document order', { length: ids.length, first: ids[0] },
+    { length: 4, first: 'html' });
+  expectStyle('Document p', libcss.getStyle('p'),
+    { color: '#ffff0000', float: 'none' });
+  expectStyle('Document class', libcss.getStyle('div'), { clear: 'both' });
+  expectStyle('Document descendant and id', libcss.getStyle(ids[3]),
+    { color: '#ff0000ff', float: 'left' });
+  expectError('Document missing node', () => libcss.getStyle('missing'));
+  expectError('Document attributeChanged',
+    () => libcss.attributeChanged('p', 'class', ''));
+  expectError('Document stateChanged',
+    () => libcss.stateChanged('p', 'hover'));
+  expectError('Document childrenChanged',
+    () => libcss.childrenChanged('html'));
+  expectError('Document nodeRemoved', () => libcss.nodeRemoved('p'));
+
+  // Loaded again after a change, with generated identifiers
+  ids = libcss.loadDocument({
+    tagName: 'html', children: [ { tagName: 'div',
+      attributes: [ { attribute: 'class', value: 'a' } ] } ]
+  });
+  expectStyle('Document identifiers', ids, { length: 2 });
+  expectStyle('Document reloaded', libcss.getStyle(ids[1]),
+    { clear: 'both', float: 'none' });
+
+  libcss.unloadDocument();
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+// Reads the whole stream; records are pushed synchronously from read().
+function readStream (stream) {
+  var chunks = [];
+  var chunk;
+  while ((chunk = stream.read()) !== null)
+    chunks.push(Buffer.from(chunk));
+  return Buffer.concat(chunks);
+}
+
+function testDocumentStates () {
+  console.info('Document state test');
+  libcss.addSheet(
+    'input:enabled { color: blue } input:disabled { color: green } ' +
+    ':checked { float: left } ' +
+    ':lang(en) { clear: both } :lang(fr-ca) { clear: left }');
+  libcss.loadDocument({
+    identifier: 'html', tagName: 'html', attributes: { lang: 'en-US' },
+    children: [
+      { identifier: 'p', tagName: 'p', children: [ 'text' ] },
+      { identifier: 'enabled', tagName: 'input' },
+      { identifier: 'disabled', tagName: 'input',
+        attributes: { disabled: '' } },
+      { identifier: 'checked', tagName: 'input',
+        attributes: { type: 'checkbox', checked: '' } },
+      { identifier: 'selected', tagName: 'option',
+        attributes: { selected: '' } },
+      { identifier: 'french', tagName: 'div', attributes: { lang: 'FR-CA' },
+        children: [ { identifier: 'nested', tagName: 'span' } ] },
+      { identifier: 'english', tagName: 'div',
+        attributes: { lang: 'english' } }
+    ]
+  });
+
+  expectStyle('Document :lang inherited', libcss.getStyle('p'),
+    { clear: 'both' });
+  expectStyle('Document :enabled', libcss.getStyle('enabled'),
+    { color: '#ff0000ff', float: 'none' });
+  expectStyle('Document :disabled', libcss.getStyle('disabled'),
+    { color: '#ff008000' });
+  expectStyle('Document :checked', libcss.getStyle('checked'),
+    { float: 'left' });
+  expectStyle('Document :checked option', libcss.getStyle('selected'),
+    { float: 'left' });
+  expectStyle('Document :lang', libcss.getStyle('nested'),
+    { clear: 'left' });
+  expectStyle('Document :lang prefix', libcss.getStyle('english'),
+    { clear: 'none' });
+
+  libcss.unloadDocument();
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testStream () {
+  console.info('Style stream test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var div = makeElement('div', body, count++);
+  var p = makeElement('p', div, count++);
+  var span = makeElement('span', body, count++);
+
+  libcss.addSheet('p { color: red } div p { float: left }');
+  var records = readStream(libcss.styleTreeStream(body.id)).toString()
+    .split('\n').filter(line => line !== '').map(line => JSON.parse(line));
+  expectStyle('Stream order', {
+    ids: records.map(record => record.identifier).join(',')
+  }, { ids: [ body.id, div.id, p.id, span.id ].join(',') });
+  // Released nodes take their style sharing entries with them
+  expectStyle('Stream released memory', libcss.getMemoryStats(),
+    { nodes: 0, shares: 0 });
+  expectStyle('Stream style', records[2].style,
+    { color: '#ffff0000', float: 'left' });
+
+  var binary = readStream(libcss.styleTreeStream(p.id, { format: 'binary' }));
+  var length = binary.readUInt32LE(0);
+  expectStyle('Stream binary identifier',
+    { identifier: binary.toString('utf8', 4, 4 + length) },
+    { identifier: p.id });
+
+  // Released styles are computed again on demand
+  expectStyle('Stream released', libcss.getStyle(p.id),
+    { color: '#ffff0000', float: 'left' });
+
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testCommandLine () {
+  console.info('Command line test');
+  var dir = fs.mkdtempSync(path.join(os.tmpdir(), 'libcss-style-'));
+  var css = path.join(dir, 'style.css');
+  var tree = path.join(dir, 'tree.json');
+  fs.writeFileSync(css, 'p { color: red } div p { float: left }');
+  fs.writeFileSync(tree, JSON.stringify({
+    identifier: 'html', tagName: 'html',
+    children: [
+      { identifier: 'p', tagName: 'p' },
+      { identifier: 'div', tagName: 'div',
+        children: [ { identifier: 'q', tagName: 'p' } ] }
+    ]
+  }));
+
+  var run = (args) => childProcess.execFileSync(process.execPath,
+    [ path.join(__dirname, '..', 'bin', 'libcss-style'), css,
+      '--tree', tree ].concat(args))
+    .toString().split('\n').filter(line => line !== '')
+    .map(line => JSON.parse(line));
+  try {
+    var records = run([ '--jobs', '2' ]);
+    expectStyle('Command line order', {
+      ids: records.map(record => record.identifier).join(',')
+    }, { ids: 'html,p,div,q' });
+    expectStyle('Command line style', records[3].style,
+      { color: '#ffff0000', float: 'left' });
+    records = run([ '--node', 'p' ]);
+    expectStyle('Command line node',
+      { length: records.length, float: records[0].style.float },
+      { length: 1, float: 'none' });
+  } finally {
+    fs.rmSync(dir, { recursive: true });
+  }
+
+  console.log('');
+}
+
+function testContexts () {
+  console.info('Context test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var p = makeElement('p', body, count++);
+
+  var context = libcss.createContext({ handlers: handlers,
+    incremental: true });
+  libcss.addSheet('p { color: red }');
+  context.addSheet('p { color: blue }');
+  expectStyle('Context default', libcss.getStyle(p.id),
+    { color: '#ffff0000' });
+  expectStyle('Context own sheets', context.getStyle(p.id),
+    { color: '#ff0000ff' });
+
+  libcss.addSheet('p { color: blue }');
+  expectStyle('Context shared style id', { id: context.getStyleId(p.id) },
+    { id: libcss.getStyleId(p.id) });
+  context.addSheet('p { float: left }');
+  expectStyle('Context isolation', libcss.getStyle(p.id), { float: 'none' });
+
+  context.dropSheets();
+  expectStyle('Context dropSheets', context.getStyle(p.id),
+    { color: '#ff000000' });
+  context.destroy();
+
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testSharedSheets () {
+  console.info('Shared sheet test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var p = makeElement('p', body, count++);
+
+  var sheet = libcss.parseSheet('p { color: red; float: left }');
+  var context = libcss.createContext({ handlers: handlers });
+  libcss.addSheet(sheet);
+  context.addSheet(sheet, { media: [ 'print' ] });
+  // The contexts keep the sheet alive
+  sheet.release();
+  expectStyle('Shared sheet default', libcss.getStyle(p.id),
+    { color: '#ffff0000', float: 'left' });
+  expectStyle('Shared sheet context media', context.getStyle(p.id,
+    { media: 'screen' }), { float: 'none' });
+  expectStyle('Shared sheet context', context.getStyle(p.id,
+    { media: 'print' }), { color: '#ffff0000', float: 'left' });
+
+  libcss.dropSheets();
+  expectStyle('Shared sheet dropped', libcss.getStyle(p.id),
+    { float: 'none' });
+  expectStyle('Shared sheet still attached', context.getStyle(p.id,
+    { media: 'print' }), { float: 'left' });
+  context.destroy();
+
+  elements = {};
+  console.log('');
+}
+
+function testDerive () {
+  console.info('Derived context test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var p = makeElement('p', body, count++);
+  p.attributes.push({ attribute: 'class', value: 'a' });
+
+  libcss.addSheet('p { color: red }');
+  var derived = libcss.derive();
+  expectStyle('Derived inherits', derived.getStyle(p.id),
+    { color: '#ffff0000' });
+  derived.addSheet('.a { clear: both }');
+  libcss.addSheet('p { display: none }');
+  expectStyle('Derived own sheet', derived.getStyle(p.id),
+    { clear: 'both', display: 'inline' });
+  expectStyle('Derived base sheet', libcss.getStyle(p.id),
+    { clear: 'none', display: 'none' });
+
+  var second = derived.derive();
+  expectStyle('Derived same style id', { id: second.getStyleId(p.id) },
+    { id: derived.getStyleId(p.id) });
+  derived.destroy();
+  expectStyle('Derived from a context', second.getStyle(p.id),
+    { color: '#ffff0000', clear: 'both' });
+  second.destroy();
+  expectStyle('Derived base kept', libcss.getStyle(p.id),
+    { color: '#ffff0000', display: 'none' });
+
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testDefaultSheet () {
+  console.info('Default sheet test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var p = makeElement('p', body, count++);
+  var span = makeElement('span', p, count++);
+  var head = makeElement('head', root, count++);
+
+  libcss.addDefaultSheet();
+  libcss.addSheet('span { display: block }');
+  expectStyle('Default sheet p', libcss.getStyle(p.id), { display: 'block' });
+  expectStyle('Default sheet head', libcss.getStyle(head.id),
+    { display: 'none' });
+  // Author sheets come after the user-agent sheet
+  expectStyle('Default sheet overridden', libcss.getStyle(span.id),
+    { display: 'block' });
+
+  var context = libcss.createContext({ handlers: handlers });
+  context.addDefaultSheet();
+  expectStyle('Default sheet context', context.getStyle(p.id),
+    { display: 'block' });
+  context.destroy();
+
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testEnvironment () {
+  console.info('Environment test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var p = makeElement('p', body, count++);
+
+  libcss.addSheet('p { font-size: 2em }');
+  expectStyle('Environment from uaFontSize', libcss.getStyle(p.id),
+    { 'font-size': 2 * DEFAULT_FONT_SIZE + 'pt' });
+
+  var context = libcss.createContext({ handlers: handlers,
+    environment: { fontSize: 10 } });
+  context.addSheet('p { font-size: 2em; width: 2ex }');
+  expectStyle('Environment option', context.getStyle(p.id),
+    { 'font-size': '20pt', color: '#ff000000' });
+  context.setEnvironment({ color: '#ff0000', fontFamily: 'serif',
+    exRatio: 0.5 });
+  expectStyle('Environment changed', context.getStyle(p.id),
+    { 'font-size': '20pt', color: '#ffff0000', 'font-family': 'serif',
+      width: '1em' });
+  var derived = context.derive();
+  expectStyle('Environment derived', derived.getStyle(p.id),
+    { 'font-size': '20pt', color: '#ffff0000' });
+  derived.destroy();
+  context.destroy();
+
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testHints () {
+  console.info('Hints test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var p = makeElement('p', body, count++);
+  var div = makeElement('div', body, count++);
+
+  libcss.addSheet('p { width: 10px }');
+  libcss.setHints(p.id, [
+    { property: 'width', value: 50, unit: '%' },
+    { property: 'background-color', value: '#ff0000' },
+    { property: 'text-align', value: 'center' }
+  ]);
+  // Stylesheets override hints
+  expectStyle('Hints', libcss.getStyle(p.id),
+    { width: '10px', 'background-color': '#ffff0000',
+      'text-align': 'center' });
+
+  libcss.setHints({
+    [div.id]: [ { property: 'width', value: 5, unit: 'px' } ]
+  });
+  expectStyle('Hints batch', libcss.getStyle(div.id), { width: '5px' });
+  expectError('Hints unsupported property', () => libcss.setHints(div.id,
+    [ { property: 'bogus', value: 'x' } ]));
+  expectError('Hints invalid batch', () => libcss.setHints({
+    [div.id]: [ { property: 'width', value: 7, unit: 'px' } ],
+    [p.id]: [ { property: 'bogus', value: 'x' } ]
+  }));
+  expectStyle('Hints unchanged', libcss.getStyle(div.id), { width: '5px' });
+
+  libcss.setHints(p.id, []);
+  expectStyle('Hints removed', libcss.getStyle(p.id),
+    { 'background-color': '#00000000', 'text-align': 'default' });
+
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testAttributes () {
+  console.info('Attribute selector test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var a = makeElement('a', body, count++);
+  a.attributes.push({ attribute: 'title', value: 'one two' });
+  a.attributes.push({ attribute: 'lang', value: 'en-US' });
+  a.attributes.push({ attribute: 'href', value: 'http://example.com/a.PDF' });
+
+  libcss.addSheet('[title~=two] { color: red } [title~=on] { color: blue } ' +
+    '[lang|=en] { float: left } [href^="http:"] { clear: both } ' +
+    '[href$=".pdf"] { display: none } [href*=example] { position: relative } ' +
+    '[title="one two"] { visibility: hidden } [title*=""] { width: 5px } ' +
+    '[title=ON] { text-align: right }');
+  expectStyle('Attribute operators', libcss.getStyle(a.id), {
+    color: '#ffff0000', float: 'left', clear: 'both', display: 'none',
+    position: 'relative', visibility: 'hidden', width: 'auto' });
+
+  a.attributes[0].value = 'on';
+  a.attributes[1].value = 'english';
+  libcss.attributeChanged(a.id, 'title');
+  libcss.attributeChanged(a.id, 'lang');
+  expectStyle('Attribute changed', libcss.getStyle(a.id),
+    { color: '#ff0000ff', float: 'none', visibility: 'visible',
+      'text-align': 'right' });
+
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+// Checks the entries of a list, found by the value of their <key> member.
+function expectEntries (name, entries, key, expected) {
+  for (let id of Object.keys(expected)) {
+    let entry = entries.find((e) => String(e[key]) === id) || {};
+    expectStyle(name + ' ' + id, entry, expected[id]);
+  }
+}
+
+function testProfile () {
+  console.info('Profile test');
+  root = makeElement('root', null, count++);
+  var html = makeElement('html', root, count++);
+  var body = makeElement('body', html, count++);
+  var first = makeElement('div', body, count++);
+  first.attributes.push({ attribute: 'class', value: 'a' });
+  var p1 = makeElement('p', first, count++);
+  var p2 = makeElement('p', first, count++);
+  var second = makeElement('div', body, count++);
+  var span = makeElement('span', second, count++);
+  var all = [ html, body, first, p1, p2, second, span ];
+
+  libcss.addSheet('div.a p { color: red } p:first-child { float: left } ' +
+    'span { color: blue } .missing { color: green }',
+    { url: 'profile.css' });
+  libcss.startProfiling();
+  for (let element of all) {
+    libcss.getStyle(element.id);
+  }
+  libcss.stopProfiling();
+
+  var profile = libcss.getProfile();
+  expectStyle('Profile selections', profile, { selections: all.length });
+  expectEntries('Profile', profile.selectors, 'selector', {
+    'div.a p': { tests: 2, matches: 2, rule: 0, url: 'profile.css' },
+    'p:first-child': { tests: 2, matches: 1, rejects: 1 },
+    'span': { tests: 1, matches: 1, rule: 2 }
+  });
+  // Filed under a class no element has, so never tested
+  expectStyle('Profile candidates', profile.selectors, { length: 3 });
+  expectStyle('Profile top', libcss.getProfile(1).selectors, { length: 1 });
+
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testProfilePasses () {
+  console.info('Profile pass test');
+  root = makeElement('root', null, count++);
+  var html = makeElement('html', root, count++);
+  var body = makeElement('body', html, count++);
+  var first = makeElement('div', body, count++);
+  first.attributes.push({ attribute: 'class', value: 'a' });
+  var p1 = makeElement('p', first, count++);
+  var p2 = makeElement('p', first, count++);
+  var second = makeElement('div', body, count++);
+  var span = makeElement('span', second, count++);
+  var all = [ html, body, first, p1, p2, second, span ];
+
+  libcss.addSheet('div.a p { color: red } p:first-child { float: left } ' +
+    'span { color: blue } .missing { color: green }');
+  var derived = libcss.derive();
+  // Known before profiling starts, which must select them again
+  libcss.getStyle(p1.id);
+  derived.getStyle(span.id);
+
+  libcss.startProfiling();
+  libcss.startCoverage();
+  for (let element of all) {
+    libcss.getStyle(element.id);
+  }
+  derived.getStyle(span.id);
+  libcss.stopProfiling();
+  libcss.stopCoverage();
+
+  var profile = libcss.getProfile();
+  expectEntries('Profile pass', profile.selectors, 'selector', {
+    'div.a p': { tests: 2, matches: 2, exact: true },
+    'p:first-child': { tests: 2, matches: 1, exact: true },
+    'span': { tests: 2, matches: 2, exact: true }
+  });
+  expectStyle('Profile pass candidates', profile.selectors,
+    { length: 3 });
+
+  var coverage = libcss.getCoverage()[0];
+  expectEntries('Profile pass coverage', coverage.rules, 'selector', {
+    'div.a p': { matches: 2 },
+    'p:first-child': { matches: 1 },
+    'span': { matches: 2 },
+    '.missing': { matches: 0 }
+  });
+  expectStyle('Profile pass coverage used', coverage, { used: 3 });
+
+  derived.destroy();
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testCoverage () {
+  console.info('Coverage test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var p = makeElement('p', body, count++);
+  p.attributes.push({ attribute: 'class', value: 'a' });
+  var span = makeElement('span', body, count++);
+
+  libcss.addSheet('span, .a { color: red } p.a { float: left } ' +
+    '@media print { p { color: blue } } div { color: green }');
+  var derived = libcss.derive();
+  // Known before coverage starts, which must select them again
+  libcss.getStyle(p.id);
+  derived.getStyle(span.id);
+
+  libcss.startCoverage();
+  libcss.getStyle(p.id, { media: 'screen' });
+  libcss.getStyle(span.id, { media: 'screen' });
+  derived.getStyle(span.id, { media: 'screen' });
+  libcss.stopCoverage();
+
+  var coverage = libcss.getCoverage()[0];
+  expectStyle('Coverage sheet', coverage,
+    { sheet: 0, origin: 'author', used: 2 });
+  expectEntries('Coverage', coverage.rules, 'rule', {
+    0: { selector: 'span, .a', matches: 3 },
+    1: { selector: 'p.a', matches: 1 },
+    2: { selector: 'p', matches: 0 },
+    3: { selector: 'div', matches: 0 }
+  });
+
+  derived.destroy();
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testPruning () {
+  console.info('Pruning test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var p = makeElement('p', body, count++);
+  var span = makeElement('span', body, count++);
+
+  libcss.startCoverage();
+  libcss.addSheet('p { color: red } div { color: blue } ' +
+    '@media print { p { float: left } } ' +
+    '@media screen { span { float: right } em { clear: both } }');
+  libcss.getStyle(p.id, { media: 'screen' });
+  libcss.getStyle(span.id, { media: 'screen' });
+  libcss.stopCoverage();
+  // Added without coverage: nothing to prune it from
+  libcss.addSheet('a { color: red }');
+
+  expectStyle('Pruned sheet', { text: libcss.getPrunedSheet(0) }, {
+    text: 'p { color: red }\n@media screen {\n\tspan { float: right }\n}\n'
+  });
+  expectStyle('Pruned coverage', libcss.getCoverage()[1],
+    { prunable: false });
+  expectError('Pruned sheet without coverage',
+    () => libcss.getPrunedSheet(1));
+
+  elements = {};
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testSheetStats () {
+  console.info('Sheet statistics test');
+  var sheet = libcss.parseSheet('#x p { color: red } ' +
+    '.a.b, div > span + em { float: left } ' +
+    '@media print { * { color: blue } }');
+  var stats = libcss.sheetStats(sheet);
+  sheet.release();
+  expectStyle('Sheet statistics rules', stats,
+    { rules: 4, styleRules: 3, mediaRules: 1, selectors: 4 });
+  expectStyle('Sheet statistics simple selectors', stats.simpleSelectors,
+    { id: 1, 'class': 2, tag: 4, universal: 3 });
+  expectStyle('Sheet statistics combinators', stats.combinators,
+    { descendant: 1, child: 1, adjacent: 1, sibling: 0 });
+  expectStyle('Sheet statistics depth', stats.depth, { 0: 2, 1: 1, 2: 1 });
+  // Filed under the subject: p, .a and em, and * as universal
+  expectStyle('Sheet statistics hash', {
+    ids: stats.hash.ids.keys,
+    classes: stats.hash.classes.keys,
+    elements: stats.hash.elements.keys,
+    universal: stats.hash.universal
+  }, { ids: 0, classes: 1, elements: 2, universal: 1 });
+
+  libcss.addSheet('p { color: red }');
+  expectStyle('Sheet statistics by position', libcss.sheetStats(0),
+    { rules: 1, selectors: 1 });
+  libcss.dropSheets();
+  console.log('');
+}
+
+function testHandles () {
+  console.info('Style handle test');
+  root = makeElement('root', null, count++);
+  var body = makeElement('body', root, count++);
+  var p = makeElement('p', body, count++);
+  p.attributes.push({ attribute: 'class', value: 'a' });
+
+  libcss.addSheet('p { color: red; width: 10px } ' +
+    '.a { float: left; clear: both }');
+  var handle = libcss.getStyle(p.id, { lazy: true });
+  expectStyle('Handle get', { color: handle.get('color') },
+    { color: '#ffff0000' });
+  expectStyle('Handle property', handle, { width: '10px', float: 'left' });
+
+  // The handle keeps the style it was taken with
+  p.attributes = [];
+  libcss.attributeChanged(p.id, 'class', 'a');
+  expectStyle('Handle after restyle', handle, { clear: 'both' });
+  expectStyle('Handle restyled element', libcss.getStyle(p.id),
+    { float: 'none', clear: 'none' });
+  handle.release();
+
+  // Properties read through libcss's accessors are written as getStyle does
+  var q = makeElement('p', body, count++);
+  libcss.addSheet('p + p { width: 1.5em; height: 33.333%; ' +
+    'margin-left: -2.25px; text-indent: 0.001px; opacity: 0.5; ' +
+    'z-index: 3; position: relative; line-height: 1.2; ' +
+    'vertical-align: 10%; font-size: larger; font-weight: bold; ' +
+    'border-top-style: solid; border-top-width: thick; ' +
+    'text-align: center; max-width: none; float: right }');
+  var lazy = libcss.getStyle(q.id, { lazy: true });
+  var properties = Object.keys(libcss.getStyle(q.id, { numeric: true }));
+  var style = libcss.getStyle(q.id);
+  var expected = {};
+  var decoded = {};
+  for (let property of properties) {
+    expected[property] = style[property];
+    decoded[property] = lazy.get(property);
+  }
+  expectStyle('Handle accessors', decoded, expected);
+  expectStyle('Handle other property', lazy, { 'list-style-type': 'disc' });
+  lazy.release();
+
+  elements = {};
+  libcss.dropSheets();
   console.log('');
 }